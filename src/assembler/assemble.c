@@ -123,9 +123,9 @@ int main(int argc, char **argv) {
         address += 4;
         break;
       case LINE_INSTRUCTION: //TODO replace literal with value of label
-        if (parses[i].instr.instr_type == INSTR_BRANCH && (!strcmp(parses[i].instr.mnemonic, "b") 
-            || is_bcond_instruction(parses[i].instr.mnemonic))) {
-          if (label_conversion(symbol_table, &parses[i].instr.operands[0])) {
+        /* every branch but br ends with its target */
+        if (parses[i].instr.instr_type == INSTR_BRANCH && strcmp(parses[i].instr.mnemonic, "br")) {
+          if (label_conversion(symbol_table, &parses[i].instr.operands[parses[i].instr.operand_count - 1])) {
             fprintf(stderr, "[aj3124] Error parsing `b` or `b.cond` wrong operand.\n");
             fclose(in);
             fclose(out);
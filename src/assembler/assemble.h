@@ -33,6 +33,12 @@ typedef enum {
   TOKEN_MSUB,
   TOKEN_MUL,
   TOKEN_MNEG,
+  TOKEN_CSEL,
+  TOKEN_CSINC,
+  TOKEN_CSINV,
+  TOKEN_CSNEG,
+  TOKEN_CSET,
+  TOKEN_CINC,
   TOKEN_B,
   TOKEN_B_AL,
   TOKEN_B_EQ,
@@ -42,8 +48,40 @@ typedef enum {
   TOKEN_B_LT,
   TOKEN_B_NE,
   TOKEN_BR,
+  TOKEN_CBZ,
+  TOKEN_CBNZ,
+  TOKEN_TBZ,
+  TOKEN_TBNZ,
   TOKEN_STR,
   TOKEN_LDR,
+  TOKEN_STRB,
+  TOKEN_LDRB,
+  TOKEN_STRH,
+  TOKEN_LDRH,
+  TOKEN_LDRSW,
+  TOKEN_STP,
+  TOKEN_LDP,
+  TOKEN_LDXR,
+  TOKEN_LDAXR,
+  TOKEN_STXR,
+  TOKEN_STLXR,
+  TOKEN_LDAR,
+  TOKEN_STLR,
+  TOKEN_ADDV,
+  TOKEN_SMAXV,
+  TOKEN_SMINV,
+  TOKEN_UMAXV,
+  TOKEN_UMINV,
+  TOKEN_DUP,
+  TOKEN_UMOV,
+  TOKEN_LD1,
+  TOKEN_ST1,
+  TOKEN_DMB,
+  TOKEN_DSB,
+  TOKEN_ISB,
+  TOKEN_CLREX,
+  TOKEN_NOP,
+  TOKEN_MRS,
   TOKEN_INT
 } token_mnemonic_t;
 
@@ -52,6 +90,8 @@ typedef enum {
   INSTR_DATA_PROCESSING,
   INSTR_LOAD_STORE,
   INSTR_BRANCH,
+  INSTR_SYSTEM,
+  INSTR_SIMD,
 } instruction_type_t;
 
 typedef enum {
@@ -64,7 +104,8 @@ typedef enum {
   OPERAND_MEMORY_PRE_INDEX,
   OPERAND_MEMORY_UNSIGNED_OFFSET,
   OPERAND_MEMORY_REGISTER_OFFSET,
-  OPERAND_SHIFT
+  OPERAND_SHIFT,
+  OPERAND_VECTOR
 } operand_type_t;
 
 typedef enum { LSL = 0, LSR, ASR, ROR } shift_t;
@@ -78,6 +119,14 @@ typedef struct {
       bool is_64bit;
     } reg;
 
+    /* v1.4s, the element v1.s[2] or the scalar s1 */
+    struct {
+      u8 reg_num;
+      u8 size;  /* log2 of the bytes per lane */
+      bool q;   /* all 128 bits */
+      u8 index; /* of an element */
+    } vector;
+
     u32 immediate;
     i32 s_immediate;
     shift_t shift_type;
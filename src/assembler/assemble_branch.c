@@ -7,6 +7,8 @@
 #define BRANCH_OPC 0x14000000
 #define BRANCH_SIMM_26_BITMASK 0x03ffffff
 #define BRANCH_REG_MISC_BITS 0x21f
+#define COMPARE_BRANCH_OPC 0x34000000
+#define TEST_BRANCH_OPC 0x36000000
 
 #define BRANCH_AL_ENCODING 0xe
 #define BRANCH_EQ_ENCODING 0x0
@@ -64,6 +66,36 @@ u32 assemble_branch(instruction_IR_t *ps, u32 address) {
     assert(encoding_idx >= TOKEN_B_AL && encoding_idx <= TOKEN_B_NE);
     encoding = branch_encodings[encoding_idx - TOKEN_B_AL];
     insert_bits_u32(&instr, 0, 3, encoding);
+  } else if (ps->mnemonic_tok == TOKEN_CBZ || ps->mnemonic_tok == TOKEN_CBNZ) {
+    /* compare and branch: sf 011010 op simm19 Rt, op set for CBNZ */
+    operand_t rt = ps->operands[0];
+    assert(rt.reg.reg_num <= MAX_REG_NUM);
+    instr = COMPARE_BRANCH_OPC;
+    insert_bits_u32(&instr, 31, 31, rt.reg.is_64bit);
+    insert_bits_u32(&instr, 24, 24, ps->mnemonic_tok == TOKEN_CBNZ);
+
+    i32 raw_offset = ps->operands[1].literal_address - address;
+    i32 offset = raw_offset >> 2;
+
+    assert(offset > -(1 << 18) && offset <= (1 << 18));
+    insert_bits_u32(&instr, 5, 23, offset);
+    insert_bits_u32(&instr, 0, 4, rt.reg.reg_num);
+  } else if (ps->mnemonic_tok == TOKEN_TBZ || ps->mnemonic_tok == TOKEN_TBNZ) {
+    /* test and branch: b5 011011 op b40 simm14 Rt, testing bit b5:b40 */
+    operand_t rt = ps->operands[0];
+    u32 bit = ps->operands[1].immediate;
+    assert(rt.reg.reg_num <= MAX_REG_NUM && bit < (rt.reg.is_64bit ? 64 : 32));
+    instr = TEST_BRANCH_OPC;
+    insert_bits_u32(&instr, 31, 31, bit >> 5);
+    insert_bits_u32(&instr, 24, 24, ps->mnemonic_tok == TOKEN_TBNZ);
+    insert_bits_u32(&instr, 19, 23, bit);
+
+    i32 raw_offset = ps->operands[2].literal_address - address;
+    i32 offset = raw_offset >> 2;
+
+    assert(offset > -(1 << 13) && offset <= (1 << 13));
+    insert_bits_u32(&instr, 5, 18, offset);
+    insert_bits_u32(&instr, 0, 4, rt.reg.reg_num);
   } else {
     fprintf(stderr, "Invalid branch instruction mnemonic token: %d\n",
             ps->mnemonic_tok);
@@ -37,6 +37,12 @@
 #define MADD_OPCODE 0xd8
 #define MSUB_OPCODE 0xd8
 
+/* Conditional select instructions: op|0|1101|0100 */
+#define CSEL_OPCODE 0xd4
+#define CSINC_OPCODE 0xd4
+#define CSINV_OPCODE 0x2d4
+#define CSNEG_OPCODE 0x2d4
+
 static inline bool is_dp_arith_token(token_mnemonic_t token) {
   return (token == TOKEN_ADD || token == TOKEN_ADDS || token == TOKEN_SUB ||
           token == TOKEN_SUBS);
@@ -52,6 +58,11 @@ static inline bool is_dp_mult_token(token_mnemonic_t token) {
   return (token == TOKEN_MADD || token == TOKEN_MSUB);
 }
 
+static inline bool is_dp_csel_token(token_mnemonic_t token) {
+  return (token == TOKEN_CSEL || token == TOKEN_CSINC || token == TOKEN_CSINV ||
+          token == TOKEN_CSNEG);
+}
+
 static inline bool is_dp_mov_token(token_mnemonic_t token) {
   return (token == TOKEN_MOVK || token == TOKEN_MOVN || token == TOKEN_MOVZ);
 }
@@ -111,6 +122,14 @@ static dp_instr_info_t dp_instrs[] = {
     /* opcode: opc|1|101|1000 */
     {TOKEN_MADD, MADD_OPCODE << 21, true},
     {TOKEN_MSUB, MSUB_OPCODE << 21, true}, /* x=1 */
+
+    /* Conditional select instructions, extra flag is the op2 bit */
+    /* Has syntax: opc <Rd>, <Rn>, <Rm>, <cond> */
+    /* opcode: op|0|1101|0100 */
+    {TOKEN_CSEL, CSEL_OPCODE << 21, true},
+    {TOKEN_CSINC, CSINC_OPCODE << 21, true}, /* op2=1 */
+    {TOKEN_CSINV, CSINV_OPCODE << 21, true},
+    {TOKEN_CSNEG, CSNEG_OPCODE << 21, true}, /* op2=1 */
 };
 
 #define DP_INSTR_COUNT (sizeof(dp_instrs) / sizeof(dp_instrs[0]))
@@ -135,6 +154,8 @@ static bool is_dp_instr_reg(instruction_IR_t *ps) {
     return true;
   if (is_dp_mult_token(ps->mnemonic_tok))
     return true;
+  if (is_dp_csel_token(ps->mnemonic_tok))
+    return true;
   if (is_dp_arith_token(ps->mnemonic_tok))
     return ps->operands[2].type == OPERAND_REGISTER;
 
@@ -272,6 +293,33 @@ static void convert_alias_dp_instrs(instruction_IR_t *ps) {
          (operand_t){OPERAND_REGISTER,
                      {.reg = {31, ps->operands[0].reg.is_64bit}}}}};
     break;
+
+  /* both select on the inverted condition, flipping its lowest bit */
+  case TOKEN_CSET:
+    *ps = (instruction_IR_t){
+        "csinc",
+        TOKEN_CSINC,
+        INSTR_DATA_PROCESSING,
+        4,
+        {ps->operands[0],
+         (operand_t){OPERAND_REGISTER,
+                     {.reg = {31, ps->operands[0].reg.is_64bit}}},
+         (operand_t){OPERAND_REGISTER,
+                     {.reg = {31, ps->operands[0].reg.is_64bit}}},
+         (operand_t){OPERAND_IMMEDIATE,
+                     {.immediate = ps->operands[1].immediate ^ 1}}}};
+    break;
+
+  case TOKEN_CINC:
+    *ps = (instruction_IR_t){
+        "csinc",
+        TOKEN_CSINC,
+        INSTR_DATA_PROCESSING,
+        4,
+        {ps->operands[0], ps->operands[1], ps->operands[1],
+         (operand_t){OPERAND_IMMEDIATE,
+                     {.immediate = ps->operands[2].immediate ^ 1}}}};
+    break;
   default:
     break;
   }
@@ -334,6 +382,7 @@ u32 assemble_data_processing(instruction_IR_t *ps, u32 addr) {
     case TOKEN_EON:
     case TOKEN_ORN:
       insert_bits_u32(&instr, 21, 21, 1);
+      /* fallthrough */
     case TOKEN_ADD:
     case TOKEN_ADDS:
     case TOKEN_SUB:
@@ -370,6 +419,7 @@ u32 assemble_data_processing(instruction_IR_t *ps, u32 addr) {
       break;
     case TOKEN_MSUB:
       insert_bits_u32(&instr, 15, 15, 1);
+      /* fallthrough */
     case TOKEN_MADD:
       assert(ps->operand_count == 4);
       operand_t ra = ps->operands[3];
@@ -377,6 +427,18 @@ u32 assemble_data_processing(instruction_IR_t *ps, u32 addr) {
       assert(ra.reg.reg_num <= MAX_REG_NUM);
       insert_bits_u32(&instr, 10, 14, ra.reg.reg_num);
       break;
+    case TOKEN_CSINC:
+    case TOKEN_CSNEG:
+      insert_bits_u32(&instr, 10, 10, 1);
+      /* fallthrough */
+    case TOKEN_CSEL:
+    case TOKEN_CSINV: {
+      assert(ps->operand_count == 4);
+      u32 cond = ps->operands[3].immediate;
+      assert(cond <= 0xf);
+      insert_bits_u32(&instr, 12, 15, cond);
+      break;
+    }
     default:
       fprintf(
           stderr,
@@ -4,7 +4,113 @@
 #include <assert.h>
 #include <stdlib.h>
 
+#define EXCLUSIVE_OPC 0x08000000
+#define EXCLUSIVE_UNUSED_REG 0x1f
+#define PAIR_OPC 0x28000000
+
+/* log2 of the bytes a single data transfer moves */
+static u32 transfer_size(token_mnemonic_t token, bool is_64bit) {
+  switch (token) {
+  case TOKEN_LDRB:
+  case TOKEN_STRB:
+    return 0;
+  case TOKEN_LDRH:
+  case TOKEN_STRH:
+    return 1;
+  case TOKEN_LDRSW:
+    return 2;
+  default:
+    return is_64bit ? 3 : 2;
+  }
+}
+
+static bool is_exclusive_token(token_mnemonic_t token) {
+  return token == TOKEN_LDXR || token == TOKEN_LDAXR || token == TOKEN_STXR ||
+         token == TOKEN_STLXR || token == TOKEN_LDAR || token == TOKEN_STLR;
+}
+
+/*
+ * exclusive and ordered transfers: size 001000 o2 L 0 Rs o0 11111 Rn Rt
+ * STXR and STLXR take the status register Ws first, then Rt and [Xn]
+ */
+static u32 assemble_exclusive(instruction_IR_t *ps) {
+  token_mnemonic_t token = ps->mnemonic_tok;
+  bool has_status = token == TOKEN_STXR || token == TOKEN_STLXR;
+  operand_t rt = ps->operands[has_status ? 1 : 0];
+  operand_t xn = ps->operands[has_status ? 2 : 1];
+  u32 rs = has_status ? ps->operands[0].reg.reg_num : EXCLUSIVE_UNUSED_REG;
+  assert(rt.reg.reg_num <= MAX_REG_NUM && xn.reg.reg_num <= MAX_REG_NUM &&
+         rs <= MAX_REG_NUM);
+
+  u32 instr = EXCLUSIVE_OPC;
+  insert_bits_u32(&instr, 30, 31, rt.reg.is_64bit ? 3 : 2);
+  /* o2: ordered rather than exclusive */
+  insert_bits_u32(&instr, 23, 23, token == TOKEN_LDAR || token == TOKEN_STLR);
+  /* L: load */
+  insert_bits_u32(&instr, 22, 22,
+                  token == TOKEN_LDXR || token == TOKEN_LDAXR ||
+                      token == TOKEN_LDAR);
+  insert_bits_u32(&instr, 16, 20, rs);
+  /* o0: acquire or release */
+  insert_bits_u32(&instr, 15, 15,
+                  token != TOKEN_LDXR && token != TOKEN_STXR);
+  insert_bits_u32(&instr, 10, 14, EXCLUSIVE_UNUSED_REG);
+  insert_bits_u32(&instr, 5, 9, xn.reg.reg_num);
+  insert_bits_u32(&instr, 0, 4, rt.reg.reg_num);
+  return instr;
+}
+
+/*
+ * load/store pair: opc 101 0 mode L imm7 Rt2 Rn Rt, with opc 10 for X
+ * registers and mode 01 post-index, 10 signed offset or 11 pre-index
+ */
+static u32 assemble_pair(instruction_IR_t *ps) {
+  operand_t rt = ps->operands[0];
+  operand_t rt2 = ps->operands[1];
+  operand_t xn = ps->operands[2];
+  assert(rt.reg.reg_num <= MAX_REG_NUM && rt2.reg.reg_num <= MAX_REG_NUM &&
+         rt.reg.is_64bit == rt2.reg.is_64bit);
+
+  u32 instr = PAIR_OPC;
+  insert_bits_u32(&instr, 30, 31, rt.reg.is_64bit ? 2 : 0);
+  insert_bits_u32(&instr, 22, 22, ps->mnemonic_tok == TOKEN_LDP);
+  insert_bits_u32(&instr, 10, 14, rt2.reg.reg_num);
+  insert_bits_u32(&instr, 5, 9, xn.reg.reg_num);
+  insert_bits_u32(&instr, 0, 4, rt.reg.reg_num);
+
+  switch (xn.type) {
+  case OPERAND_MEMORY_POST_INDEX:
+    insert_bits_u32(&instr, 23, 24, 1);
+    break;
+  case OPERAND_MEMORY_PRE_INDEX:
+    insert_bits_u32(&instr, 23, 24, 3);
+    break;
+  case OPERAND_MEMORY_UNSIGNED_OFFSET:
+    insert_bits_u32(&instr, 23, 24, 2);
+    break;
+  default:
+    fprintf(stderr, "Invalid addressing mode for a pair!\n");
+    exit(1);
+  }
+
+  /* imm7 is the offset scaled by the register size, and may be negative */
+  i32 offset = ps->operand_count == 4 ? ps->operands[3].s_immediate : 0;
+  int scale = rt.reg.is_64bit ? 8 : 4;
+  assert(offset % scale == 0);
+  offset /= scale;
+  assert(offset >= -64 && offset <= 63);
+  insert_bits_u32(&instr, 15, 21, (u32)offset);
+  return instr;
+}
+
 u32 assemble_load_store(instruction_IR_t *ps, u32 address) {
+    if (is_exclusive_token(ps->mnemonic_tok)) {
+      return assemble_exclusive(ps);
+    }
+    if (ps->mnemonic_tok == TOKEN_LDP || ps->mnemonic_tok == TOKEN_STP) {
+      return assemble_pair(ps);
+    }
+
     /*
      * if literal for ldr:
      * check 1) address is 1MB within the address of instruction
@@ -13,6 +119,7 @@ u32 assemble_load_store(instruction_IR_t *ps, u32 address) {
     u32 instr = 0x0;
     operand_t rt = ps->operands[0];
     u8 sf = rt.reg.is_64bit;
+    u32 size = transfer_size(ps->mnemonic_tok, sf);
     insert_bits_u32(&instr, 27, 28, 3); /* 0b11 */
     insert_bits_u32(&instr, 30, 30, sf);
     assert(rt.reg.reg_num <= MAX_REG_NUM);
@@ -38,7 +145,15 @@ u32 assemble_load_store(instruction_IR_t *ps, u32 address) {
         insert_bits_u32(&instr, 22, 22, 1);
         break; /* NOTE: the addressing will be handled after the if-else */
       }
-    } else if (ps->mnemonic_tok == TOKEN_STR) {
+    } else if (ps->mnemonic_tok == TOKEN_LDRB ||
+               ps->mnemonic_tok == TOKEN_LDRH) {
+      insert_bits_u32(&instr, 22, 22, 1);
+    } else if (ps->mnemonic_tok == TOKEN_LDRSW) {
+      /* opc 10: sign extend to 64 bits */
+      insert_bits_u32(&instr, 23, 23, 1);
+    } else if (ps->mnemonic_tok == TOKEN_STR ||
+               ps->mnemonic_tok == TOKEN_STRB ||
+               ps->mnemonic_tok == TOKEN_STRH) {
       insert_bits_u32(&instr, 22, 22, 0);
     } else {
       fprintf(stderr, "Invalid load/store instruction mnemonic token: %d\n",
@@ -46,7 +161,7 @@ u32 assemble_load_store(instruction_IR_t *ps, u32 address) {
       exit(1);
     }
 
-    insert_bits_u32(&instr, 31, 31, 1); /* for single data transfer bits */
+    insert_bits_u32(&instr, 30, 31, size); /* for single data transfer bits */
     insert_bits_u32(&instr, 29, 29, 1); /* for single data transfer bits */
 
     /* unsigned immediate: set 24th bit to 1 if it is unsigned immedaite mode */
@@ -85,16 +200,10 @@ u32 assemble_load_store(instruction_IR_t *ps, u32 address) {
         imm12_raw = ps->operands[2].immediate;
       }
 
+      /* scaled by the transfer size */
       u32 imm12 = imm12_raw;
-      if (sf) {
-        /* Rt is 64-bit X-register */
-        assert(imm12 % 8 == 0);
-        imm12 >>= 3;
-      } else {
-        /* Rt is 32-bit W-register*/
-        assert(imm12 % 4 == 0);
-        imm12 >>= 2;
-      }
+      assert(imm12 % (1 << size) == 0);
+      imm12 >>= size;
 
       assert(imm12 <= 4095);
       insert_bits_u32(&instr, 10, 21, imm12);
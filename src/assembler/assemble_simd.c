@@ -0,0 +1,203 @@
+#include "assemble_simd.h"
+#include "../utils/bits_utils.h"
+#include "assemble.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define THREE_SAME_OPC 0x0e200400
+#define ACROSS_LANES_OPC 0x0e300800
+#define COPY_OPC 0x0e000400
+#define MULTIPLE_OPC 0x0c000000
+
+#define ADD_OPCODE 0x10
+#define MUL_OPCODE 0x13
+#define LOGIC_OPCODE 0x03
+#define ADDV_OPCODE 0x1b
+#define MAXV_OPCODE 0x0a
+#define MINV_OPCODE 0x1a
+#define DUP_IMM4 0x1
+#define UMOV_IMM4 0x7
+#define POST_INDEX_IMMEDIATE_REG 0x1f
+
+static void invalid_simd(instruction_IR_t *ps) {
+  fprintf(stderr, "Invalid SIMD instruction mnemonic token: %d\n",
+          ps->mnemonic_tok);
+  exit(1);
+}
+
+/* three same: 0 Q U 01110 size 1 Rm opcode 1 Rn Rd */
+static u32 assemble_three_same(instruction_IR_t *ps) {
+  operand_t vd = ps->operands[0];
+  operand_t vn = ps->operands[1];
+  operand_t vm = ps->operands[2];
+  assert(vd.vector.size == vn.vector.size && vd.vector.size == vm.vector.size &&
+         vd.vector.q == vn.vector.q && vd.vector.q == vm.vector.q);
+
+  u32 u = 0;
+  u32 size = vd.vector.size;
+  u32 opcode;
+  switch (ps->mnemonic_tok) {
+  case TOKEN_ADD:
+    opcode = ADD_OPCODE;
+    break;
+  case TOKEN_SUB:
+    u = 1;
+    opcode = ADD_OPCODE;
+    break;
+  case TOKEN_MUL:
+    assert(size != 3);
+    opcode = MUL_OPCODE;
+    break;
+  /* the bitwise operations are told apart by size, their lanes are bytes */
+  case TOKEN_AND:
+    opcode = LOGIC_OPCODE;
+    size = 0;
+    break;
+  case TOKEN_ORR:
+    opcode = LOGIC_OPCODE;
+    size = 2;
+    break;
+  case TOKEN_EOR:
+    u = 1;
+    opcode = LOGIC_OPCODE;
+    size = 0;
+    break;
+  default:
+    invalid_simd(ps);
+    return 0;
+  }
+
+  u32 instr = THREE_SAME_OPC;
+  insert_bits_u32(&instr, 30, 30, vd.vector.q);
+  insert_bits_u32(&instr, 29, 29, u);
+  insert_bits_u32(&instr, 22, 23, size);
+  insert_bits_u32(&instr, 16, 20, vm.vector.reg_num);
+  insert_bits_u32(&instr, 11, 15, opcode);
+  insert_bits_u32(&instr, 5, 9, vn.vector.reg_num);
+  insert_bits_u32(&instr, 0, 4, vd.vector.reg_num);
+  return instr;
+}
+
+/* across lanes: 0 Q U 01110 size 11000 opcode 10 Rn Rd */
+static u32 assemble_across_lanes(instruction_IR_t *ps) {
+  operand_t vd = ps->operands[0];
+  operand_t vn = ps->operands[1];
+  assert(vd.vector.size == vn.vector.size && vn.vector.size < 3);
+
+  u32 u = ps->mnemonic_tok == TOKEN_UMAXV || ps->mnemonic_tok == TOKEN_UMINV;
+  u32 opcode;
+  switch (ps->mnemonic_tok) {
+  case TOKEN_ADDV:
+    opcode = ADDV_OPCODE;
+    break;
+  case TOKEN_SMAXV:
+  case TOKEN_UMAXV:
+    opcode = MAXV_OPCODE;
+    break;
+  default:
+    opcode = MINV_OPCODE;
+    break;
+  }
+
+  u32 instr = ACROSS_LANES_OPC;
+  insert_bits_u32(&instr, 30, 30, vn.vector.q);
+  insert_bits_u32(&instr, 29, 29, u);
+  insert_bits_u32(&instr, 22, 23, vn.vector.size);
+  insert_bits_u32(&instr, 12, 16, opcode);
+  insert_bits_u32(&instr, 5, 9, vn.vector.reg_num);
+  insert_bits_u32(&instr, 0, 4, vd.vector.reg_num);
+  return instr;
+}
+
+/*
+ * copy: 0 Q 0 01110000 imm5 0 imm4 1 Rn Rd, where the lowest set bit of imm5
+ * is the lane size and the bits above it the index of an element
+ */
+static u32 assemble_copy(instruction_IR_t *ps) {
+  bool dup = ps->mnemonic_tok == TOKEN_DUP;
+  operand_t vector = ps->operands[dup ? 0 : 1];
+  operand_t rn = ps->operands[dup ? 1 : 0];
+  u32 size = vector.vector.size;
+  assert(rn.reg.reg_num <= MAX_REG_NUM && rn.reg.is_64bit == (size == 3));
+
+  u32 instr = COPY_OPC;
+  u32 imm5 = 1 << size;
+  if (dup) {
+    insert_bits_u32(&instr, 30, 30, vector.vector.q);
+    insert_bits_u32(&instr, 11, 14, DUP_IMM4);
+  } else {
+    assert(vector.vector.index < (16u >> size));
+    imm5 |= vector.vector.index << (size + 1);
+    /* Xd for the 64-bit lanes */
+    insert_bits_u32(&instr, 30, 30, size == 3);
+    insert_bits_u32(&instr, 11, 14, UMOV_IMM4);
+  }
+  insert_bits_u32(&instr, 16, 20, imm5);
+  insert_bits_u32(&instr, 5, 9, dup ? rn.reg.reg_num : vector.vector.reg_num);
+  insert_bits_u32(&instr, 0, 4, dup ? vector.vector.reg_num : rn.reg.reg_num);
+  return instr;
+}
+
+/*
+ * LD1 and ST1: 0 Q 001100 P L 0 Rm opcode size Rn Rt, the opcode giving the
+ * number of registers; post-index by the bytes moved encodes Rm as 31
+ */
+static u32 assemble_multiple(instruction_IR_t *ps) {
+  static const u32 opcodes[] = {0, 0x7, 0xa, 0x6, 0x2};
+  operand_t vt = ps->operands[0];
+  u32 count = ps->operands[1].immediate;
+  operand_t xn = ps->operands[2];
+  assert(count >= 1 && count <= 4 && xn.reg.reg_num <= MAX_REG_NUM);
+
+  u32 instr = MULTIPLE_OPC;
+  insert_bits_u32(&instr, 30, 30, vt.vector.q);
+  insert_bits_u32(&instr, 22, 22, ps->mnemonic_tok == TOKEN_LD1);
+  insert_bits_u32(&instr, 12, 15, opcodes[count]);
+  insert_bits_u32(&instr, 10, 11, vt.vector.size);
+  insert_bits_u32(&instr, 5, 9, xn.reg.reg_num);
+  insert_bits_u32(&instr, 0, 4, vt.vector.reg_num);
+
+  if (xn.type == OPERAND_MEMORY_POST_INDEX) {
+    operand_t step = ps->operands[3];
+    u32 rm = POST_INDEX_IMMEDIATE_REG;
+    if (step.type == OPERAND_REGISTER) {
+      rm = step.reg.reg_num;
+      assert(rm < POST_INDEX_IMMEDIATE_REG);
+    } else {
+      /* the immediate can only be the number of bytes moved */
+      assert(step.immediate == count * (vt.vector.q ? 16 : 8));
+    }
+    insert_bits_u32(&instr, 23, 23, 1);
+    insert_bits_u32(&instr, 16, 20, rm);
+  }
+  return instr;
+}
+
+u32 assemble_simd(instruction_IR_t *ps, u32 address) {
+  (void)address;
+  switch (ps->mnemonic_tok) {
+  case TOKEN_ADD:
+  case TOKEN_SUB:
+  case TOKEN_MUL:
+  case TOKEN_AND:
+  case TOKEN_ORR:
+  case TOKEN_EOR:
+    return assemble_three_same(ps);
+  case TOKEN_ADDV:
+  case TOKEN_SMAXV:
+  case TOKEN_SMINV:
+  case TOKEN_UMAXV:
+  case TOKEN_UMINV:
+    return assemble_across_lanes(ps);
+  case TOKEN_DUP:
+  case TOKEN_UMOV:
+    return assemble_copy(ps);
+  case TOKEN_LD1:
+  case TOKEN_ST1:
+    return assemble_multiple(ps);
+  default:
+    invalid_simd(ps);
+    return 0;
+  }
+}
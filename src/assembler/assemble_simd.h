@@ -0,0 +1,8 @@
+#ifndef ASSEMBLE_SIMD
+#define ASSEMBLE_SIMD
+
+#include "assemble.h"
+
+u32 assemble_simd(instruction_IR_t *ps, u32 address);
+
+#endif /* ASSEMBLE_SIMD */
@@ -0,0 +1,49 @@
+#include "assemble_system.h"
+#include "../utils/bits_utils.h"
+#include "assemble.h"
+#include <assert.h>
+#include <stdlib.h>
+
+#define DMB_OPC 0xd50330bf
+#define DSB_OPC 0xd503309f
+#define ISB_OPC 0xd50330df
+#define CLREX_OPC 0xd503305f
+#define NOP_OPC 0xd503201f
+#define MRS_OPC 0xd5300000
+
+/* the barrier option (CRm) is bits 8-11 */
+static u32 with_option(u32 opc, instruction_IR_t *ps) {
+  assert(ps->operands[0].immediate <= 0xf);
+  insert_bits_u32(&opc, 8, 11, ps->operands[0].immediate);
+  return opc;
+}
+
+u32 assemble_system(instruction_IR_t *ps, u32 address) {
+  (void)address;
+
+  switch (ps->mnemonic_tok) {
+  case TOKEN_NOP:
+    return NOP_OPC;
+  case TOKEN_DMB:
+    return with_option(DMB_OPC, ps);
+  case TOKEN_DSB:
+    return with_option(DSB_OPC, ps);
+  case TOKEN_ISB:
+    return with_option(ISB_OPC, ps);
+  case TOKEN_CLREX:
+    return with_option(CLREX_OPC, ps);
+  case TOKEN_MRS: {
+    /* the system register (o0:op1:CRn:CRm:op2) is bits 5-19 */
+    u32 instr = MRS_OPC;
+    u32 rt = ps->operands[0].reg.reg_num;
+    assert(rt <= MAX_REG_NUM);
+    insert_bits_u32(&instr, 5, 19, ps->operands[1].immediate);
+    insert_bits_u32(&instr, 0, 4, rt);
+    return instr;
+  }
+  default:
+    fprintf(stderr, "Invalid system instruction mnemonic token: %d\n",
+            ps->mnemonic_tok);
+    exit(1);
+  }
+}
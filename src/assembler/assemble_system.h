@@ -0,0 +1,8 @@
+#ifndef ASSEMBLE_SYSTEM
+#define ASSEMBLE_SYSTEM
+
+#include "assemble.h"
+
+u32 assemble_system(instruction_IR_t *ps, u32 address);
+
+#endif /* ASSEMBLE_SYSTEM */
@@ -3,15 +3,19 @@
 #include "assemble_branch.h"
 #include "assemble_dp.h"
 #include "assemble_load_store.h"
+#include "assemble_simd.h"
+#include "assemble_system.h"
 #include <assert.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-static instruction_assembler_fun assembler_functions[3] = {
+static instruction_assembler_fun assembler_functions[5] = {
     assemble_data_processing,
     assemble_load_store,
     assemble_branch,
+    assemble_system,
+    assemble_simd,
 };
 
 static u32 assemble_directive(directive_IR_t *ps) { return (u32)(ps->value); }
@@ -15,20 +15,34 @@ typedef struct {
   token_mnemonic_t token;
 } mnemonic_mapping_t;
 
+// sorted for bsearch, '.' comes before any letter
 static const mnemonic_mapping_t mnemonic_table[] = {
-    {"add", TOKEN_ADD},   {"adds", TOKEN_ADDS}, {"and", TOKEN_AND},
-    {"ands", TOKEN_ANDS}, {"b", TOKEN_B},       {"b.al", TOKEN_B_AL},
-    {"b.eq", TOKEN_B_EQ}, {"b.ge", TOKEN_B_GQ}, {"b.gt", TOKEN_B_GT},
-    {"b.le", TOKEN_B_LE}, {"b.lt", TOKEN_B_LT}, {"b.ne", TOKEN_B_NE},
-    {"bic", TOKEN_BIC},   {"bics", TOKEN_BICS}, {"br", TOKEN_BR},
-    {"cmn", TOKEN_CMN},   {"cmp", TOKEN_CMP},   {"eon", TOKEN_EON},
-    {"eor", TOKEN_EOR},   {"ldr", TOKEN_LDR},   {"madd", TOKEN_MADD},
-    {"mneg", TOKEN_MNEG}, {"mov", TOKEN_MOV},   {"movk", TOKEN_MOVK},
-    {"movn", TOKEN_MOVN}, {"movz", TOKEN_MOVZ}, {"msub", TOKEN_MSUB},
-    {"mul", TOKEN_MUL},   {"mvn", TOKEN_MVN},   {"neg", TOKEN_NEG},
-    {"negs", TOKEN_NEGS}, {"orn", TOKEN_ORN},   {"orr", TOKEN_ORR},
-    {"str", TOKEN_STR},   {"sub", TOKEN_SUB},   {"subs", TOKEN_SUBS},
-    {"tst", TOKEN_TST},   {".int", TOKEN_INT}};
+    {".int", TOKEN_INT}, {"add", TOKEN_ADD}, {"adds", TOKEN_ADDS},
+    {"addv", TOKEN_ADDV}, {"and", TOKEN_AND}, {"ands", TOKEN_ANDS},
+    {"b", TOKEN_B}, {"b.al", TOKEN_B_AL}, {"b.eq", TOKEN_B_EQ},
+    {"b.ge", TOKEN_B_GQ}, {"b.gt", TOKEN_B_GT}, {"b.le", TOKEN_B_LE},
+    {"b.lt", TOKEN_B_LT}, {"b.ne", TOKEN_B_NE}, {"bic", TOKEN_BIC},
+    {"bics", TOKEN_BICS}, {"br", TOKEN_BR}, {"cbnz", TOKEN_CBNZ},
+    {"cbz", TOKEN_CBZ}, {"cinc", TOKEN_CINC}, {"clrex", TOKEN_CLREX},
+    {"cmn", TOKEN_CMN}, {"cmp", TOKEN_CMP}, {"csel", TOKEN_CSEL},
+    {"cset", TOKEN_CSET}, {"csinc", TOKEN_CSINC}, {"csinv", TOKEN_CSINV},
+    {"csneg", TOKEN_CSNEG}, {"dmb", TOKEN_DMB}, {"dsb", TOKEN_DSB},
+    {"dup", TOKEN_DUP}, {"eon", TOKEN_EON}, {"eor", TOKEN_EOR},
+    {"isb", TOKEN_ISB}, {"ld1", TOKEN_LD1}, {"ldar", TOKEN_LDAR},
+    {"ldaxr", TOKEN_LDAXR}, {"ldp", TOKEN_LDP}, {"ldr", TOKEN_LDR},
+    {"ldrb", TOKEN_LDRB}, {"ldrh", TOKEN_LDRH}, {"ldrsw", TOKEN_LDRSW},
+    {"ldxr", TOKEN_LDXR}, {"madd", TOKEN_MADD}, {"mneg", TOKEN_MNEG},
+    {"mov", TOKEN_MOV}, {"movk", TOKEN_MOVK}, {"movn", TOKEN_MOVN},
+    {"movz", TOKEN_MOVZ}, {"mrs", TOKEN_MRS}, {"msub", TOKEN_MSUB},
+    {"mul", TOKEN_MUL}, {"mvn", TOKEN_MVN}, {"neg", TOKEN_NEG},
+    {"negs", TOKEN_NEGS}, {"nop", TOKEN_NOP}, {"orn", TOKEN_ORN},
+    {"orr", TOKEN_ORR},
+    {"smaxv", TOKEN_SMAXV}, {"sminv", TOKEN_SMINV}, {"st1", TOKEN_ST1},
+    {"stlr", TOKEN_STLR}, {"stlxr", TOKEN_STLXR}, {"stp", TOKEN_STP},
+    {"str", TOKEN_STR}, {"strb", TOKEN_STRB}, {"strh", TOKEN_STRH},
+    {"stxr", TOKEN_STXR}, {"sub", TOKEN_SUB}, {"subs", TOKEN_SUBS},
+    {"tbnz", TOKEN_TBNZ}, {"tbz", TOKEN_TBZ}, {"tst", TOKEN_TST},
+    {"umaxv", TOKEN_UMAXV}, {"uminv", TOKEN_UMINV}, {"umov", TOKEN_UMOV}};
 
 #define MNEMONIC_TABLE_SIZE (sizeof(mnemonic_table) / sizeof(mnemonic_table[0]))
 
@@ -52,17 +66,23 @@ static token_mnemonic_t get_mnemonic_token(const char *mnemonic) {
   }
 }
 
-#define NR_INSTRUCTIONS 37
+#define NR_INSTRUCTIONS 75
 static const char *ALL_INSTRUCTIONS[NR_INSTRUCTIONS] = {
-    "add",  "adds", "and",  "ands", "b",    "b.al", "b.eq", "b.ge",
-    "b.gt", "b.le", "b.lt", "b.ne", "bic",  "bics", "br",   "cmn",
-    "cmp",  "eon",  "eor",  "ldr",  "madd", "mov",  "movk", "movn",
-    "movz", "mneg", "msub", "mul",  "mvn",  "neg",  "negs", "orn",
-    "orr",  "str",  "sub",  "subs", "tst"};
+    "add",  "adds", "addv", "and",   "ands",  "b",     "b.al", "b.eq",
+    "b.ge", "b.gt", "b.le", "b.lt",  "b.ne",  "bic",   "bics", "br",
+    "cbnz", "cbz",  "cinc", "clrex", "cmn",   "cmp",   "csel", "cset",
+    "csinc", "csinv", "csneg", "dmb", "dsb",  "dup",   "eon",  "eor",
+    "isb",  "ld1",  "ldar", "ldaxr", "ldp",   "ldr",   "ldrb", "ldrh",
+    "ldrsw", "ldxr", "madd", "mov",  "movk",  "movn",  "movz", "mneg",
+    "mrs",  "msub", "mul",  "mvn",   "neg",   "negs",  "nop",  "orn",
+    "orr",  "smaxv", "sminv", "st1", "stlr",  "stlxr", "stp",  "str",
+    "strb", "strh", "stxr", "sub",   "subs",  "tbnz",  "tbz",  "tst",
+    "umaxv", "uminv", "umov"};
 
 static const char *DATA_PROCESSING_INSTRUCTIONS[] = {
-  "add", "adds", "and", "ands", "bic", "bics", "cmn",
-  "cmp", "eon", "eor", "madd", "mneg", "mov", "movk", "movn", "movz", "msub", "mul",
+  "add", "adds", "and", "ands", "bic", "bics", "cinc", "cmn",
+  "cmp", "csel", "cset", "csinc", "csinv", "csneg", "eon", "eor", "madd",
+  "mneg", "mov", "movk", "movn", "movz", "msub", "mul",
   "mvn", "neg", "negs", "orn", "orr", "sub", "subs", "tst"
 };
 
@@ -83,6 +103,61 @@ static const char *CONDITION_BRANCHING_INSTRUCTIONS[] = {
   "b.al", "b.eq", "b.ge", "b.gt", "b.le", "b.lt", "b.ne"
 };
 
+static const char *COND_SELECT_INSTRUCTIONS[] = {
+  "cinc", "csel", "cset", "csinc", "csinv", "csneg"
+};
+
+static const char *SYSTEM_INSTRUCTIONS[] = {
+  "clrex", "dmb", "dsb", "isb", "mrs", "nop"
+};
+
+static const char *SINGLE_TRANSFER_INSTRUCTIONS[] = {
+  "ldr", "ldrb", "ldrh", "ldrsw", "str", "strb", "strh"
+};
+
+static const char *EXCLUSIVE_INSTRUCTIONS[] = {
+  "ldar", "ldaxr", "ldxr", "stlr", "stlxr", "stxr"
+};
+
+// Only ever SIMD, add and the like are too when given vectors
+static const char *SIMD_INSTRUCTIONS[] = {
+  "addv", "dup", "ld1", "smaxv", "sminv", "st1", "umaxv", "uminv", "umov"
+};
+
+// Options of dmb and the CRm field they are encoded as
+typedef struct {
+  const char *name;
+  u32 crm;
+} barrier_option_t;
+
+static const barrier_option_t BARRIER_OPTIONS[] = {
+  {"ish", 0xb}, {"ishld", 0x9}, {"ishst", 0xa}, {"ld", 0xd},
+  {"nsh", 0x7}, {"nshld", 0x5}, {"nshst", 0x6}, {"osh", 0x3},
+  {"oshld", 0x1}, {"oshst", 0x2}, {"st", 0xe}, {"sy", 0xf}
+};
+
+// the option isb and clrex take when none is given
+#define BARRIER_SY 0xf
+
+// Names of the condition codes, as csel and its aliases take them
+static const struct {
+  const char *name;
+  u32 cond;
+} CONDITION_CODES[] = {
+  {"al", 0xe}, {"cc", 0x3}, {"cs", 0x2}, {"eq", 0x0}, {"ge", 0xa},
+  {"gt", 0xc}, {"hi", 0x8}, {"hs", 0x2}, {"le", 0xd}, {"lo", 0x3},
+  {"ls", 0x9}, {"lt", 0xb}, {"mi", 0x4}, {"ne", 0x1}, {"nv", 0xf},
+  {"pl", 0x5}, {"vc", 0x7}, {"vs", 0x6}
+};
+
+// System registers mrs can read, with their o0:op1:CRn:CRm:op2 encoding
+static const struct {
+  const char *name;
+  u32 encoding;
+} SYSTEM_REGISTERS[] = {
+  {"mpidr_el1", 0x4005}
+};
+
 
 // strcmp wrapper but with generic type for binary search
 static int cmp_str(const void* a, const void* b) {
@@ -108,6 +183,115 @@ bool is_bcond_instruction(char *command) {
   return (bsearch(&command, CONDITION_BRANCHING_INSTRUCTIONS, 7, sizeof(*CONDITION_BRANCHING_INSTRUCTIONS), &cmp_str )) != NULL;
 }
 
+static bool is_compare_branch_instruction(char *command) {
+  return strcmp(command, "cbz") == 0 || strcmp(command, "cbnz") == 0 ||
+         strcmp(command, "tbz") == 0 || strcmp(command, "tbnz") == 0;
+}
+
+static bool is_cond_select_instruction(char *command) {
+  return (bsearch(&command, COND_SELECT_INSTRUCTIONS, 6,
+                  sizeof(*COND_SELECT_INSTRUCTIONS), cmp_str)) != NULL;
+}
+
+static bool is_single_transfer_instruction(char *command) {
+  return (bsearch(&command, SINGLE_TRANSFER_INSTRUCTIONS, 7,
+                  sizeof(*SINGLE_TRANSFER_INSTRUCTIONS), cmp_str)) != NULL;
+}
+
+static bool is_pair_instruction(char *command) {
+  return strcmp(command, "ldp") == 0 || strcmp(command, "stp") == 0;
+}
+
+static bool is_exclusive_instruction(char *command) {
+  return (bsearch(&command, EXCLUSIVE_INSTRUCTIONS, 6,
+                  sizeof(*EXCLUSIVE_INSTRUCTIONS), cmp_str)) != NULL;
+}
+
+static bool is_simd_instruction(char *command) {
+  return (bsearch(&command, SIMD_INSTRUCTIONS, 9,
+                  sizeof(*SIMD_INSTRUCTIONS), cmp_str)) != NULL;
+}
+
+static bool is_vector_register(const char *operand) {
+  return operand[0] == 'v' && isdigit(operand[1]);
+}
+
+// dmb takes either a named option or its #imm encoding
+static u32 get_barrier_option(const char *option) {
+  if (is_immediate(option)) {
+    return strtol(option + 1, NULL, 0);
+  }
+  for (unsigned long i = 0; i < sizeof(BARRIER_OPTIONS) / sizeof(*BARRIER_OPTIONS); i++) {
+    if (strcmp(BARRIER_OPTIONS[i].name, option) == 0) {
+      return BARRIER_OPTIONS[i].crm;
+    }
+  }
+  fprintf(stderr, "Unknown barrier option: %s\n", option);
+  exit(1);
+}
+
+static u32 get_condition(const char *name) {
+  for (unsigned long i = 0; i < sizeof(CONDITION_CODES) / sizeof(*CONDITION_CODES); i++) {
+    if (strcmp(CONDITION_CODES[i].name, name) == 0) {
+      return CONDITION_CODES[i].cond;
+    }
+  }
+  fprintf(stderr, "Unknown condition: %s\n", name);
+  exit(1);
+}
+
+static u32 get_system_register(const char *name) {
+  for (unsigned long i = 0; i < sizeof(SYSTEM_REGISTERS) / sizeof(*SYSTEM_REGISTERS); i++) {
+    if (strcmp(SYSTEM_REGISTERS[i].name, name) == 0) {
+      return SYSTEM_REGISTERS[i].encoding;
+    }
+  }
+  fprintf(stderr, "Unsupported system register: %s\n", name);
+  exit(1);
+}
+
+// log2 of the bytes in a lane named b, h, s or d
+static u8 get_lane_size(char lane) {
+  switch (lane) {
+    case 'b': return 0;
+    case 'h': return 1;
+    case 's': return 2;
+    case 'd': return 3;
+    default:
+      fprintf(stderr, "Unknown vector lane: %c\n", lane);
+      exit(1);
+  }
+}
+
+// v1.4s, the element v1.s[2] or the scalar s1, maybe opening a list with {
+static operand_t get_vector(const char *str) {
+  if (str[0] == '{') {
+    str++;
+  }
+  operand_t vector = {.type = OPERAND_VECTOR};
+  if (str[0] != 'v') {
+    vector.vector.size = get_lane_size(str[0]);
+    vector.vector.reg_num = strtol(str + 1, NULL, 10);
+    return vector;
+  }
+
+  char *arrangement;
+  vector.vector.reg_num = strtol(str + 1, &arrangement, 10);
+  if (*arrangement != '.') {
+    fprintf(stderr, "Missing vector arrangement: %s\n", str);
+    exit(1);
+  }
+  char *lane;
+  long lanes = strtol(arrangement + 1, &lane, 10);
+  vector.vector.size = get_lane_size(*lane);
+  if (lanes == 0) {
+    vector.vector.index = strtol(lane + 2, NULL, 0);
+  } else {
+    vector.vector.q = (lanes << vector.vector.size) == 16;
+  }
+  return vector;
+}
+
 static shift_t convert_string_to_shift_t(char *str) {
   if (strcmp(str, "lsr") == 0) return LSR;
   else if (strcmp(str, "lsl") == 0) return LSL;
@@ -163,31 +347,41 @@ static unsigned int get_reg_num(const char *regn) {
   return strtol(regn, NULL, 0);
 }
 
-static instruction_type_t get_instr_type(char *command) {
-  if (strcmp(command, "ldr") == 0 || strcmp(command, "str") == 0) {
+// operand is the first one, vectors make add and the like SIMD
+static instruction_type_t get_instr_type(char *command, const char *operand) {
+  if (is_simd_instruction(command)) {
+    return INSTR_SIMD;
+  } else if (is_single_transfer_instruction(command) || is_pair_instruction(command) ||
+      is_exclusive_instruction(command)) {
     return INSTR_LOAD_STORE;
-  } else if (strcmp(command, "b") == 0 || is_bcond_instruction(command) || strcmp(command, "br") == 0) {
+  } else if (bsearch(&command, SYSTEM_INSTRUCTIONS, 6,
+                     sizeof(*SYSTEM_INSTRUCTIONS), cmp_str)) {
+    return INSTR_SYSTEM;
+  } else if (strcmp(command, "b") == 0 || is_bcond_instruction(command) ||
+             strcmp(command, "br") == 0 ||
+             is_compare_branch_instruction(command)) {
     return INSTR_BRANCH;
-  } else if (bsearch(&command, DATA_PROCESSING_INSTRUCTIONS, 26, sizeof(*DATA_PROCESSING_INSTRUCTIONS), cmp_str)) {
-    return INSTR_DATA_PROCESSING;
+  } else if (bsearch(&command, DATA_PROCESSING_INSTRUCTIONS, 32, sizeof(*DATA_PROCESSING_INSTRUCTIONS), cmp_str)) {
+    return is_vector_register(operand) ? INSTR_SIMD : INSTR_DATA_PROCESSING;
   } else {
     printf("Cannot parse line: 100\n");
     exit(1);
   }
 }
 
-static offset_type_t get_offset_type(tokenized_line_t tok) {
-  if (tok.length == 3 && tok.tokens[2][0] != '[') {
+// first is the index of the token holding the address, after the registers
+static offset_type_t get_offset_type(tokenized_line_t tok, int first) {
+  if (tok.length == first + 1 && tok.tokens[first][0] != '[') {
     assert(strcmp(tok.tokens[0], "ldr") == 0);
     return LOAD_LITERAL;
   }
 
-  char* arg1 = tok.tokens[2];
-  char* arg2 = tok.tokens[3];
+  char* arg1 = tok.tokens[first];
+  char* arg2 = tok.tokens[first + 1];
 
   if (arg1[strlen(arg1) - 1] == ']') {
     //MID: POST-INDEX OR UNSIGNED OFFSET
-    if (tok.length == 4) {
+    if (tok.length == first + 2) {
       return POST_INDEX;
     } else {
       return UNSIGNED_OFFSET;  // without optional immediate 
@@ -216,6 +410,27 @@ static char* remove_closing_bracket(char* target) {
   return str;
 }
 
+// base of an exclusive or ordered transfer, [xn] or [xn, #0] at tokens[mem]
+static unsigned int get_exclusive_base(tokenized_line_t tok, int mem) {
+  char *base = tok.tokens[mem];
+  bool closed = base[strlen(base) - 1] == ']';
+  int last = closed ? mem : mem + 1;
+  bool valid = base[0] == '[' && base[1] == 'x' && isdigit(base[2]) &&
+               last == tok.length - 1;
+  if (valid && !closed) {
+    char *end;
+    const char *offset = tok.tokens[last];
+    valid = is_immediate(offset) && strtol(offset + 1, &end, 0) == 0 &&
+            strcmp(end, "]") == 0;
+  }
+  if (!valid) {
+    fprintf(stderr, "Expected [xn] or [xn, #0] as the address of %s\n",
+            tok.tokens[0]);
+    exit(1);
+  }
+  return get_reg_num(base + 2);
+}
+
 parsed_line_type_t get_line_type(char *command) {
   if (strcmp(command, ".int") == 0 ) { 
     return LINE_DIRECTIVE;
@@ -276,6 +491,16 @@ static tokenized_line_t tokenize(char input[]) {
   return tokenized_line;
 }
 
+// a label, or an address given as a number
+static operand_t branch_target(symbol_table_ptr_t table, char *target) {
+  if (is_label(target)) {
+    return (operand_t){.type = OPERAND_LITERAL_LABEL,
+                       .literal_label = put_label(table, target, UINT32_MAX, false)};
+  }
+  return (operand_t){.type = OPERAND_LITERAL_ADDRESS,
+                     .literal_address = strtol(target, NULL, 0)};
+}
+
 // Main parse function into IR-format
 parsed_line_t parse(char str_input[], u32 address, symbol_table_ptr_t table) {
 
@@ -311,7 +536,8 @@ parsed_line_t parse(char str_input[], u32 address, symbol_table_ptr_t table) {
       parsed_instr.instr.mnemonic_tok = tok_line.mnemonic;
       assert (parsed_instr.instr.mnemonic != NULL); //CHANGE THIS TO SOMETHING COOLER
       strcpy(parsed_instr.instr.mnemonic, tok_line.tokens[0]);
-      parsed_instr.instr.instr_type = get_instr_type(tok_line.tokens[0]);
+      parsed_instr.instr.instr_type = get_instr_type(
+          tok_line.tokens[0], tok_line.length > 1 ? tok_line.tokens[1] : "");
       //parsed_instr.instr.label_address = address;
 
       switch (parsed_instr.instr.instr_type) {
@@ -320,13 +546,23 @@ parsed_line_t parse(char str_input[], u32 address, symbol_table_ptr_t table) {
           
           if (strcmp(tok_line.tokens[0], "b") == 0 || is_bcond_instruction(tok_line.tokens[0])) {
             //MID: tokens[1] is a literal
-            if (is_label(tok_line.tokens[1])) {
-              parsed_instr.instr.operands[0].type = OPERAND_LITERAL_LABEL;
-              parsed_instr.instr.operands[0].literal_label = put_label(table, tok_line.tokens[1], UINT32_MAX, false);
-            } else {
-              parsed_instr.instr.operands[0].type = OPERAND_LITERAL_ADDRESS;
-              parsed_instr.instr.operands[0].literal_address = strtol(tok_line.tokens[1], NULL, 0);
+            parsed_instr.instr.operands[0] = branch_target(table, tok_line.tokens[1]);
+
+          } else if (is_compare_branch_instruction(tok_line.tokens[0])) {
+            //MID: cbz x0, label or tbz x0, #3, label
+            int target = tok_line.length - 1;
+            parsed_instr.instr.operands[0] = (operand_t){
+                .type = OPERAND_REGISTER,
+                .reg = {.is_64bit = tok_line.tokens[1][0] == 'x',
+                        .reg_num = get_reg_num(tok_line.tokens[1] + 1)}};
+            if (target == 3) {
+              parsed_instr.instr.operands[1] = (operand_t) {
+                .type = OPERAND_IMMEDIATE,
+                .immediate = strtol(tok_line.tokens[2] + 1, NULL, 0)
+              };
             }
+            parsed_instr.instr.operands[target - 1] = branch_target(table, tok_line.tokens[target]);
+            parsed_instr.instr.operand_count = target;
 
           } else if (strcmp(tok_line.tokens[0], "br") == 0 ) {
             //MID: tokens[1] is xn register
@@ -353,63 +589,100 @@ parsed_line_t parse(char str_input[], u32 address, symbol_table_ptr_t table) {
                               .reg_num = get_reg_num(tok_line.tokens[1] + 1),
                           }};
 
-          offset_type_t offset_t = get_offset_type(tok_line);
+          if (is_exclusive_instruction(tok_line.tokens[0])) {
+            //MID: registers, then [xn] with no offset: stxr w2, x0, [x1]
+            int mem = 1;
+            while (mem < tok_line.length && tok_line.tokens[mem][0] != '[')
+              mem++;
+            if (mem == tok_line.length) {
+              fprintf(stderr, "Missing the address of %s\n",
+                      tok_line.tokens[0]);
+              exit(1);
+            }
+            for (int i = 1; i < mem - 1; i++) {
+              parsed_instr.instr.operands[i] = (operand_t){
+                  .type = OPERAND_REGISTER,
+                  .reg = {.is_64bit = tok_line.tokens[i + 1][0] == 'x',
+                          .reg_num = get_reg_num(tok_line.tokens[i + 1] + 1)}};
+            }
+            parsed_instr.instr.operands[mem - 1] = (operand_t) {
+              .type = OPERAND_MEMORY_UNSIGNED_OFFSET,
+              .reg = {
+                .is_64bit = true,
+                .reg_num = get_exclusive_base(tok_line, mem)
+              }
+            };
+            parsed_instr.instr.operand_count = mem;
+            break;
+          }
+
+          //MID: pairs have a second register before the address:
+          //     ldp x0, x1, [x2, #16]
+          int mem = 1;
+          if (is_pair_instruction(tok_line.tokens[0])) {
+            parsed_instr.instr.operands[1] = (operand_t){
+                .type = OPERAND_REGISTER,
+                .reg = {.is_64bit = tok_line.tokens[2][0] == 'x',
+                        .reg_num = get_reg_num(tok_line.tokens[2] + 1)}};
+            mem = 2;
+          }
+          offset_type_t offset_t = get_offset_type(tok_line, mem + 1);
 
           switch (offset_t) {
             case (POST_INDEX): {
-              parsed_instr.instr.operand_count = 3;
-              parsed_instr.instr.operands[1] = (operand_t) {
+              parsed_instr.instr.operand_count = mem + 2;
+              parsed_instr.instr.operands[mem] = (operand_t) {
                 .type = OPERAND_MEMORY_POST_INDEX, 
                 .reg = {
                   .is_64bit = true, 
-                  .reg_num = strtol(remove_closing_bracket(tok_line.tokens[2] + 1), NULL, 0)
+                  .reg_num = strtol(remove_closing_bracket(tok_line.tokens[mem + 1] + 1), NULL, 0)
                 }
               };
 
-              parsed_instr.instr.operands[2] = (operand_t) {
+              parsed_instr.instr.operands[mem + 1] = (operand_t) {
                 .type = OPERAND_SIGNED_IMMEDIATE, 
-                .s_immediate = strtol(tok_line.tokens[3] + 1, NULL, 0) 
+                .s_immediate = strtol(tok_line.tokens[mem + 2] + 1, NULL, 0) 
               };
               break;
             }
             
             case (PRE_INDEX): {
-              parsed_instr.instr.operand_count = 3;
-              parsed_instr.instr.operands[1] = (operand_t) {
+              parsed_instr.instr.operand_count = mem + 2;
+              parsed_instr.instr.operands[mem] = (operand_t) {
                 .type = OPERAND_MEMORY_PRE_INDEX, 
                 .reg = {
                   .is_64bit = true, 
-                  .reg_num = strtol(tok_line.tokens[2] + 2, NULL, 0)
+                  .reg_num = strtol(tok_line.tokens[mem + 1] + 2, NULL, 0)
                 }
               };
 
               /* TODO: maybe add 1 to tokens[3] in remove_closing bracket? */
-              parsed_instr.instr.operands[2] = (operand_t){
+              parsed_instr.instr.operands[mem + 1] = (operand_t){
                   .type = OPERAND_SIGNED_IMMEDIATE,
                   .s_immediate = strtol(
-                      remove_closing_bracket(tok_line.tokens[3]), NULL, 0)};
+                      remove_closing_bracket(tok_line.tokens[mem + 2]), NULL, 0)};
               break;
             }
 
             case (UNSIGNED_OFFSET): {
-              parsed_instr.instr.operands[1] = (operand_t) {
+              parsed_instr.instr.operands[mem] = (operand_t) {
                 .type = OPERAND_MEMORY_UNSIGNED_OFFSET, 
                 .reg = {
                   .is_64bit = true, 
-                  .reg_num = strtol(remove_closing_bracket(tok_line.tokens[2] + 1), NULL, 0)
+                  .reg_num = strtol(remove_closing_bracket(tok_line.tokens[mem + 1] + 1), NULL, 0)
                 }
               };
 
-              if (tok_line.length == 3) {
+              if (tok_line.length == mem + 2) {
                 //MID: NO OPTIONAL IMM
-                parsed_instr.instr.operand_count = 2;
-              } else if (tok_line.length == 4){
+                parsed_instr.instr.operand_count = mem + 1;
+              } else if (tok_line.length == mem + 3){
                 //MID: YES OPTIONAL IMM
-                parsed_instr.instr.operand_count = 3;
-                parsed_instr.instr.operands[2] = (operand_t){
+                parsed_instr.instr.operand_count = mem + 2;
+                parsed_instr.instr.operands[mem + 1] = (operand_t){
                     .type = OPERAND_IMMEDIATE,
                     .immediate = strtol(
-                        remove_closing_bracket(tok_line.tokens[3]), NULL, 0)};
+                        remove_closing_bracket(tok_line.tokens[mem + 2]), NULL, 0)};
               } else {
                 printf("Cannot parse line: 313\n");
                 exit(1); //ERROR
@@ -417,30 +690,30 @@ parsed_line_t parse(char str_input[], u32 address, symbol_table_ptr_t table) {
               break;
             }
             case (REGISTER_OFFSET): {
-              parsed_instr.instr.operand_count = 3;
-              parsed_instr.instr.operands[1] = (operand_t) {
+              parsed_instr.instr.operand_count = mem + 2;
+              parsed_instr.instr.operands[mem] = (operand_t) {
                 .type = OPERAND_MEMORY_REGISTER_OFFSET, 
                 .reg = {
                   .is_64bit = true, 
-                  .reg_num = strtol(tok_line.tokens[2] + 2, NULL, 0)
+                  .reg_num = strtol(tok_line.tokens[mem + 1] + 2, NULL, 0)
                 }
               };
 
-              parsed_instr.instr.operands[2] = (operand_t){
+              parsed_instr.instr.operands[mem + 1] = (operand_t){
                   .type = OPERAND_REGISTER,
                   .reg = {.is_64bit = true,
                           .reg_num = get_reg_num(
-                              remove_closing_bracket(tok_line.tokens[3]))}};
+                              remove_closing_bracket(tok_line.tokens[mem + 2]))}};
               break;
             }
             case (LOAD_LITERAL): {
-              parsed_instr.instr.operand_count = 2; 
-              if (is_label(tok_line.tokens[2])) {
-                parsed_instr.instr.operands[1].type = OPERAND_LITERAL_LABEL;
-                parsed_instr.instr.operands[1].literal_label = put_label(table, tok_line.tokens[2], UINT32_MAX, false);
+              parsed_instr.instr.operand_count = mem + 1; 
+              if (is_label(tok_line.tokens[mem + 1])) {
+                parsed_instr.instr.operands[mem].type = OPERAND_LITERAL_LABEL;
+                parsed_instr.instr.operands[mem].literal_label = put_label(table, tok_line.tokens[mem + 1], UINT32_MAX, false);
               } else {
-                parsed_instr.instr.operands[1].type = OPERAND_LITERAL_ADDRESS;
-                parsed_instr.instr.operands[1].literal_address = strtol(tok_line.tokens[2] + 1, NULL, 0);
+                parsed_instr.instr.operands[mem].type = OPERAND_LITERAL_ADDRESS;
+                parsed_instr.instr.operands[mem].literal_address = strtol(tok_line.tokens[mem + 1] + 1, NULL, 0);
               }
               break;
             }
@@ -461,7 +734,21 @@ parsed_line_t parse(char str_input[], u32 address, symbol_table_ptr_t table) {
           
           char *mnemonic = tok_line.tokens[0]; 
           //mul/mneg, madd/msub, mov, tst, 
-          if (is_rn_rd_instructions(mnemonic)) {
+          if (is_cond_select_instruction(mnemonic)) {
+            //MID: registers, then the condition: csel x0, x1, x2, lt
+            int count = tok_line.length - 1;
+            for (int i = 1; i < count - 1; i++) {
+              parsed_instr.instr.operands[i] = (operand_t){
+                  .type = OPERAND_REGISTER,
+                  .reg = {.is_64bit = tok_line.tokens[i + 1][0] == 'x',
+                          .reg_num = get_reg_num(tok_line.tokens[i + 1] + 1)}};
+            }
+            parsed_instr.instr.operands[count - 1] = (operand_t) {
+              .type = OPERAND_IMMEDIATE,
+              .immediate = get_condition(tok_line.tokens[count])
+            };
+            parsed_instr.instr.operand_count = count;
+          } else if (is_rn_rd_instructions(mnemonic)) {
             parsed_instr.instr.operands[1] = (operand_t){
                 .type = OPERAND_REGISTER,
                 .reg = {.is_64bit = tok_line.tokens[2][0] == 'x',
@@ -544,6 +831,115 @@ parsed_line_t parse(char str_input[], u32 address, symbol_table_ptr_t table) {
           }
           break;
         }
+        case INSTR_SYSTEM: {
+          token_mnemonic_t tok = tok_line.mnemonic;
+          if (tok == TOKEN_NOP) {
+            parsed_instr.instr.operand_count = 0;
+          } else if (tok == TOKEN_DMB || tok == TOKEN_DSB) {
+            //MID: dmb ish
+            if (tok_line.length != 2) {
+              fprintf(stderr, "%s takes a barrier option\n",
+                      tok_line.tokens[0]);
+              exit(1);
+            }
+            parsed_instr.instr.operand_count = 1;
+            parsed_instr.instr.operands[0] = (operand_t) {
+              .type = OPERAND_IMMEDIATE,
+              .immediate = get_barrier_option(tok_line.tokens[1])
+            };
+          } else if (tok == TOKEN_ISB || tok == TOKEN_CLREX) {
+            //MID: isb, clrex, or with the option given: isb sy, clrex #0xf
+            parsed_instr.instr.operand_count = 1;
+            parsed_instr.instr.operands[0] = (operand_t) {
+              .type = OPERAND_IMMEDIATE,
+              .immediate = tok_line.length > 1
+                               ? get_barrier_option(tok_line.tokens[1])
+                               : BARRIER_SY
+            };
+          } else {
+            //MID: mrs x0, mpidr_el1
+            parsed_instr.instr.operand_count = 2;
+            parsed_instr.instr.operands[0] = (operand_t){
+                .type = OPERAND_REGISTER,
+                .reg = {.is_64bit = true,
+                        .reg_num = get_reg_num(tok_line.tokens[1] + 1)}};
+            parsed_instr.instr.operands[1] = (operand_t) {
+              .type = OPERAND_IMMEDIATE,
+              .immediate = get_system_register(tok_line.tokens[2])
+            };
+          }
+          break;
+        }
+
+        case INSTR_SIMD: {
+          char *mnemonic = tok_line.tokens[0];
+          if (strcmp(mnemonic, "ld1") == 0 || strcmp(mnemonic, "st1") == 0) {
+            //MID: a list of registers, then the address:
+            //     ld1 {v0.4s, v1.4s}, [x0], #32 or st1 {v0.16b-v3.16b}, [x1]
+            int mem = 1;
+            while (mem < tok_line.length - 1 &&
+                   tok_line.tokens[mem][strlen(tok_line.tokens[mem]) - 1] != '}') {
+              mem++;
+            }
+            operand_t first = get_vector(tok_line.tokens[1]);
+            u32 count = mem;
+            char *range = strchr(tok_line.tokens[1], '-');
+            if (range != NULL) {
+              count = (get_vector(range + 1).vector.reg_num -
+                       first.vector.reg_num + 32) % 32 + 1;
+            }
+            mem++;
+            bool post_index = tok_line.length == mem + 2;
+
+            parsed_instr.instr.operands[0] = first;
+            parsed_instr.instr.operands[1] = (operand_t) {
+              .type = OPERAND_IMMEDIATE,
+              .immediate = count
+            };
+            parsed_instr.instr.operands[2] = (operand_t) {
+              .type = post_index ? OPERAND_MEMORY_POST_INDEX
+                                 : OPERAND_MEMORY_UNSIGNED_OFFSET,
+              .reg = {
+                .is_64bit = true,
+                .reg_num = strtol(remove_closing_bracket(tok_line.tokens[mem] + 1), NULL, 0)
+              }
+            };
+            parsed_instr.instr.operand_count = 3;
+            if (post_index) {
+              char *step = tok_line.tokens[mem + 1];
+              if (is_immediate(step)) {
+                parsed_instr.instr.operands[3] = (operand_t) {
+                  .type = OPERAND_IMMEDIATE,
+                  .immediate = strtol(step + 1, NULL, 0)
+                };
+              } else {
+                parsed_instr.instr.operands[3] = (operand_t){
+                    .type = OPERAND_REGISTER,
+                    .reg = {.is_64bit = true,
+                            .reg_num = get_reg_num(step + 1)}};
+              }
+              parsed_instr.instr.operand_count = 4;
+            }
+          } else {
+            //MID: vectors, and the general purpose register of dup and umov:
+            //     add v0.4s, v1.4s, v2.4s or addv s0, v1.4s or umov w0, v1.s[1]
+            int count = tok_line.length - 1;
+            for (int i = 0; i < count; i++) {
+              char *operand = tok_line.tokens[i + 1];
+              if (operand[0] == 'x' || operand[0] == 'w') {
+                parsed_instr.instr.operands[i] = (operand_t){
+                    .type = OPERAND_REGISTER,
+                    .reg = {.is_64bit = operand[0] == 'x',
+                            .reg_num = get_reg_num(operand + 1)}};
+              } else {
+                parsed_instr.instr.operands[i] = get_vector(operand);
+              }
+            }
+            parsed_instr.instr.operand_count = count;
+          }
+          break;
+        }
+
         default:
         printf("Cannot parse line: 454\n");
           exit(1); //ERROR
@@ -6,7 +6,7 @@
 #include <stdbool.h>
 #include "../utils/hashmap.h"
 
-#define MAX_TOKENS_COUNT 6 // Max count of all opcode, all operands
+#define MAX_TOKENS_COUNT 8 // Max count of all opcode, all operands
 #define INSTRUCTION_COUNT 31
 
 bool is_label(const char *str);
@@ -0,0 +1,317 @@
+#include "batch.h"
+#include "jit.h"
+#include "machine.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OUT_EXTENSION ".out"
+#define IMAGE_EXTENSION ".bin"
+
+typedef enum { JOB_RAN, JOB_PASSED, JOB_FAILED, JOB_ERROR } job_status_t;
+
+static const char *const status_names[] = {
+    [JOB_RAN] = "RAN",
+    [JOB_PASSED] = "PASS",
+    [JOB_FAILED] = "FAIL",
+    [JOB_ERROR] = "ERROR",
+};
+
+typedef struct {
+  char *image;
+  char *expected; /* NULL if there is nothing to compare against */
+  char *output;
+  job_status_t status;
+} batch_job_t;
+
+/*
+ * The jobs a worker still has to run. Jobs never create new jobs, so a deque
+ * is just a range of job indices: the owner takes from the bottom and thieves
+ * from the top.
+ */
+typedef struct {
+  pthread_mutex_t lock;
+  int top, bottom; /* jobs [top, bottom) */
+} job_deque_t;
+
+typedef struct {
+  batch_job_t *jobs;
+  int job_count;
+  job_deque_t *deques;
+  int worker_count;
+  bool use_jit;
+  u64 memory_size;
+  bool fast_forward;
+} batch_t;
+
+typedef struct {
+  batch_t *batch;
+  int id;
+} worker_t;
+
+/* ======== manifest ======== */
+
+static char *output_path(const char *image, const char *out_dir) {
+  const char *name = image;
+  if (out_dir != NULL) {
+    const char *slash = strrchr(image, '/');
+    if (slash != NULL)
+      name = slash + 1;
+  }
+
+  size_t len = strlen(name);
+  size_t ext_len = strlen(IMAGE_EXTENSION);
+  if (len >= ext_len && strcmp(name + len - ext_len, IMAGE_EXTENSION) == 0)
+    len -= ext_len;
+
+  size_t dir_len = out_dir != NULL ? strlen(out_dir) + 1 : 0;
+  char *path = malloc(dir_len + len + strlen(OUT_EXTENSION) + 1);
+  if (path == NULL)
+    return NULL;
+  if (out_dir != NULL)
+    sprintf(path, "%s/", out_dir);
+  sprintf(path + dir_len, "%.*s%s", (int)len, name, OUT_EXTENSION);
+  return path;
+}
+
+static void free_jobs(batch_job_t *jobs, int count) {
+  for (int i = 0; i < count; i++) {
+    free(jobs[i].image);
+    free(jobs[i].expected);
+    free(jobs[i].output);
+  }
+  free(jobs);
+}
+
+/* returns the number of jobs read, or -1 on error */
+static int read_manifest(const char *manifest, const char *out_dir,
+                         batch_job_t **jobs_out) {
+  FILE *file = fopen(manifest, "r");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open the manifest %s\n", manifest);
+    return -1;
+  }
+
+  batch_job_t *jobs = NULL;
+  int count = 0, capacity = 0;
+  char line[BATCH_MAX_LINE];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char *image = strtok(line, " \t\r\n");
+    if (image == NULL || image[0] == '#')
+      continue;
+    char *expected = strtok(NULL, " \t\r\n");
+
+    if (count == capacity) {
+      capacity = capacity ? 2 * capacity : 64;
+      batch_job_t *grown = realloc(jobs, capacity * sizeof(batch_job_t));
+      if (grown == NULL)
+        break;
+      jobs = grown;
+    }
+    batch_job_t *job = &jobs[count++];
+    job->image = strdup(image);
+    job->expected = expected != NULL ? strdup(expected) : NULL;
+    job->output = output_path(image, out_dir);
+    if (job->image == NULL || job->output == NULL ||
+        (expected != NULL && job->expected == NULL)) {
+      free_jobs(jobs, count);
+      fclose(file);
+      return -1;
+    }
+  }
+  fclose(file);
+
+  *jobs_out = jobs;
+  return count;
+}
+
+/* ======== jobs ======== */
+
+static bool file_matches(const char *path, const char *data, size_t size) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+    return false;
+
+  bool same = true;
+  char buf[BATCH_MAX_LINE];
+  size_t offset = 0, n;
+  while (same && (n = fread(buf, 1, sizeof(buf), file)) > 0) {
+    same = offset + n <= size && memcmp(buf, data + offset, n) == 0;
+    offset += n;
+  }
+  fclose(file);
+  return same && offset == size;
+}
+
+static job_status_t run_job(machine_t *m, const batch_job_t *job) {
+  if (!machine_load_program(m, job->image))
+    return JOB_ERROR;
+  run_machine(m);
+  if (m->exit.reason != MACHINE_HALTED) {
+    /* an error only stops this image, the worker goes on to the next one */
+    fprintf(stderr, "%s: ", job->image);
+    machine_print_exit(stderr, &m->exit);
+    if (m->exit.reason != MACHINE_INVALID_INSTRUCTION)
+      return JOB_ERROR;
+  }
+
+  /* the dump is kept in memory to compare it with the expected output */
+  char *dump = NULL;
+  size_t size = 0;
+  FILE *stream = open_memstream(&dump, &size);
+  if (stream == NULL)
+    return JOB_ERROR;
+  shutdown_machine(m, stream);
+  fclose(stream);
+
+  job_status_t status = JOB_RAN;
+  FILE *out = fopen(job->output, "w");
+  if (out == NULL || fwrite(dump, 1, size, out) != size) {
+    fprintf(stderr, "Could not write %s\n", job->output);
+    status = JOB_ERROR;
+  }
+  if (out != NULL)
+    fclose(out);
+
+  if (status == JOB_RAN && job->expected != NULL)
+    status = file_matches(job->expected, dump, size) ? JOB_PASSED : JOB_FAILED;
+  free(dump);
+  return status;
+}
+
+/* ======== work stealing ======== */
+
+static int pop_job(job_deque_t *deque) {
+  int job = -1;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->bottom > deque->top)
+    job = --deque->bottom;
+  pthread_mutex_unlock(&deque->lock);
+  return job;
+}
+
+/* moves half of the jobs of some other worker to this one */
+static bool steal_jobs(batch_t *batch, int id) {
+  for (int i = 1; i < batch->worker_count; i++) {
+    job_deque_t *victim = &batch->deques[(id + i) % batch->worker_count];
+
+    pthread_mutex_lock(&victim->lock);
+    int available = victim->bottom - victim->top;
+    int first = victim->top;
+    int taken = (available + 1) / 2;
+    victim->top += taken;
+    pthread_mutex_unlock(&victim->lock);
+
+    if (taken > 0) {
+      job_deque_t *own = &batch->deques[id];
+      pthread_mutex_lock(&own->lock);
+      own->top = first;
+      own->bottom = first + taken;
+      pthread_mutex_unlock(&own->lock);
+      return true;
+    }
+  }
+  return false;
+}
+
+static void *worker_main(void *arg) {
+  worker_t *worker = arg;
+  batch_t *batch = worker->batch;
+
+  machine_t *m = machine_create(batch->memory_size);
+  if (m == NULL) {
+    /* the other workers steal everything this one was given */
+    return NULL;
+  }
+  m->fast_forward = batch->fast_forward;
+  if (batch->use_jit)
+    jit_init(m);
+
+  while (TRUE) {
+    int job = pop_job(&batch->deques[worker->id]);
+    if (job < 0) {
+      /* no new jobs appear, so once every deque is empty the batch is done */
+      if (!steal_jobs(batch, worker->id))
+        break;
+      continue;
+    }
+    batch->jobs[job].status = run_job(m, &batch->jobs[job]);
+  }
+
+  machine_destroy(m);
+  return NULL;
+}
+
+int run_batch(const char *manifest, const char *out_dir, int threads,
+              bool use_jit, u64 memory_size, bool fast_forward) {
+  batch_t batch = {.use_jit = use_jit,
+                   .memory_size = memory_size,
+                   .fast_forward = fast_forward};
+  batch.job_count = read_manifest(manifest, out_dir, &batch.jobs);
+  if (batch.job_count < 0)
+    return -1;
+
+  if (threads <= 0)
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads > batch.job_count)
+    threads = batch.job_count;
+  if (threads < 1)
+    threads = 1;
+  batch.worker_count = threads;
+
+  batch.deques = calloc(threads, sizeof(job_deque_t));
+  worker_t *workers = calloc(threads, sizeof(worker_t));
+  pthread_t *tids = calloc(threads, sizeof(pthread_t));
+  if (batch.deques == NULL || workers == NULL || tids == NULL) {
+    fprintf(stderr, "Could not allocate the batch workers.\n");
+    free(batch.deques);
+    free(workers);
+    free(tids);
+    free_jobs(batch.jobs, batch.job_count);
+    return -1;
+  }
+
+  /* every job starts in an error state, in case no worker gets to it */
+  for (int i = 0; i < batch.job_count; i++)
+    batch.jobs[i].status = JOB_ERROR;
+
+  /* deal the jobs out in contiguous runs */
+  for (int i = 0; i < threads; i++) {
+    pthread_mutex_init(&batch.deques[i].lock, NULL);
+    batch.deques[i].top = (int)((long)batch.job_count * i / threads);
+    batch.deques[i].bottom = (int)((long)batch.job_count * (i + 1) / threads);
+    workers[i] = (worker_t){.batch = &batch, .id = i};
+  }
+
+  int started = 0;
+  for (; started < threads; started++) {
+    if (pthread_create(&tids[started], NULL, worker_main, &workers[started]))
+      break;
+  }
+  if (started == 0) /* run everything on this thread instead */
+    worker_main(&workers[0]);
+  for (int i = 0; i < started; i++)
+    pthread_join(tids[i], NULL);
+
+  int failures = 0, passed = 0;
+  for (int i = 0; i < batch.job_count; i++) {
+    const batch_job_t *job = &batch.jobs[i];
+    printf("%-5s %s\n", status_names[job->status], job->image);
+    if (job->status == JOB_FAILED || job->status == JOB_ERROR)
+      failures++;
+    else if (job->status == JOB_PASSED)
+      passed++;
+  }
+  printf("%d images, %d passed, %d failed\n", batch.job_count, passed,
+         failures);
+
+  for (int i = 0; i < threads; i++)
+    pthread_mutex_destroy(&batch.deques[i].lock);
+  free(batch.deques);
+  free(workers);
+  free(tids);
+  free_jobs(batch.jobs, batch.job_count);
+  return failures;
+}
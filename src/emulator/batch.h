@@ -0,0 +1,33 @@
+#ifndef BATCH
+#define BATCH
+
+#include "../defs.h"
+#include <stdbool.h>
+
+/* longest line accepted in a manifest */
+#define BATCH_MAX_LINE 4096
+
+/**
+ * Runs every image listed in a manifest on a pool of worker threads, each of
+ * which reuses a single machine for all the images it runs. Idle workers steal
+ * half of the remaining images of a busy one.
+ *
+ * Each manifest line names an image, optionally followed by a file holding
+ * its expected output. Blank lines and lines starting with '#' are ignored.
+ * The final state of every image is written in the format of
+ * shutdown_machine, to the image path with ".bin" replaced by ".out".
+ *
+ * @param manifest The manifest file.
+ * @param out_dir  Directory for the results instead of next to the images, or
+ *                 NULL.
+ * @param threads  Number of workers, 0 for one per online CPU.
+ * @param use_jit  Whether the workers compile hot blocks.
+ * @param memory_size Size of the address space of every machine.
+ * @param fast_forward Whether delay loops are skipped, see block.h.
+ * @return the number of images that failed or could not be run, or -1 if the
+ *         manifest could not be read.
+ */
+int run_batch(const char *manifest, const char *out_dir, int threads,
+              bool use_jit, u64 memory_size, bool fast_forward);
+
+#endif /* BATCH */
@@ -0,0 +1,442 @@
+#include "block.h"
+#include "../utils/bits_utils.h"
+#include "decode.h"
+#include "emulate.h"
+#include "execute/branches.h"
+#include "execute/immediate_instructions.h"
+#include "execute/load_store.h"
+#include "execute/register_instruction.h"
+#include "execute/simd.h"
+#include "flags.h"
+#include "jit.h"
+#include "memory.h"
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_HASH_MASK (BLOCK_HASH_SIZE - 1)
+#define BLOCK_HASH(pc) (((pc) >> 2) & BLOCK_HASH_MASK)
+/* a block spans at most two pages, so every block adds at most two */
+#define CODE_PAGE_LIMIT (2 * BLOCK_POOL_SIZE)
+
+struct block_cache {
+  block_t block_pool[BLOCK_POOL_SIZE];
+  block_op_t op_pool[BLOCK_OP_POOL_SIZE];
+  u32 block_count;
+  u32 op_count;
+
+  block_t *block_hash[BLOCK_HASH_SIZE];
+  /* addresses of the pages flagged as PAGE_CODE */
+  u64 code_pages[CODE_PAGE_LIMIT];
+  u32 code_page_count;
+
+  /* set when blocks are dropped, so stale ones are neither chained nor run */
+  bool flushed;
+};
+
+static const struct {
+  exec_fn fn;
+  op_kind_t kind;
+} op_kinds[] = {
+    {exec_arith_imm, OP_ARITH_IMM},
+    {exec_move_wide, OP_MOVE_WIDE},
+    {exec_move_keep, OP_MOVE_KEEP},
+    {exec_arith_reg, OP_ARITH_REG},
+    {exec_logic_reg, OP_LOGIC_REG},
+    {exec_multiply, OP_MULTIPLY},
+    {exec_cond_select, OP_COND_SELECT},
+    {exec_load, OP_LOAD},
+    {exec_store, OP_STORE},
+    {exec_load_literal, OP_LOAD_LITERAL},
+    {exec_load_pair, OP_LOAD_PAIR},
+    {exec_store_pair, OP_STORE_PAIR},
+    {exec_vector_add, OP_VECTOR},
+    {exec_vector_sub, OP_VECTOR},
+    {exec_vector_mul, OP_VECTOR},
+    {exec_vector_logic, OP_VECTOR},
+    {exec_vector_reduce, OP_VECTOR},
+    {exec_vector_dup, OP_VECTOR},
+    {exec_vector_move, OP_VECTOR},
+    {exec_vector_load, OP_VECTOR_LOAD},
+    {exec_vector_store, OP_VECTOR_STORE},
+    {exec_branch, OP_BRANCH},
+    {exec_branch_reg, OP_BRANCH_REG},
+    {exec_branch_cond, OP_BRANCH_COND},
+    {exec_compare_branch, OP_COMPARE_BRANCH},
+    {exec_test_branch, OP_TEST_BRANCH},
+};
+
+#define OP_KINDS_COUNT (sizeof(op_kinds) / sizeof(op_kinds[0]))
+
+static op_kind_t op_kind(const decoded_instr_t *d) {
+  for (size_t i = 0; i < OP_KINDS_COUNT; i++) {
+    if (op_kinds[i].fn == d->exec)
+      return op_kinds[i].kind;
+  }
+  return d->ends_block ? OP_CALL_EXIT : OP_CALL;
+}
+
+void block_cache_flush(machine_t *m) {
+  struct block_cache *bc = m->block_cache;
+  if (m->profile != NULL) {
+    for (u32 i = 0; i < bc->block_count; i++)
+      profile_add_block(m, &bc->block_pool[i]);
+  }
+  bc->block_count = 0;
+  bc->op_count = 0;
+  memset(bc->block_hash, 0, sizeof(bc->block_hash));
+  for (u32 i = 0; i < bc->code_page_count; i++)
+    memory_clear_flags(m, bc->code_pages[i], PAGE_CODE);
+  bc->code_page_count = 0;
+  if (m->jit != NULL)
+    jit_flush(m);
+  bc->flushed = true;
+}
+
+static bool overlaps(const block_t *b, u64 address, int num_bytes) {
+  return address < b->pc + b->len * sizeof(instruction) &&
+         b->pc < address + num_bytes;
+}
+
+void block_cache_invalidate(machine_t *m, u64 address, int num_bytes) {
+  struct block_cache *bc = m->block_cache;
+  bool dropped = false;
+  for (u32 i = 0; i < bc->block_count; i++) {
+    block_t *b = &bc->block_pool[i];
+    if (b->dropped || !overlaps(b, address, num_bytes))
+      continue;
+    /* unhashed, it is translated again the next time it is looked up */
+    block_t **link = &bc->block_hash[BLOCK_HASH(b->pc)];
+    while (*link != b)
+      link = &(*link)->hash_next;
+    *link = b->hash_next;
+    if (m->profile != NULL)
+      profile_add_block(m, b);
+    b->count = 0;
+    b->dropped = true;
+    dropped = true;
+  }
+  if (!dropped)
+    return;
+
+  /* nothing may chain into the dropped blocks either */
+  for (u32 i = 0; i < bc->block_count; i++) {
+    block_t *b = &bc->block_pool[i];
+    for (int j = 0; j < 2; j++) {
+      if (b->succ[j] != NULL && b->succ[j]->dropped)
+        b->succ[j] = NULL;
+    }
+  }
+  /* the block running the store may be one of them */
+  bc->flushed = true;
+}
+
+bool block_cache_create(machine_t *m) {
+  m->block_cache = calloc(1, sizeof(*m->block_cache));
+  if (m->block_cache == NULL)
+    return false;
+  block_cache_flush(m);
+  return true;
+}
+
+void block_cache_destroy(machine_t *m) {
+  free(m->block_cache);
+  m->block_cache = NULL;
+}
+
+/* the subs counting down a delay loop, see run_blocks, or NULL */
+static const decoded_instr_t *find_countdown(const block_t *b) {
+  const decoded_instr_t *branch = &b->ops[b->len - 1].d;
+  if (b->len < 2 || branch->exec != exec_branch_cond ||
+      branch->opc != COND_NE || branch->imm != b->pc)
+    return NULL;
+
+  const decoded_instr_t *countdown = NULL;
+  for (u32 i = 0; i + 1 < b->len; i++) {
+    const decoded_instr_t *d = &b->ops[i].d;
+    if (d->exec == exec_nop)
+      continue;
+    if (countdown != NULL || d->exec != exec_arith_imm ||
+        d->opc != OPP_SUB_FLAGS || d->rd != d->rn || d->rd >= REG_COUNT ||
+        d->imm == 0)
+      return NULL;
+    countdown = d;
+  }
+  return countdown;
+}
+
+/* runs a delay loop to completion in one go, false if it cannot be skipped */
+static bool fast_forward(machine_t *m, block_t *b) {
+  const decoded_instr_t *d = b->countdown;
+  u64 counter = d->sf ? m->regs[d->rd] : zero_upper_32(m->regs[d->rd]);
+  /* otherwise the counter wraps around rather than reaching zero */
+  if (counter == 0 || counter % d->imm != 0)
+    return false;
+
+  b->count += counter / d->imm;
+  m->regs[d->rd] = 0;
+  record_arith_flags(&m->pstate, d->imm, d->imm, 0, true, d->sf);
+  m->PC = b->pc + b->len * sizeof(instruction);
+  return true;
+}
+
+static block_t *translate(machine_t *m, reg pc, const void *const *labels) {
+  struct block_cache *bc = m->block_cache;
+  if (bc->block_count == BLOCK_POOL_SIZE ||
+      bc->op_count + BLOCK_MAX_INSTRS + 1 > BLOCK_OP_POOL_SIZE)
+    block_cache_flush(m);
+
+  block_t *b = &bc->block_pool[bc->block_count++];
+  b->pc = pc;
+  b->ops = &bc->op_pool[bc->op_count];
+  b->succ[0] = b->succ[1] = NULL;
+  b->heat = 0;
+  b->count = 0;
+  b->native = NULL;
+  b->dropped = false;
+
+  /* decode up to (and including) the first instruction ending the block */
+  u32 len = 0;
+  reg addr = pc;
+  bool exits = false;
+  while (!exits &&
+         (len == 0 || (len < BLOCK_MAX_INSTRS &&
+                       addr <= m->memory_size - sizeof(instruction)))) {
+    block_op_t *op = &b->ops[len++];
+    op->d = *decode_cache_lookup(m, addr);
+    op->kind = op_kind(&op->d);
+    op->label = labels[op->kind];
+    exits = op->d.ends_block;
+    addr += sizeof(instruction);
+  }
+  b->len = len;
+  bc->op_count += len;
+  b->countdown = find_countdown(b);
+
+  if (!exits) {
+    b->ops[len].kind = OP_END;
+    b->ops[len].label = labels[OP_END];
+    bc->op_count++;
+  }
+
+  /* stores to the pages of the block take the slow path, to drop it if hit */
+  for (u64 page = pc & ~PAGE_MASK; page < addr; page += PAGE_SIZE) {
+    if (memory_set_flags(m, page, PAGE_CODE))
+      bc->code_pages[bc->code_page_count++] = page;
+  }
+
+  b->hash_next = bc->block_hash[BLOCK_HASH(pc)];
+  bc->block_hash[BLOCK_HASH(pc)] = b;
+  return b;
+}
+
+static block_t *find_block(machine_t *m, reg pc, const void *const *labels) {
+  for (block_t *b = m->block_cache->block_hash[BLOCK_HASH(pc)]; b != NULL;
+       b = b->hash_next) {
+    if (b->pc == pc)
+      return b;
+  }
+  return translate(m, pc, labels);
+}
+
+void run_blocks(machine_t *m) {
+  static const void *const labels[OP_KIND_COUNT] = {
+      [OP_CALL] = &&op_call,
+      [OP_CALL_EXIT] = &&op_call_exit,
+      [OP_ARITH_IMM] = &&op_arith_imm,
+      [OP_MOVE_WIDE] = &&op_move_wide,
+      [OP_MOVE_KEEP] = &&op_move_keep,
+      [OP_ARITH_REG] = &&op_arith_reg,
+      [OP_LOGIC_REG] = &&op_logic_reg,
+      [OP_MULTIPLY] = &&op_multiply,
+      [OP_COND_SELECT] = &&op_cond_select,
+      [OP_LOAD] = &&op_load,
+      [OP_STORE] = &&op_store,
+      [OP_LOAD_LITERAL] = &&op_load_literal,
+      [OP_LOAD_PAIR] = &&op_load_pair,
+      [OP_STORE_PAIR] = &&op_store_pair,
+      [OP_VECTOR] = &&op_vector,
+      [OP_VECTOR_LOAD] = &&op_vector_load,
+      [OP_VECTOR_STORE] = &&op_vector_store,
+      [OP_BRANCH] = &&op_branch,
+      [OP_BRANCH_REG] = &&op_branch_reg,
+      [OP_BRANCH_COND] = &&op_branch_cond,
+      [OP_COMPARE_BRANCH] = &&op_compare_branch,
+      [OP_TEST_BRANCH] = &&op_test_branch,
+      [OP_END] = &&op_end,
+  };
+
+/* jump straight to the label of the next op in the block */
+#define DISPATCH() goto *(++op)->label
+/* handlers only return false when the machine has to stop */
+#define EXEC(handler)                                                          \
+  do {                                                                         \
+    if (!handler(m, &op->d))                                                      \
+      goto stop;                                                               \
+  } while (0)
+/* address of the op currently executing */
+#define OP_PC() (b->pc + (reg)(op - b->ops) * sizeof(instruction))
+/* memory accesses may fault, which reports the PC, so they bring it up to date */
+#define EXEC_MEMORY(handler)                                                   \
+  do {                                                                         \
+    m->PC = OP_PC();                                                           \
+    EXEC(handler);                                                             \
+  } while (0)
+/*
+ * the last op of a block may branch: the PC is set to its address first and,
+ * as in the single step loop, only advanced if the handler left it unchanged
+ */
+#define EXEC_EXIT(handler)                                                     \
+  do {                                                                         \
+    reg exit_pc = OP_PC();                                                     \
+    m->PC = exit_pc;                                                           \
+    EXEC(handler);                                                             \
+    if (m->PC == exit_pc)                                                      \
+      m->PC += sizeof(instruction);                                            \
+    goto next_block;                                                           \
+  } while (0)
+
+  bool *flushed = &m->block_cache->flushed;
+  *flushed = false;
+  block_t *b = find_block(m, m->PC, labels);
+  block_op_t *op;
+
+  while (TRUE) {
+    if (b->countdown != NULL && m->fast_forward && fast_forward(m, b))
+      goto next_block;
+    if (m->jit != NULL && b->native == NULL && ++b->heat == JIT_THRESHOLD) {
+      b->native = jit_compile(m, b, flushed);
+      if (*flushed) {
+        /* the code buffer ran out and took the translation cache with it */
+        *flushed = false;
+        b = find_block(m, m->PC, labels);
+        continue;
+      }
+    }
+    if (b->native != NULL) {
+      /* compiled blocks count their own runs, if they are profiled */
+      if (!b->native(m))
+        return;
+      goto next_block;
+    }
+    b->count++;
+    op = b->ops;
+    goto *op->label;
+
+  op_call:
+    /* the exclusive and ordered transfers among these access memory */
+    EXEC_MEMORY(op->d.exec);
+    DISPATCH();
+  op_arith_imm:
+    EXEC(exec_arith_imm);
+    DISPATCH();
+  op_move_wide:
+    EXEC(exec_move_wide);
+    DISPATCH();
+  op_move_keep:
+    EXEC(exec_move_keep);
+    DISPATCH();
+  op_arith_reg:
+    EXEC(exec_arith_reg);
+    DISPATCH();
+  op_logic_reg:
+    EXEC(exec_logic_reg);
+    DISPATCH();
+  op_multiply:
+    EXEC(exec_multiply);
+    DISPATCH();
+  op_cond_select:
+    EXEC(exec_cond_select);
+    DISPATCH();
+  op_load:
+    EXEC_MEMORY(exec_load);
+    DISPATCH();
+  op_load_literal:
+    EXEC_MEMORY(exec_load_literal);
+    DISPATCH();
+  op_load_pair:
+    EXEC_MEMORY(exec_load_pair);
+    DISPATCH();
+  op_store:
+    EXEC_MEMORY(exec_store);
+    if (*flushed) {
+      /* the store hit translated code, which may include this block */
+      m->PC = OP_PC() + sizeof(instruction);
+      goto next_block;
+    }
+    DISPATCH();
+  op_store_pair:
+    EXEC_MEMORY(exec_store_pair);
+    if (*flushed) {
+      m->PC = OP_PC() + sizeof(instruction);
+      goto next_block;
+    }
+    DISPATCH();
+  op_vector:
+    /* none of these touch memory or fault */
+    EXEC(op->d.exec);
+    DISPATCH();
+  op_vector_load:
+    EXEC_MEMORY(exec_vector_load);
+    DISPATCH();
+  op_vector_store:
+    EXEC_MEMORY(exec_vector_store);
+    if (*flushed) {
+      m->PC = OP_PC() + sizeof(instruction);
+      goto next_block;
+    }
+    DISPATCH();
+
+  op_call_exit:
+    EXEC_EXIT(op->d.exec);
+  op_branch:
+    EXEC_EXIT(exec_branch);
+  op_branch_reg:
+    EXEC_EXIT(exec_branch_reg);
+  op_branch_cond:
+    EXEC_EXIT(exec_branch_cond);
+  op_compare_branch:
+    EXEC_EXIT(exec_compare_branch);
+  op_test_branch:
+    EXEC_EXIT(exec_test_branch);
+  op_end:
+    m->PC = b->pc + b->len * sizeof(instruction);
+
+  next_block:
+    if (__atomic_load_n(&m->interrupted, __ATOMIC_RELAXED))
+      return; /* another core stopped the machine, see cores.h */
+    if ((m->budget -= b->len) <= 0)
+      return; /* the turn of this core is over */
+    if (*flushed) {
+      /* b or its successors may be gone, maybe before it ran to the end */
+      if (m->profile != NULL)
+        profile_skip_block(m, b, m->PC);
+      *flushed = false;
+      b = find_block(m, m->PC, labels);
+      continue;
+    }
+    if (b->succ[0] != NULL && b->succ[0]->pc == m->PC) {
+      b = b->succ[0];
+    } else if (b->succ[1] != NULL && b->succ[1]->pc == m->PC) {
+      b = b->succ[1];
+    } else {
+      block_t *next = find_block(m, m->PC, labels);
+      if (!*flushed) {
+        /* chain the new successor into the first free slot */
+        b->succ[b->succ[0] == NULL ? 0 : 1] = next;
+      }
+      *flushed = false;
+      b = next;
+    }
+  }
+
+stop:
+  m->PC = OP_PC();
+
+#undef DISPATCH
+#undef EXEC
+#undef EXEC_MEMORY
+#undef OP_PC
+#undef EXEC_EXIT
+}
@@ -0,0 +1,115 @@
+#ifndef BLOCK
+#define BLOCK
+
+#include "../defs.h"
+#include "decode.h"
+#include "emulate.h"
+
+/* longest straight-line run translated into a single block */
+#define BLOCK_MAX_INSTRS 64
+
+/* capacity of the translation cache, it is flushed when either runs out */
+#define BLOCK_POOL_SIZE 4096
+#define BLOCK_OP_POOL_SIZE (1 << 16)
+
+#define BLOCK_HASH_BITS 12
+#define BLOCK_HASH_SIZE (1 << BLOCK_HASH_BITS)
+
+/* every op kind has its own label in run_blocks */
+typedef enum {
+  OP_CALL,      /* handler without a dedicated label, called indirectly */
+  OP_CALL_EXIT, /* same, but the handler may change the PC */
+  OP_ARITH_IMM,
+  OP_MOVE_WIDE,
+  OP_MOVE_KEEP,
+  OP_ARITH_REG,
+  OP_LOGIC_REG,
+  OP_MULTIPLY,
+  OP_COND_SELECT,
+  OP_LOAD,
+  OP_STORE,
+  OP_LOAD_LITERAL,
+  OP_LOAD_PAIR,
+  OP_STORE_PAIR,
+  OP_VECTOR, /* SIMD data processing, called indirectly */
+  OP_VECTOR_LOAD,
+  OP_VECTOR_STORE,
+  OP_BRANCH,
+  OP_BRANCH_REG,
+  OP_BRANCH_COND,
+  OP_COMPARE_BRANCH,
+  OP_TEST_BRANCH,
+  OP_END, /* falls through to the next block */
+  OP_KIND_COUNT
+} op_kind_t;
+
+typedef struct {
+  const void *label; /* address of the label executing this op */
+  op_kind_t kind;
+  decoded_instr_t d;
+} block_op_t;
+
+/*
+ * Native code for a block. Returns false if the machine has to stop, the PC
+ * is up to date either way.
+ */
+typedef bool (*jit_fn)(machine_t *m);
+
+typedef struct block {
+  reg pc;                  /* address of the first instruction */
+  u32 len;                 /* number of guest instructions */
+  block_op_t *ops;         /* len ops, followed by OP_END if there is no exit */
+  struct block *hash_next; /* next block in the same hash bucket */
+  struct block *succ[2];   /* chained successors, checked against the PC */
+  u32 heat;                /* times entered, used to pick blocks to compile */
+  u64 count;               /* times run, for the profile */
+  jit_fn native;           /* compiled code, if any */
+  const decoded_instr_t *countdown; /* subs of a delay loop, see run_blocks */
+  bool dropped; /* overwritten, its slot is only reused after a flush */
+} block_t;
+
+/**
+ * Runs the machine until it halts, another core sets m->interrupted, or
+ * m->budget instructions have run, translating basic blocks on first use and
+ * executing them with threaded dispatch. The budget is only checked between
+ * blocks, so a run may go over it by a block.
+ *
+ * Unless m->fast_forward is cleared, delay loops are not run at all: a block
+ * that only counts a register down to zero, i.e.
+ *
+ *   loop: subs xN, xN, #k   (and any number of nops)
+ *         b.ne loop
+ *
+ * is entered with xN a multiple of k, it is skipped by setting xN to zero and
+ * the flags to those of the last subs, leaving the machine exactly as running
+ * it would have.
+ *
+ * @param m The machine to run, with PC pointing at the first instruction.
+ */
+void run_blocks(machine_t *m);
+
+/**
+ * Drops the translated blocks overlapping [address, address + num_bytes), on a
+ * page flagged PAGE_CODE, after it was written. Stores to data sharing a page
+ * with code leave every block in place.
+ */
+void block_cache_invalidate(machine_t *m, u64 address, int num_bytes);
+
+/**
+ * Drops every translated block.
+ */
+void block_cache_flush(machine_t *m);
+
+/**
+ * Allocates the translation cache of a machine.
+ *
+ * @return false if it could not be allocated.
+ */
+bool block_cache_create(machine_t *m);
+
+/**
+ * Frees the translation cache of a machine.
+ */
+void block_cache_destroy(machine_t *m);
+
+#endif /* BLOCK */
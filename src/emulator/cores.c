@@ -0,0 +1,218 @@
+#include "cores.h"
+#include "block.h"
+#include "decode.h"
+#include "jit.h"
+#include "machine.h"
+#include "memory.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct cores {
+  u32 count;
+  u64 quantum;       /* instructions per turn, 0 when the cores run free */
+  machine_t *core[]; /* count cores, core[0] is the machine itself */
+};
+
+typedef struct {
+  struct cores *cores;
+  machine_t *core;
+} core_thread_t;
+
+/* frees a core, but not the memory it shares */
+static void core_destroy(machine_t *core) {
+  if (core == NULL)
+    return;
+  jit_destroy(core);
+  block_cache_destroy(core);
+  decode_cache_destroy(core);
+  free(core);
+}
+
+/* a core using the memory of m */
+static machine_t *core_create(machine_t *m, u32 id) {
+  machine_t *core = aligned_alloc(CACHE_LINE_SIZE, sizeof(machine_t));
+  if (core == NULL)
+    return NULL;
+  memset(core, 0, sizeof(machine_t));
+  core->memory_size = m->memory_size;
+  core->page_tables = m->page_tables;
+  core->dirty_pages = m->dirty_pages;
+  core->dirty_summary = m->dirty_summary;
+  core->fast_forward = m->fast_forward;
+  core->core_id = id;
+  core->shared_memory = true;
+
+  if (!decode_cache_create(core) || !block_cache_create(core)) {
+    core_destroy(core);
+    return NULL;
+  }
+  if (m->jit != NULL)
+    jit_init(core);
+  reset_core(core);
+  memory_flush_tlb(core);
+  return core;
+}
+
+bool machine_set_cores(machine_t *machine, int count, uint64_t quantum) {
+  cores_destroy(machine);
+  if (count == 1)
+    return true;
+  if (count < 1 || count > CORES_MAX)
+    return false;
+
+  struct cores *cores =
+      calloc(1, sizeof(struct cores) + count * sizeof(machine_t *));
+  if (cores == NULL)
+    return false;
+  cores->count = count;
+  cores->quantum = quantum;
+  cores->core[0] = machine;
+  machine->cores = cores;
+  machine->shared_memory = true;
+  for (int i = 1; i < count; i++) {
+    cores->core[i] = core_create(machine, i);
+    if (cores->core[i] == NULL) {
+      cores_destroy(machine);
+      return false;
+    }
+  }
+  /* loads from unwritten pages may no longer be cached */
+  memory_flush_tlb(machine);
+  return true;
+}
+
+void cores_destroy(machine_t *m) {
+  if (m->cores == NULL)
+    return;
+  for (u32 i = 1; i < m->cores->count; i++)
+    core_destroy(m->cores->core[i]);
+  free(m->cores);
+  m->cores = NULL;
+  m->shared_memory = false;
+}
+
+void cores_reset(machine_t *m) {
+  for (u32 i = 1; i < m->cores->count; i++) {
+    reset_core(m->cores->core[i]);
+    memory_flush_tlb(m->cores->core[i]);
+  }
+}
+
+u32 cores_count(const machine_t *m) {
+  return m->cores != NULL ? m->cores->count : 1;
+}
+
+machine_t *cores_get(const machine_t *m, u32 id) {
+  return m->cores != NULL ? m->cores->core[id] : (machine_t *)m;
+}
+
+/* ======== running ======== */
+
+static bool failed(const machine_t *core) {
+  return core->exit.reason != MACHINE_RUNNING &&
+         core->exit.reason != MACHINE_HALTED;
+}
+
+static void interrupt_cores(struct cores *cores) {
+  for (u32 i = 0; i < cores->count; i++)
+    __atomic_store_n(&cores->core[i]->interrupted, true, __ATOMIC_RELAXED);
+}
+
+/*
+ * round robin on this thread, until every core stopped or ran limit; without
+ * a limit the turns go through the block engine, so they end at the first
+ * block boundary after the quantum rather than exactly on it
+ */
+static void run_turns(struct cores *cores, u64 limit, u64 quantum) {
+  u64 ran[CORES_MAX] = {0};
+  bool stopped[CORES_MAX] = {false};
+  bool turns_left = true;
+  while (turns_left) {
+    turns_left = false;
+    for (u32 i = 0; i < cores->count; i++) {
+      if (stopped[i] || ran[i] == limit)
+        continue;
+      u64 n = limit - ran[i] < quantum ? limit - ran[i] : quantum;
+      turns_left = true;
+      bool running = limit == UINT64_MAX ? run_core_turn(cores->core[i], n)
+                                         : run_core_steps(cores->core[i], n);
+      if (running) {
+        ran[i] += n;
+        continue;
+      }
+      stopped[i] = true;
+      if (failed(cores->core[i]))
+        return; /* which stops every other core where it is */
+    }
+  }
+}
+
+static void *core_main(void *arg) {
+  core_thread_t *thread = arg;
+  run_core(thread->core);
+  if (failed(thread->core))
+    interrupt_cores(thread->cores);
+  return NULL;
+}
+
+/* a thread per core, core 0 running on this one */
+static void run_free(struct cores *cores) {
+  pthread_t tids[CORES_MAX];
+  core_thread_t threads[CORES_MAX];
+  for (u32 i = 0; i < cores->count; i++)
+    threads[i] = (core_thread_t){.cores = cores, .core = cores->core[i]};
+
+  u32 started = 1;
+  for (; started < cores->count; started++) {
+    if (pthread_create(&tids[started], NULL, core_main, &threads[started]))
+      break;
+  }
+  bool all_started = started == cores->count;
+  if (all_started)
+    core_main(&threads[0]);
+  else
+    interrupt_cores(cores);
+  for (u32 i = 1; i < started; i++)
+    pthread_join(tids[i], NULL);
+
+  if (!all_started) {
+    /* the interrupted cores carry on from where they are, taking turns */
+    for (u32 i = 0; i < cores->count; i++)
+      cores->core[i]->interrupted = false;
+    run_turns(cores, UINT64_MAX, CORES_DEFAULT_QUANTUM);
+  }
+}
+
+bool cores_run(machine_t *m, u64 limit) {
+  struct cores *cores = m->cores;
+  /* from here on the data of a page stays where it is */
+  memory_unshare(m);
+  for (u32 i = 0; i < cores->count; i++) {
+    machine_t *core = cores->core[i];
+    memory_flush_tlb(core);
+    core->interrupted = false;
+    /* a core an error stops before its first turn is still running */
+    core->exit = (machine_exit_t){
+        .reason = MACHINE_RUNNING, .pc = core->PC, .core = i};
+  }
+
+  if (cores->quantum == 0 && limit == UINT64_MAX)
+    run_free(cores);
+  else
+    run_turns(cores, limit,
+              cores->quantum != 0 ? cores->quantum : CORES_DEFAULT_QUANTUM);
+
+  bool running = false;
+  for (u32 i = 0; i < cores->count; i++) {
+    const machine_t *core = cores->core[i];
+    if (failed(core)) {
+      m->exit = core->exit;
+      return false;
+    }
+    running |= core->exit.reason == MACHINE_RUNNING;
+  }
+  /* otherwise the exit is that of core 0, halted only once all of them are */
+  m->exit.reason = running ? MACHINE_RUNNING : MACHINE_HALTED;
+  return running;
+}
@@ -0,0 +1,83 @@
+#ifndef CORES
+#define CORES
+
+#include "../defs.h"
+#include "emulate.h"
+#include <stdbool.h>
+
+/*
+ * Machines with several cores, see machine_set_cores in libemulator.h.
+ *
+ * Core 0 is the machine itself, the others are machines of their own that
+ * point at its page table and dirty bitmaps rather than having memory of their
+ * own. Every core keeps its own registers, TLB, caches and JIT, so they run
+ * exactly as a single core does and only meet in memory:
+ *
+ *   - Pages are allocated with a compare and swap and never move while the
+ *     cores run: the image and snapshot pages that are normally copied on the
+ *     first store are copied before the cores start instead.
+ *   - Plain loads and stores are host loads and stores, so they are as
+ *     ordered as those of the host. DMB, DSB, ISB, LDAR and STLR are host
+ *     fences, and LDXR and STXR a compare and swap, see load_store.h.
+ *   - Instructions are cached per core, and the other cores may miss code
+ *     one of them writes, so self-modifying code needs a single core.
+ *
+ * Cores either run free, each on a thread of its own, or take turns on the
+ * calling thread, each running a quantum of instructions before the next one
+ * gets to run. Turns make every run of a program interleave its cores the
+ * same way, which is what tests and debugging want. Turns run blocks and
+ * compiled code as a single core does, so they end at the first block
+ * boundary after the quantum, or exactly on it under machine_run_for.
+ *
+ * A core that halts leaves the others running. A core that stops on an error
+ * sets interrupted on all of them, which they check between blocks, so one
+ * spinning on a lock the failed core held does not keep the machine going.
+ */
+
+/* most cores a machine may have */
+#define CORES_MAX 64
+
+/*
+ * instructions per turn when stepping cores that would otherwise run free, and
+ * the default quantum of the emulator, whose usage string repeats it
+ */
+#define CORES_DEFAULT_QUANTUM 1000
+
+/**
+ * Frees every core of a machine but core 0, and leaves it with a single one.
+ */
+void cores_destroy(machine_t *m);
+
+/**
+ * Resets the registers and caches of every core but core 0, as init_machine
+ * does for core 0.
+ *
+ * @param m PRE: Has several cores.
+ */
+void cores_reset(machine_t *m);
+
+/**
+ * Runs every core until all of them stopped, or at most limit instructions
+ * each, leaving how in m->exit: the exit of the first core that stopped on an
+ * error, otherwise MACHINE_RUNNING while any core is still running.
+ *
+ * @param m     PRE: Has several cores.
+ * @param limit UINT64_MAX to run to the end. Any other limit makes the cores
+ *              take turns, even if they are set to run free.
+ * @return true if no core stopped on an error and some are still running.
+ */
+bool cores_run(machine_t *m, u64 limit);
+
+/**
+ * Returns the number of cores of a machine, 1 if it has no others.
+ */
+u32 cores_count(const machine_t *m);
+
+/**
+ * Returns core id of a machine.
+ *
+ * @param id PRE: id < cores_count(m).
+ */
+machine_t *cores_get(const machine_t *m, u32 id);
+
+#endif /* CORES */
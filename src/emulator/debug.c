@@ -0,0 +1,161 @@
+#include "debug.h"
+#include "flags.h"
+#include "memory.h"
+#include "timeline.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROMPT "(emulate) "
+
+typedef struct {
+  machine_t *m;
+  FILE *out;
+  u64 breakpoints[DEBUG_MAX_BREAKPOINTS];
+  int breakpoint_count;
+} debugger_t;
+
+static bool at_breakpoint(const debugger_t *dbg) {
+  for (int i = 0; i < dbg->breakpoint_count; i++) {
+    if (dbg->breakpoints[i] == dbg->m->PC)
+      return true;
+  }
+  return false;
+}
+
+static void print_location(const debugger_t *dbg) {
+  fprintf(dbg->out, "[%" PRIu64 "] PC = %016" PRIx64 "\n",
+          timeline_position(dbg->m), dbg->m->PC);
+}
+
+static void print_registers(const debugger_t *dbg) {
+  machine_t *m = dbg->m;
+  for (int i = 0; i < REG_COUNT; i++)
+    fprintf(dbg->out, "X%02d    = %016" PRIx64 "\n", i, m->regs[i]);
+  fprintf(dbg->out, "SP     = %016" PRIx64 "\n", m->SP);
+  fprintf(dbg->out, "PC     = %016" PRIx64 "\n", m->PC);
+  materialise_flags(&m->pstate);
+  u8 nzcv = m->pstate.nzcv;
+  fprintf(dbg->out, "PSTATE : %c%c%c%c\n", nzcv & FLAG_N ? 'N' : '-',
+          nzcv & FLAG_Z ? 'Z' : '-', nzcv & FLAG_C ? 'C' : '-',
+          nzcv & FLAG_V ? 'V' : '-');
+  /* as at exit, only the V registers holding something */
+  for (int i = 0; i < VREG_COUNT; i++) {
+    const vreg *v = &m->vregs[i];
+    if (v->d[0] != 0 || v->d[1] != 0)
+      fprintf(dbg->out, "V%02d    = %016" PRIx64 "%016" PRIx64 "\n", i,
+              v->d[1], v->d[0]);
+  }
+}
+
+/* steps n times, or until a breakpoint if until_breakpoint */
+static void step(debugger_t *dbg, u64 n, bool until_breakpoint) {
+  for (u64 i = 0; i < n; i++) {
+    if (!timeline_step(dbg->m)) {
+      fprintf(dbg->out, "The machine has stopped.\n");
+      machine_print_exit(dbg->out, &dbg->m->exit);
+      break;
+    }
+    if (until_breakpoint && at_breakpoint(dbg))
+      break;
+  }
+  print_location(dbg);
+}
+
+static void step_back(debugger_t *dbg, u64 n, bool until_breakpoint) {
+  for (u64 i = 0; i < n; i++) {
+    if (!timeline_step_back(dbg->m)) {
+      fprintf(dbg->out, "At the start of the recorded history.\n");
+      break;
+    }
+    if (until_breakpoint && at_breakpoint(dbg))
+      break;
+  }
+  print_location(dbg);
+}
+
+static void set_breakpoint(debugger_t *dbg, u64 address) {
+  if (dbg->breakpoint_count == DEBUG_MAX_BREAKPOINTS) {
+    fprintf(dbg->out, "Too many breakpoints.\n");
+    return;
+  }
+  dbg->breakpoints[dbg->breakpoint_count++] = address;
+}
+
+static void delete_breakpoint(debugger_t *dbg, u64 address) {
+  for (int i = 0; i < dbg->breakpoint_count; i++) {
+    if (dbg->breakpoints[i] == address) {
+      dbg->breakpoints[i] = dbg->breakpoints[--dbg->breakpoint_count];
+      return;
+    }
+  }
+  fprintf(dbg->out, "No breakpoint at 0x%" PRIx64 ".\n", address);
+}
+
+static void last_write(debugger_t *dbg, u64 address) {
+  if (!timeline_last_write(dbg->m, address)) {
+    fprintf(dbg->out, "No recorded write to 0x%" PRIx64 ".\n", address);
+    return;
+  }
+  print_location(dbg);
+}
+
+static void print_memory(debugger_t *dbg, u64 address) {
+  if (address > dbg->m->memory_size - sizeof(u64)) {
+    fprintf(dbg->out, "0x%" PRIx64 " is out of bounds.\n", address);
+    return;
+  }
+  fprintf(dbg->out, "0x%" PRIx64 ": 0x%016" PRIx64 "\n", address,
+          memory_load(dbg->m, address, sizeof(u64)));
+}
+
+void run_debugger(machine_t *m, FILE *in, FILE *out) {
+  debugger_t dbg = {.m = m, .out = out};
+  if (!timeline_start(m)) {
+    fprintf(stderr, "Could not start recording the machine.\n");
+    return;
+  }
+  print_location(&dbg);
+
+  char line[DEBUG_MAX_LINE];
+  while (TRUE) {
+    fprintf(out, PROMPT);
+    fflush(out);
+    if (fgets(line, sizeof(line), in) == NULL)
+      break;
+    char *command = strtok(line, " \t\r\n");
+    if (command == NULL)
+      continue;
+    char *arg = strtok(NULL, " \t\r\n");
+    u64 value = arg != NULL ? strtoull(arg, NULL, 0) : 1;
+
+    if (strcmp(command, "step") == 0 || strcmp(command, "s") == 0) {
+      step(&dbg, value, false);
+    } else if (strcmp(command, "continue") == 0 || strcmp(command, "c") == 0) {
+      step(&dbg, UINT64_MAX, true);
+    } else if (strcmp(command, "back") == 0 || strcmp(command, "b") == 0) {
+      step_back(&dbg, value, false);
+    } else if (strcmp(command, "reverse-continue") == 0 ||
+               strcmp(command, "rc") == 0) {
+      step_back(&dbg, UINT64_MAX, true);
+    } else if (arg != NULL && strcmp(command, "last-write") == 0) {
+      last_write(&dbg, value);
+    } else if (arg != NULL && strcmp(command, "break") == 0) {
+      set_breakpoint(&dbg, value);
+    } else if (arg != NULL && strcmp(command, "delete") == 0) {
+      delete_breakpoint(&dbg, value);
+    } else if (strcmp(command, "regs") == 0) {
+      print_registers(&dbg);
+    } else if (arg != NULL && strcmp(command, "mem") == 0) {
+      print_memory(&dbg, value);
+    } else if (strcmp(command, "quit") == 0 || strcmp(command, "q") == 0) {
+      break;
+    } else {
+      fprintf(out, "Unknown command %s, try step [n], continue, back [n], "
+                   "reverse-continue, last-write addr, break addr, delete "
+                   "addr, regs, mem addr or quit.\n",
+              command);
+    }
+  }
+  timeline_stop(m);
+}
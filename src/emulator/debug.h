@@ -0,0 +1,26 @@
+#ifndef DEBUG
+#define DEBUG
+
+#include "../defs.h"
+#include "emulate.h"
+#include <stdio.h>
+
+/* longest command line accepted */
+#define DEBUG_MAX_LINE 256
+
+#define DEBUG_MAX_BREAKPOINTS 64
+
+/**
+ * Runs an interactive debugger on a machine that can step backwards as well
+ * as forwards, until it is told to quit or its input ends. The machine is left
+ * in whatever state the session ended in.
+ *
+ * Commands: step [n], continue, back [n], reverse-continue, last-write addr,
+ * break addr, delete addr, regs, mem addr, quit.
+ *
+ * @param in  Stream the commands are read from.
+ * @param out Stream the answers are written to.
+ */
+void run_debugger(machine_t *m, FILE *in, FILE *out);
+
+#endif /* DEBUG */
@@ -0,0 +1,180 @@
+#include "decode.h"
+#include "../utils/bits_utils.h"
+#include "emulate.h"
+#include "execute/branches.h"
+#include "execute/halt.h"
+#include "execute/immediate_instructions.h"
+#include "execute/load_store.h"
+#include "execute/register_instruction.h"
+#include "execute/simd.h"
+#include "execute/system.h"
+#include "memory.h"
+#include <stdlib.h>
+
+#define DP_IMM_BIT_PATTERN_1 0x8
+#define DP_IMM_BIT_PATTERN_2 0x9
+#define DP_REG_BIT_PATTERN_1 0x5
+#define DP_REG_BIT_PATTERN_2 0xd
+#define LS_BIT_PATTERN_1 0x4
+#define LS_BIT_PATTERN_2 0xc
+#define LS_BIT_PATTERN_3 0x6
+#define LS_BIT_PATTERN_4 0xe
+#define SIMD_BIT_PATTERN_1 0x7
+#define SIMD_BIT_PATTERN_2 0xf
+#define B_BIT_PATTERN_1 0xa
+#define B_BIT_PATTERN_2 0xb
+
+#define DECODE_CACHE_MASK (DECODE_CACHE_SIZE - 1)
+#define DECODE_CACHE_INDEX(pc) (((pc) >> 2) & DECODE_CACHE_MASK)
+#define INVALID_TAG UINT64_MAX
+
+typedef struct {
+  reg tag; /* PC of the cached instruction */
+  decoded_instr_t d;
+} decode_cache_entry_t;
+
+struct decode_cache {
+  decode_cache_entry_t entries[DECODE_CACHE_SIZE];
+  decoded_instr_t misaligned; /* scratch for misaligned PCs, never cached */
+};
+
+static instruction fetch(machine_t *m, reg pc) {
+  /* instructions are stored in little-endian format in the memory */
+  /* fetching past the end of memory reads an invalid instruction */
+  if (pc > m->memory_size - sizeof(instruction))
+    return 0;
+  return (instruction)memory_load(m, pc, sizeof(instruction));
+}
+
+bool exec_halt(machine_t *m, const decoded_instr_t *d) {
+  (void)m;
+  (void)d;
+  return false;
+}
+
+bool exec_nop(machine_t *m, const decoded_instr_t *d) {
+  (void)m;
+  (void)d;
+  return true;
+}
+
+bool exec_invalid(machine_t *m, const decoded_instr_t *d) {
+  m->exit.reason = MACHINE_INVALID_INSTRUCTION;
+  m->exit.message = d->msg;
+  return false;
+}
+
+bool exec_fatal(machine_t *m, const decoded_instr_t *d) {
+  m->exit.reason = MACHINE_UNSUPPORTED_INSTRUCTION;
+  m->exit.message = d->msg;
+  return false;
+}
+
+void decode_instr(instruction instr, reg pc, decoded_instr_t *d) {
+  *d = (decoded_instr_t){0};
+
+  if (halt_instr(instr)) {
+    d->exec = exec_halt;
+    d->ends_block = true;
+    d->instr_class = CLASS_OTHER;
+    return;
+  }
+
+  u8 op0 = (u8)extract_bits_u32(instr, 25, 28);
+  switch (op0) {
+  case DP_IMM_BIT_PATTERN_1:
+  case DP_IMM_BIT_PATTERN_2:
+    /* data processing (immediate) */
+    decode_immediate(instr, d);
+    d->instr_class = CLASS_DP_IMM;
+    break;
+  case DP_REG_BIT_PATTERN_1:
+  case DP_REG_BIT_PATTERN_2:
+    /* data processing (register) */
+    decode_register(instr, d);
+    d->instr_class = CLASS_DP_REG;
+    break;
+  case LS_BIT_PATTERN_1:
+  case LS_BIT_PATTERN_2:
+    /* loads and stores */
+    decode_load_store(instr, pc, d);
+    d->instr_class = CLASS_LOAD_STORE;
+    break;
+  case LS_BIT_PATTERN_3:
+  case LS_BIT_PATTERN_4:
+    /* loads and stores of the SIMD registers */
+    decode_simd_load_store(instr, d);
+    d->instr_class = CLASS_SIMD;
+    break;
+  case SIMD_BIT_PATTERN_1:
+  case SIMD_BIT_PATTERN_2:
+    /* SIMD data processing */
+    decode_simd(instr, d);
+    d->instr_class = CLASS_SIMD;
+    break;
+  case B_BIT_PATTERN_1:
+  case B_BIT_PATTERN_2:
+    if (system_instr(instr)) {
+      /* barriers and the like, which fall through to the next instruction */
+      decode_system(instr, d);
+      d->instr_class = CLASS_OTHER;
+      break;
+    }
+    /* branches */
+    decode_branch(instr, pc, d);
+    d->ends_block = true;
+    d->instr_class = CLASS_BRANCH;
+    break;
+  default:
+    d->exec = exec_invalid;
+    d->msg = "Invalid instruction op0\n";
+    d->ends_block = true;
+    d->instr_class = CLASS_OTHER;
+    break;
+  }
+}
+
+const decoded_instr_t *decode_cache_lookup(machine_t *m, reg pc) {
+  decode_cache_entry_t *entry =
+      &m->decode_cache->entries[DECODE_CACHE_INDEX(pc)];
+  if (entry->tag != pc) {
+    if (pc & 0x3) {
+      /* misaligned PCs are never cached, so stores only have to invalidate
+       * word aligned entries */
+      decode_instr(fetch(m, pc), pc, &m->decode_cache->misaligned);
+      return &m->decode_cache->misaligned;
+    }
+    decode_instr(fetch(m, pc), pc, &entry->d);
+    entry->tag = pc;
+    /* stores to the page now invalidate the entry */
+    memory_set_flags(m, pc, PAGE_DECODED);
+  }
+  return &entry->d;
+}
+
+void decode_cache_invalidate(machine_t *m, u64 address, int num_bytes) {
+  for (u64 pc = address & ~0x3ULL; pc < address + num_bytes; pc += 4) {
+    decode_cache_entry_t *entry =
+        &m->decode_cache->entries[DECODE_CACHE_INDEX(pc)];
+    if (entry->tag == pc)
+      entry->tag = INVALID_TAG;
+  }
+}
+
+void decode_cache_flush(machine_t *m) {
+  for (int i = 0; i < DECODE_CACHE_SIZE; i++)
+    m->decode_cache->entries[i].tag = INVALID_TAG;
+}
+
+bool decode_cache_create(machine_t *m) {
+  m->decode_cache = malloc(sizeof(*m->decode_cache));
+  if (m->decode_cache == NULL)
+    return false;
+  decode_cache_flush(m);
+  return true;
+}
+
+void decode_cache_destroy(machine_t *m) {
+  free(m->decode_cache);
+  m->decode_cache = NULL;
+}
@@ -0,0 +1,113 @@
+#ifndef DECODE
+#define DECODE
+
+#include "../defs.h"
+#include "emulate.h"
+#include <stdbool.h>
+
+/*
+ * log2 of the number of entries in the predecode cache. The cache is direct
+ * mapped on PC / 4, so 2^14 entries cover 64KB of straight-line code before
+ * two instructions start evicting each other.
+ */
+#define DECODE_CACHE_BITS 14
+#define DECODE_CACHE_SIZE (1 << DECODE_CACHE_BITS)
+
+typedef struct decoded_instr decoded_instr_t;
+
+/* instruction classes, as told apart by op0 */
+typedef enum {
+  CLASS_DP_IMM,     /* data processing (immediate) */
+  CLASS_DP_REG,     /* data processing (register) */
+  CLASS_LOAD_STORE, /* loads and stores */
+  CLASS_BRANCH,     /* branches */
+  CLASS_SIMD,       /* vector instructions, including their loads and stores */
+  CLASS_OTHER,      /* halt, system and invalid encodings */
+  CLASS_COUNT
+} instr_class_t;
+
+/**
+ * Executes a predecoded instruction.
+ *
+ * @param m The machine to execute it on.
+ * @param d The decoded instruction.
+ * @return false if the machine should stop, true otherwise.
+ */
+typedef bool (*exec_fn)(machine_t *m, const decoded_instr_t *d);
+
+/*
+ * An instruction after all of its fields have been pulled out of the
+ * instruction word. Everything that only depends on the word (and on the PC it
+ * was fetched from) is computed once here so the handler can run directly.
+ */
+struct decoded_instr {
+  exec_fn exec; /* handler for this instruction */
+  union {
+    u64 imm;         /* pre-shifted immediate, offset or absolute address */
+    const char *msg; /* diagnostic for invalid instructions */
+  };
+  u8 rd;           /* destination / transfer register (Rd, Rt) */
+  u8 rn;           /* first source / base register (Rn, Xn) */
+  u8 rm;           /* second source / offset register (Rm, Xm) */
+  u8 ra;           /* accumulator for multiply, second register of a pair */
+  bool sf;         /* true for 64-bit operations */
+  u8 opc;          /* handler specific opcode (opc, cond, addressing mode) */
+  u8 size;         /* bytes moved by a load or store, per register */
+  bool is_signed;  /* load sign extends what it reads */
+  u8 shift;        /* shift type for register operands */
+  u8 amount;       /* shift amount, bit tested by TBZ or a vector count */
+  bool negate;     /* N bit of logical instructions */
+  bool ends_block; /* may change the PC or stop the machine */
+  u8 instr_class;  /* instr_class_t of the instruction */
+};
+
+/**
+ * Decodes an instruction word into its predecoded form.
+ *
+ * @param instr The instruction word.
+ * @param pc    The address the instruction was fetched from.
+ * @param d     The record to fill in.
+ */
+void decode_instr(instruction instr, reg pc, decoded_instr_t *d);
+
+/**
+ * Returns the decoded form of the instruction at pc, decoding it only if it is
+ * not already in the predecode cache.
+ *
+ * @param m  The machine to fetch the instruction from.
+ * @param pc The address of the instruction.
+ */
+const decoded_instr_t *decode_cache_lookup(machine_t *m, reg pc);
+
+/**
+ * Drops every cached instruction overlapping [address, address + num_bytes).
+ * Must be called whenever guest memory is written.
+ */
+void decode_cache_invalidate(machine_t *m, u64 address, int num_bytes);
+
+/**
+ * Drops every cached instruction.
+ */
+void decode_cache_flush(machine_t *m);
+
+/**
+ * Allocates the predecode cache of a machine.
+ *
+ * @return false if it could not be allocated.
+ */
+bool decode_cache_create(machine_t *m);
+
+/**
+ * Frees the predecode cache of a machine.
+ */
+void decode_cache_destroy(machine_t *m);
+
+/* handlers shared by all the instruction groups */
+bool exec_halt(machine_t *m, const decoded_instr_t *d);
+bool exec_nop(machine_t *m, const decoded_instr_t *d);
+/* stops the machine with MACHINE_INVALID_INSTRUCTION and d->msg */
+bool exec_invalid(machine_t *m, const decoded_instr_t *d);
+/* stops the machine with MACHINE_UNSUPPORTED_INSTRUCTION and d->msg */
+bool exec_fatal(machine_t *m, const decoded_instr_t *d);
+
+#endif /* DECODE */
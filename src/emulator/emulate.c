@@ -1,37 +1,275 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "batch.h"
+#include "cores.h"
+#include "debug.h"
+#include "jit.h"
 #include "machine.h"
+#include "memory.h"
+#include "profile.h"
+#include "server.h"
+#include "snapshot.h"
+#include "timing.h"
+#include "trace.h"
 
-/* machine definition */
-machine_t machine = {0};
+#define USAGE                                                                  \
+  "Usage: ./emulator [options] [file_in] [file_out (optional)]\n"              \
+  "       ./emulator [options] [--threads n] --batch [manifest] "              \
+  "[out_dir (optional)]\n"                                                     \
+  "       ./emulator [options] [--threads n] --serve socket\n"                 \
+  "Options: --jit, --memory size[K|M|G], --snapshot-at insn-count, "         \
+  "--restore, --debug, --profile, --timing, --no-fast-forward, "               \
+  "--trace file, --cores n, --quantum insn-count (default 1000, 0 to run "     \
+  "the cores free)\n"
+
+/*
+ * Reports an error that stopped the machine. Invalid instructions stop it like
+ * the halt instruction, anything else means there is no final state to print.
+ *
+ * @return false if the run failed.
+ */
+static bool report_exit(const machine_t *machine) {
+  const machine_exit_t *exit = &machine->exit;
+  /* memory faults are part of the expected output of the test suite */
+  machine_print_exit(exit->reason == MACHINE_MEMORY_FAULT ? stdout : stderr,
+                     exit);
+  return exit->reason == MACHINE_RUNNING || exit->reason == MACHINE_HALTED ||
+         exit->reason == MACHINE_INVALID_INSTRUCTION;
+}
+
+/* parses a byte count with an optional K, M or G suffix, 0 if invalid */
+static u64 parse_size(const char *arg) {
+  char *end;
+  u64 size = strtoull(arg, &end, 0);
+  switch (*end) {
+  case 'G':
+    size <<= 10;
+    /* fallthrough */
+  case 'M':
+    size <<= 10;
+    /* fallthrough */
+  case 'K':
+    size <<= 10;
+    end++;
+    break;
+  }
+  return *end == '\0' ? size : 0;
+}
+
+/* parses a whole count, false unless arg is a number and nothing else */
+static bool parse_count(const char *arg, u64 *count) {
+  char *end;
+  errno = 0;
+  *count = strtoull(arg, &end, 0);
+  return arg[0] != '-' && end != arg && *end == '\0' && errno == 0;
+}
 
 int main(int argc, char **argv) {
-  if (argc != 2 && argc != 3) {
-    fprintf(stderr, "Usage: ./emulator [file_in] [file_out (optional)]");
+  const char *filename = NULL;
+  char *outname = NULL;
+  bool use_jit = false;
+  const char *manifest = NULL;
+  const char *serve = NULL;
+  int threads = 0;
+  u64 memory_size = MEMORY_SIZE;
+  const char *snapshot_at = NULL;
+  bool restore = false;
+  bool debug = false;
+  bool profile = false;
+  bool timing = false;
+  bool fast_forward = true;
+  const char *trace = NULL;
+  int cores = 1;
+  u64 quantum = CORES_DEFAULT_QUANTUM;
+  int positional = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--jit") == 0) {
+      use_jit = true;
+    } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+      manifest = argv[++i];
+    } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+      serve = argv[++i];
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc) {
+      memory_size = parse_size(argv[++i]);
+    } else if (strcmp(argv[i], "--snapshot-at") == 0 && i + 1 < argc) {
+      snapshot_at = argv[++i];
+    } else if (strcmp(argv[i], "--restore") == 0) {
+      restore = true;
+    } else if (strcmp(argv[i], "--debug") == 0) {
+      debug = true;
+    } else if (strcmp(argv[i], "--profile") == 0) {
+      profile = true;
+    } else if (strcmp(argv[i], "--timing") == 0) {
+      timing = true;
+    } else if (strcmp(argv[i], "--no-fast-forward") == 0) {
+      fast_forward = false;
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      trace = argv[++i];
+    } else if (strcmp(argv[i], "--cores") == 0 && i + 1 < argc) {
+      u64 count;
+      if (!parse_count(argv[++i], &count)) {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+      }
+      /* too many is reported with the limit below */
+      cores = count > CORES_MAX ? CORES_MAX + 1 : (int)count;
+    } else if (strcmp(argv[i], "--quantum") == 0 && i + 1 < argc) {
+      if (!parse_count(argv[++i], &quantum)) {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+      }
+    } else if (positional == 0) {
+      filename = argv[i];
+      positional++;
+    } else {
+      outname = argv[i];
+      positional++;
+    }
+  }
+
+  if (memory_size == 0 || memory_size > MAX_MEMORY_SIZE) {
+    fprintf(stderr, "Invalid memory size, the maximum is %llu bytes.\n",
+            (unsigned long long)MAX_MEMORY_SIZE);
     return EXIT_FAILURE;
   }
 
-  const char *filename = argv[1];
-  char *outname = NULL;
-  if (argc == 3)
-    outname = argv[2];
+  if (cores < 1 || cores > CORES_MAX) {
+    fprintf(stderr, "Invalid number of cores, the maximum is %d.\n",
+            CORES_MAX);
+    return EXIT_FAILURE;
+  }
+  /* these follow a single core */
+  if (cores > 1 && (manifest != NULL || serve != NULL || snapshot_at != NULL ||
+                    restore || debug || profile || timing || trace != NULL)) {
+    fprintf(stderr, "--cores can not be combined with --batch, --serve, "
+                    "--snapshot-at, --restore, --debug, --profile, --timing "
+                    "or --trace.\n");
+    return EXIT_FAILURE;
+  }
+
+  if (manifest != NULL) {
+    /* the only positional argument is the output directory */
+    if (positional > 1) {
+      fprintf(stderr, USAGE);
+      return EXIT_FAILURE;
+    }
+    int failures = run_batch(manifest, filename, threads, use_jit,
+                             memory_size, fast_forward);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (serve != NULL) {
+    if (positional != 0) {
+      fprintf(stderr, USAGE);
+      return EXIT_FAILURE;
+    }
+    bool served = run_server(serve, threads, use_jit, memory_size,
+                             fast_forward);
+    return served ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (positional != 1 && positional != 2) {
+    fprintf(stderr, USAGE);
+    return EXIT_FAILURE;
+  }
+
+  machine_t *machine = machine_create(memory_size);
+  if (machine == NULL) {
+    fprintf(stderr, "Could not allocate the machine.\n");
+    return EXIT_FAILURE;
+  }
+
+  machine->fast_forward = fast_forward;
+
+  /* the JIT is opt-in, the interpreter is used if it is unavailable */
+  if (use_jit)
+    jit_init(machine);
+
+  /* after the JIT, which every core then gets too */
+  if (!machine_set_cores(machine, cores, quantum)) {
+    fprintf(stderr, "Could not allocate the cores.\n");
+    return EXIT_FAILURE;
+  }
+
+  if (profile && !profile_init(machine)) {
+    fprintf(stderr, "Could not allocate the profile.\n");
+    return EXIT_FAILURE;
+  }
+  if (timing && !timing_init(machine)) {
+    fprintf(stderr, "Could not allocate the timing model.\n");
+    return EXIT_FAILURE;
+  }
+  if (trace != NULL && !trace_start(machine, trace)) {
+    fprintf(stderr, "Could not start tracing to %s\n", trace);
+    return EXIT_FAILURE;
+  }
 
   FILE *outstream = stdout;
 
   if (outname != NULL)
     outstream = fopen(outname, "w");
 
-  /* load image file */
-  machine_load_program(&machine, filename);
+  /* snapshots of an image live next to it */
+  char *snapshot_path =
+      malloc(strlen(filename) + strlen(SNAPSHOT_EXTENSION) + 1);
+  if (snapshot_path == NULL)
+    return EXIT_FAILURE;
+  sprintf(snapshot_path, "%s%s", filename, SNAPSHOT_EXTENSION);
 
-  run_machine(&machine);
+  if (restore) {
+    /* carry on from the snapshot instead of the start of the image */
+    snapshot_t *snapshot = snapshot_load(snapshot_path);
+    if (snapshot == NULL || !machine_restore(machine, snapshot)) {
+      fprintf(stderr, "Could not restore %s\n", snapshot_path);
+      return EXIT_FAILURE;
+    }
+    snapshot_release(snapshot);
+  } else {
+    /* load image file */
+    machine_load_program(machine, filename);
+  }
+
+  bool running = true;
+  if (snapshot_at != NULL) {
+    running = run_machine_steps(machine, strtoull(snapshot_at, NULL, 0));
+    snapshot_t *snapshot = machine_snapshot(machine);
+    if (snapshot == NULL || !snapshot_save(snapshot, snapshot_path)) {
+      fprintf(stderr, "Could not write %s\n", snapshot_path);
+      return EXIT_FAILURE;
+    }
+    snapshot_release(snapshot);
+  }
+  free(snapshot_path);
+
+  if (debug)
+    run_debugger(machine, stdin, stdout);
+  else if (running)
+    run_machine(machine);
+  if (trace != NULL && !trace_stop(machine))
+    fprintf(stderr, "Could not write the trace to %s\n", trace);
+  if (!report_exit(machine)) {
+    if (outname != NULL)
+      fclose(outstream);
+    machine_destroy(machine);
+    return EXIT_FAILURE;
+  }
 
   /* cleanup */;
-  shutdown_machine(&machine, outstream);
+  shutdown_machine(machine, outstream);
+  if (profile)
+    profile_report(machine, outstream);
+  if (timing)
+    timing_report(machine, outstream);
   /* IMPORTANT: close the output stream *AFTER* the machine shutdown */
   if (outname != NULL)
     fclose(outstream);
 
+  machine_destroy(machine);
   return EXIT_SUCCESS;
 }
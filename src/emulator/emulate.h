@@ -2,34 +2,133 @@
 #define EMULATE_H
 
 #include "../defs.h"
+#include "libemulator.h"
+#include <setjmp.h>
 #include <stdbool.h>
 #include <stdio.h>
 
+/* default size of the guest address space */
 #define MEMORY_SIZE (1 << 21)
 #define ZR 0
 #define TERMINATE_OP 0x8a000000
 
 #define START_INSTR_ADDR 0x0
 
-#define REG_COUNT 31
+#define REG_COUNT MACHINE_REG_COUNT
+#define VREG_COUNT MACHINE_VREG_COUNT
+
+/* keeps the state of different machines off each other's cache lines */
+#define CACHE_LINE_SIZE 64
+
+/* guest memory is allocated a page at a time, see memory.h */
+#define PAGE_BITS 12
+#define PAGE_SIZE (1 << PAGE_BITS)
+#define TLB_BITS 6
+#define TLB_SIZE (1 << TLB_BITS)
 
 typedef u64 reg;                 /* represents a 64-bit register */
 typedef reg reg_file[REG_COUNT]; /* 31 general purpose registers */
 typedef u32 instruction;         /* 32 bit instruction */
+
+/* a 128-bit SIMD register, as lanes of 1, 2, 4 or 8 bytes */
+typedef union {
+  _Alignas(16) u8 b[16];
+  u16 h[8];
+  u32 s[4];
+  u64 d[2];
+} vreg;
+/* kind of the last flag-setting operation, see flags.h */
+typedef enum { FLAGS_NONE, FLAGS_ADD, FLAGS_SUB, FLAGS_LOGIC } flags_op_t;
+
 typedef struct {
-  bool N, Z, C, V;
+  u8 nzcv; /* N, Z, C and V in bits 3 to 0, see FLAG_N etc. in flags.h */
+  /* NZCV is only valid once the pending operation has been materialised */
+  u8 pending;       /* flags_op_t, FLAGS_NONE when NZCV is up to date */
+  bool sf;          /* width of the pending operation */
+  u64 lhs, operand; /* its operands */
+  u64 result;       /* and its result */
 } PSTATE;
 
 typedef struct {
-  u8 memory[MEMORY_SIZE]; /* emulator memory (2^21 bytes) */
-  reg PC;                 /* Program counter register */
-  reg SP;                 /* Stack pointer register */
+  u8 *data; /* PAGE_SIZE bytes, NULL until the page is first written */
+  u8 flags; /* PAGE_* flags from memory.h */
+} page_t;
+
+/* translation of one guest page to the host memory holding it */
+typedef struct {
+  u64 read_tag;  /* guest page number if loads may use data */
+  u64 write_tag; /* guest page number if stores may use data */
+  u8 *data;
+} tlb_entry_t;
+
+/* shared, reference counted backing of guest pages, see memory.h */
+struct mapping;
+
+/* the other cores of a machine, private to cores.c */
+struct cores;
+
+/* exclusive_address of a core whose exclusive monitor is clear */
+#define EXCLUSIVE_NONE UINT64_MAX
+
+/* per machine caches, private to decode.c, block.c and jit.c */
+struct decode_cache;
+struct block_cache;
+struct jit;
+
+/*
+ * optional per machine instrumentation, see timeline.h, profile.h, timing.h,
+ * trace.h and hooks.h
+ */
+struct timeline;
+struct profile;
+struct timing;
+struct trace;
+struct hooks;
+
+/*
+ * A complete guest. Nothing in the emulator core refers to a particular
+ * machine, so any number of them can run side by side.
+ */
+typedef struct machine {
+  /* architectural state touched by every instruction, on its own lines */
+  _Alignas(CACHE_LINE_SIZE) reg PC; /* Program counter register */
+  reg SP;                           /* Stack pointer register */
   PSTATE pstate; /* Program state register (contains condition flags) */
   reg_file regs; /* Register file - 31 general purpose registers */
-} machine_t;
 
-/* the main ARMv8 state */
-/* machine should be defined in emulate.c */
-extern machine_t machine;
+  /* SIMD registers, only touched by vector instructions, see simd.h */
+  _Alignas(CACHE_LINE_SIZE) vreg vregs[VREG_COUNT];
+
+  /* guest memory, as a two level table of lazily allocated pages */
+  _Alignas(CACHE_LINE_SIZE) tlb_entry_t tlb[TLB_SIZE];
+  u64 memory_size; /* size of the address space, a multiple of PAGE_SIZE */
+  page_t **page_tables;
+  u64 *dirty_pages;      /* bitmap of the pages written since the last reset */
+  u64 *dirty_summary;    /* bitmap of the non-zero words of dirty_pages */
+  struct mapping *image; /* read-only mapping of the loaded image, or NULL */
+
+  struct decode_cache *decode_cache;
+  struct block_cache *block_cache;
+  struct jit *jit;           /* NULL unless hot blocks are compiled */
+  struct timeline *timeline; /* NULL unless execution is being recorded */
+  struct profile *profile;   /* NULL unless instructions are counted */
+  struct timing *timing;     /* NULL unless cycles are estimated */
+  struct trace *trace;       /* NULL unless instructions are traced */
+  struct hooks *hooks;       /* NULL unless tools are attached */
+
+  bool fast_forward; /* skip delay loops rather than run them, see block.h */
+
+  /* cores sharing memory with this one, see cores.h */
+  struct cores *cores; /* NULL unless this is core 0 of several */
+  u32 core_id;         /* number of the core, 0 for the machine itself */
+  bool shared_memory;  /* memory is also written by other threads */
+  bool interrupted;    /* set by another core to stop this one */
+  i64 budget; /* instructions run_blocks may still run, see run_core_turn */
+  u64 exclusive_address; /* address marked by LDXR, or EXCLUSIVE_NONE */
+  u64 exclusive_value;   /* the value LDXR loaded from it */
+
+  machine_exit_t exit;    /* how the last run ended */
+  jmp_buf *fault_handler; /* where faults unwind to, NULL outside of a run */
+} machine_t;
 
 #endif
@@ -1,72 +1,125 @@
 #include "branches.h"
 #include "../../utils/bits_utils.h"
+#include "../flags.h"
 #include <stdbool.h>
 #include <stdlib.h>
 
-#define BRANCH_AL_ENCODING 0xe
-#define BRANCH_EQ_ENCODING 0x0
-#define BRANCH_GQ_ENCODING 0xa
-#define BRANCH_GT_ENCODING 0xc
-#define BRANCH_LE_ENCODING 0xd
-#define BRANCH_LT_ENCODING 0xb
-#define BRANCH_NE_ENCODING 0x1
-
 #define BRANCH_UNCONDITIONAL 0x0
 #define BRANCH_REG 0x3
 #define BRANCH_CONDITIONAL 0x1
+#define COMPARE_OR_TEST_BIT 29
+#define TEST_BIT 25
+#define BRANCH_NONZERO_BIT 24
+
+/* whether the branches on a register branch, which they leave unchanged */
+static bool compare_holds(const machine_t *m, const decoded_instr_t *d) {
+  u64 value = d->rd < REG_COUNT ? m->regs[d->rd] : ZR;
+  if (!d->sf)
+    value = (u32)value;
+  return (value != 0) == d->negate;
+}
 
-typedef bool (*b_cond_f)(void);
+static bool test_holds(const machine_t *m, const decoded_instr_t *d) {
+  u64 value = d->rd < REG_COUNT ? m->regs[d->rd] : ZR;
+  return ((value >> d->amount) & 1) == d->negate;
+}
 
-static bool check_eq(void) { return machine.pstate.Z; }
-static bool check_ne(void) { return !machine.pstate.Z; }
-static bool check_gq(void) { return machine.pstate.N == machine.pstate.V; }
-static bool check_lt(void) { return machine.pstate.N != machine.pstate.V; }
-static bool check_gt(void) {
-  return machine.pstate.Z == 0 && machine.pstate.N == machine.pstate.V;
+bool exec_branch(machine_t *m, const decoded_instr_t *d) {
+  m->PC = d->imm;
+  return true;
 }
-static bool check_le(void) {
-  return machine.pstate.Z || machine.pstate.N != machine.pstate.V;
+
+bool exec_branch_reg(machine_t *m, const decoded_instr_t *d) {
+  m->PC = d->rn < REG_COUNT ? m->regs[d->rn] : ZR;
+  return true;
 }
-static bool check_al(void) { return true; }
 
-bool branch_instr(instruction instr) {
+bool exec_branch_cond(machine_t *m, const decoded_instr_t *d) {
+  if (condition_holds(&m->pstate, d->opc))
+    m->PC = d->imm;
+  return true;
+}
+
+bool exec_compare_branch(machine_t *m, const decoded_instr_t *d) {
+  if (compare_holds(m, d))
+    m->PC = d->imm;
+  return true;
+}
+
+bool exec_test_branch(machine_t *m, const decoded_instr_t *d) {
+  if (test_holds(m, d))
+    m->PC = d->imm;
+  return true;
+}
+
+bool branch_taken(machine_t *m, const decoded_instr_t *d) {
+  if (d->exec == exec_branch || d->exec == exec_branch_reg)
+    return true;
+  if (d->exec == exec_branch_cond)
+    return condition_holds(&m->pstate, d->opc);
+  if (d->exec == exec_compare_branch)
+    return compare_holds(m, d);
+  if (d->exec == exec_test_branch)
+    return test_holds(m, d);
+  return false;
+}
+
+/* CBZ, CBNZ, TBZ and TBNZ, negate set for the branches on non-zero */
+static void decode_compare_branch(instruction instr, reg pc,
+                                  decoded_instr_t *d) {
+  d->rd = extract_bits_u32(instr, 0, 4);
+  d->negate = check_bit_u32(instr, BRANCH_NONZERO_BIT);
+  if (check_bit_u32(instr, TEST_BIT)) {
+    /* the bit tested is b5:b40 */
+    d->amount = extract_bits_u32(instr, 31, 31) << 5 |
+                extract_bits_u32(instr, 19, 23);
+    i32 simm14 = (i32)sign_extend(extract_bits_u32(instr, 5, 18), 14);
+    d->imm = pc + (i64)simm14 * sizeof(instruction);
+    d->exec = exec_test_branch;
+  } else {
+    d->sf = check_bit_u32(instr, 31);
+    i32 simm19 = (i32)sign_extend(extract_bits_u32(instr, 5, 23), 19);
+    d->imm = pc + (i64)simm19 * sizeof(instruction);
+    d->exec = exec_compare_branch;
+  }
+}
+
+void decode_branch(instruction instr, reg pc, decoded_instr_t *d) {
   /*
    * uncondtional: 0 00101 simm26
    * register: 1101011 0 0 00 11111 0000 0 0 xn 00000
    * conditional: 0101010 0 simm19 0 cond
+   * compare: sf 011010 op simm19 rt
+   * test: b5 011011 op b40 simm14 rt
    */
+  if (check_bit_u32(instr, COMPARE_OR_TEST_BIT)) {
+    decode_compare_branch(instr, pc, d);
+    return;
+  }
+
   u8 branch_type = extract_bits_u32(instr, 30, 31);
   switch (branch_type) {
   case BRANCH_UNCONDITIONAL: { /* unconditional branch with signed immediate */
     i32 simm26 = (i32)sign_extend(extract_bits_u32(instr, 0, 25), 26);
-    machine.PC += (simm26) * sizeof(instruction);
+    d->imm = pc + (i64)simm26 * sizeof(instruction);
+    d->exec = exec_branch;
     break;
   }
   case BRANCH_REG: { /* unconditional register branch */
-    u8 xn = extract_bits_u32(instr, 5, 9);
-    machine.PC = machine.regs[xn];
+    d->rn = extract_bits_u32(instr, 5, 9);
+    d->exec = exec_branch_reg;
     break;
   }
   case BRANCH_CONDITIONAL: { /* conditional branch with signed immediate */
     i32 simm19 = sign_extend(extract_bits_u32(instr, 5, 23), 19);
-    u8 cond = extract_bits_u32(instr, 0, 3);
-
-    b_cond_f condition_funcs[] = {
-        [BRANCH_EQ_ENCODING] = check_eq, [BRANCH_NE_ENCODING] = check_ne,
-        [BRANCH_GQ_ENCODING] = check_gq, [BRANCH_LT_ENCODING] = check_lt,
-        [BRANCH_GT_ENCODING] = check_gt, [BRANCH_LE_ENCODING] = check_le,
-        [BRANCH_AL_ENCODING] = check_al};
-
-    if (cond >= sizeof(condition_funcs) / sizeof(condition_funcs[0]) ||
-        condition_funcs[cond] == NULL) {
-      fprintf(stderr, "NOT A VALID BRANCH CONDITION ENCODING.\n");
-      return false;
-    }
-
-    if (condition_funcs[cond]()) {
-      machine.PC += simm19 * sizeof(instruction);
-    }
+    /* every one of the 16 condition encodings is valid */
+    d->opc = extract_bits_u32(instr, 0, 3);
+    d->imm = pc + (i64)simm19 * sizeof(instruction);
+    d->exec = exec_branch_cond;
+    break;
   }
+  default:
+    d->exec = exec_nop;
+    break;
   }
-  return true;
 }
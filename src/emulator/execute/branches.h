@@ -1,6 +1,7 @@
 #ifndef BRANCHES
 #define BRANCHES
 
+#include "../decode.h"
 #include "../emulate.h"
 /*
  * each instruction is 32-bit, little-endian format
@@ -12,6 +13,32 @@
  * instr[25-0] = operand
  */
 
-bool branch_instr(instruction instr);
+/**
+ * Decodes a branch instruction. Branch targets are resolved against pc.
+ *
+ * @param instr PRE: Is a branch instruction; op0 = 101x
+ * @param pc    The address of the instruction.
+ * @param d     The record to fill in.
+ */
+void decode_branch(instruction instr, reg pc, decoded_instr_t *d);
+
+/* handlers for decoded branches, exposed for the block engine */
+bool exec_branch(machine_t *m, const decoded_instr_t *d);
+bool exec_branch_reg(machine_t *m, const decoded_instr_t *d);
+bool exec_branch_cond(machine_t *m, const decoded_instr_t *d);
+/* CBZ and CBNZ on rd, negate set for CBNZ */
+bool exec_compare_branch(machine_t *m, const decoded_instr_t *d);
+/* TBZ and TBNZ on bit amount of rd, negate set for TBNZ */
+bool exec_test_branch(machine_t *m, const decoded_instr_t *d);
+
+/**
+ * Tells whether a decoded instruction is a branch that is taken, even to the
+ * next instruction. A branch leaves the state its condition reads unchanged,
+ * so this holds as well once it has run. The machine is only written to
+ * materialise its flags.
+ *
+ * @param d Any decoded instruction, false unless it is a branch.
+ */
+bool branch_taken(machine_t *m, const decoded_instr_t *d);
 
 #endif /* BRANCHES */
@@ -2,6 +2,7 @@
 #include "../../defs.h"
 #include "../../utils/bits_utils.h"
 #include "../emulate.h"
+#include "../flags.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -14,61 +15,65 @@
 #define WIDE_MOV_Z_OPC 0x2
 #define WIDE_MOV_K_OPC 0x3
 
-void immediate_exectution(instruction instr) {
-  // fprintf(stderr, "%u we are immediate\n", instr);
+bool exec_arith_imm(machine_t *m, const decoded_instr_t *d) {
+  bool sf = d->sf;
+  u64 operand = d->imm;
+  u64 lhs = is_ZR(d->rn) ? 0 : m->regs[d->rn];
 
+  // If SF is 0 then bit-width for all registers is 32 bits.
+  if (!sf) {
+    lhs = zero_upper_32(lhs);
+  }
+
+  bool update_flags = (d->opc & 1);
+  bool is_sub = (d->opc >> 1);
+  u64 result = is_sub ? (lhs - operand) : (lhs + operand);
+
+  if (update_flags)
+    record_arith_flags(&m->pstate, lhs, operand, result, is_sub, sf);
+
+  // Writing the result to the destination register
+  if (d->rd != REG_COUNT) {
+    m->regs[d->rd] = sf ? result : zero_upper_32(result);
+  }
+  return true;
+}
+
+// MOVN and MOVZ: the result only depends on the instruction word
+bool exec_move_wide(machine_t *m, const decoded_instr_t *d) {
+  if (d->rd != REG_COUNT) {
+    m->regs[d->rd] = d->imm;
+  }
+  return true;
+}
+
+bool exec_move_keep(machine_t *m, const decoded_instr_t *d) {
+  u64 result = (d->rd == REG_COUNT) ? 0 : m->regs[d->rd];
+  insert_bits_u64(&result, d->amount, d->amount + 15, d->imm);
+
+  if (d->rd != REG_COUNT) {
+    m->regs[d->rd] = d->sf ? result : zero_upper_32(result);
+  }
+  return true;
+}
+
+void decode_immediate(instruction instr, decoded_instr_t *d) {
   bool sf = check_bit_u32(instr, SF_BIT_IMM);
   u32 opc = extract_bits_u32(instr, OPC_START_IMM, OPC_END_IMM);
   u32 opi = extract_bits_u32(instr, OPI_START_IMM, OPI_END_IMM);
 
-  u32 rd_index = extract_bits_u32(instr, RD_START_IMM, RD_END_IMM);
-  // reg *rd = &machine.regs[rd_index];
+  d->sf = sf;
+  d->opc = opc;
+  d->rd = extract_bits_u32(instr, RD_START_IMM, RD_END_IMM);
 
   if (opi == OPI_ARITH) {
     bool sh = check_bit_u32(instr, SH_BIT_IMM);
     u32 imm12 = extract_bits_u32(instr, IMM12_START_IMM, IMM12_END_IMM);
-    u32 rn_index = extract_bits_u32(instr, RN_START_IMM, RN_END_IMM);
-    // reg *rn = &machine.regs[rn_index];
 
     u64 operand = sh ? logical_shift_left((u64)imm12, 12) : (u64)imm12;
-    u64 lhs = is_ZR(rn_index) ? 0 : machine.regs[rn_index];
-
-    // If SF is 0 then bit-width for all registers is 32 bits.
-    if (!sf) {
-      lhs = zero_upper_32(lhs);
-      operand = zero_upper_32(operand);
-    }
-
-    bool update_flags = (opc & 1);
-    bool is_sub = (opc >> 1);
-    u64 result = is_sub ? (lhs - operand) : (lhs + operand);
-
-    if (update_flags) {
-      machine.pstate.N = check_bit_u64(result, sf ? 63 : 31);
-      machine.pstate.Z = (sf ? result == 0 : zero_upper_32(result) == 0);
-
-      if (!is_sub) {
-        machine.pstate.C =
-            (lhs > (sf ? UINT64_MAX - operand : UINT32_MAX - operand));
-        machine.pstate.V =
-            (sf ? ((i64)lhs > 0 && (i64)operand > 0 && (i64)result < 0) ||
-                      ((i64)lhs < 0 && (i64)operand < 0 && (i64)result > 0)
-                : ((i32)lhs > 0 && (i32)operand > 0 && (i32)result < 0) ||
-                      ((i32)lhs < 0 && (i32)operand < 0 && (i32)result > 0));
-      } else {
-        machine.pstate.C = (lhs >= operand);
-        machine.pstate.V =
-            (sf ? ((i64)lhs > 0 && (i64)operand < 0 && (i64)result < 0) ||
-                      ((i64)lhs < 0 && (i64)operand > 0 && (i64)result > 0)
-                : ((i32)lhs > 0 && (i32)operand < 0 && (i32)result < 0) ||
-                      ((i32)lhs < 0 && (i32)operand > 0 && (i32)result > 0));
-      }
-    }
-
-    // Writing the result to the destination register
-    if (rd_index != REG_COUNT) {
-      machine.regs[rd_index] = sf ? result : zero_upper_32(result);
-    }
+    d->imm = sf ? operand : zero_upper_32(operand);
+    d->rn = extract_bits_u32(instr, RN_START_IMM, RN_END_IMM);
+    d->exec = exec_arith_imm;
   } else if (opi == OPI_WIDE_MOVE) {
     // Wide move immediate instruction
     u32 hw = extract_bits_u32(instr, HW_START_IMM, HW_END_IMM);
@@ -78,33 +83,33 @@ void immediate_exectution(instruction instr) {
     u64 operand = logical_shift_left(imm16, shift);
 
     if (!sf && hw > 1) {
-      fprintf(stderr, "[aj3124] Invalid instruction format: Wide move "
-                      "immediate with 32-bit operand.\n");
-      exit(1);
+      d->exec = exec_fatal;
+      d->msg = "[aj3124] Invalid instruction format: Wide move "
+               "immediate with 32-bit operand.\n";
+      return;
     }
 
-    u64 result = 0;
-
     switch (opc) {
     case WIDE_MOV_N_OPC: // MOVN
-      result = ~operand;
+      d->imm = sf ? ~operand : zero_upper_32(~operand);
+      d->exec = exec_move_wide;
       break;
     case WIDE_MOV_Z_OPC: // MOVZ
-      result = operand;
+      d->imm = sf ? operand : zero_upper_32(operand);
+      d->exec = exec_move_wide;
       break;
     case WIDE_MOV_K_OPC: // MOVK
-      result = (rd_index == REG_COUNT) ? 0 : machine.regs[rd_index];
-      insert_bits_u64(&result, shift, shift + 15, imm16);
+      d->imm = imm16;
+      d->amount = shift;
+      d->exec = exec_move_keep;
       break;
     default:
-      fprintf(stderr, "[aj3124] Invalid instruction format: Unsupported opcode "
-                      "for wide move immediate.\n");
-      exit(1);
-    }
-
-    // Writing the result to the destination register
-    if (rd_index != REG_COUNT) {
-      machine.regs[rd_index] = sf ? result : zero_upper_32(result);
+      d->exec = exec_fatal;
+      d->msg = "[aj3124] Invalid instruction format: Unsupported opcode "
+               "for wide move immediate.\n";
+      break;
     }
+  } else {
+    d->exec = exec_nop;
   }
 }
@@ -1,6 +1,7 @@
 #ifndef IMMEDIATE_INSTRUCTIONS
 #define IMMEDIATE_INSTRUCTIONS
 
+#include "../decode.h"
 #include "../emulate.h"
 #include <stdio.h>
 
@@ -33,6 +34,17 @@
 #define IMM16_START_IMM 5
 #define IMM16_END_IMM 20
 
-extern void immediate_exectution(instruction instr);
+/**
+ * Decodes a data processing (immediate) instruction.
+ *
+ * @param instr PRE: Is an immediate instruction; op0 = 100x
+ * @param d     The record to fill in.
+ */
+extern void decode_immediate(instruction instr, decoded_instr_t *d);
+
+/* handlers for decoded immediate instructions, exposed for the block engine */
+bool exec_arith_imm(machine_t *m, const decoded_instr_t *d);
+bool exec_move_wide(machine_t *m, const decoded_instr_t *d);
+bool exec_move_keep(machine_t *m, const decoded_instr_t *d);
 
 #endif
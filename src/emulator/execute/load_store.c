@@ -1,109 +1,265 @@
 #include "load_store.h"
 #include "../../defs.h"
 #include "../../utils/bits_utils.h"
+#include "../decode.h"
+#include "../machine.h"
+#include "../memory.h"
 #include <assert.h>
-#include <inttypes.h>
-#include <stdio.h>
-#include <stdlib.h>
-
-static void check_memory_in_bounds(u64 address, int num_bytes) {
-  if (address + num_bytes > MEMORY_SIZE) {
-    printf("Memory access out of bounds at %" PRIx64 "\n", address);
-    exit(1);
-  }
+
+static inline u64 read_reg(const machine_t *m, u8 index) {
+  return index < REG_COUNT ? m->regs[index] : ZR;
+}
+
+static inline void write_reg(machine_t *m, u8 index, u64 value) {
+  if (index < REG_COUNT)
+    m->regs[index] = value;
 }
 
-static void store(u64 target_address, u32 target_register, int num_bytes) {
-  reg source_reg_bits = machine.regs[target_register];
-  check_memory_in_bounds(target_address, num_bytes);
-  for (int i = 0; i < num_bytes; i++) {
-    machine.memory[target_address + i] =
-        (u8)extract_bits_u64(source_reg_bits, 8 * i, 8 * (i + 1) - 1);
+static u64 load(machine_t *m, u64 target_address, int num_bytes) {
+  return memory_load(m, target_address, num_bytes);
+}
+
+/* the register value of d->size bytes that were loaded */
+static u64 extend(const decoded_instr_t *d, u64 value) {
+  if (!d->is_signed)
+    return value;
+  value = (u64)sign_extend(value, 8 * d->size);
+  return d->sf ? value : (u32)value;
+}
+
+/*
+ * The address a load or store accesses. base is set to what the base register
+ * holds afterwards, which is only written back once the access did not fault.
+ */
+static u64 calculate_offset(machine_t *m, const decoded_instr_t *d,
+                            u64 *base) {
+  u64 base_addr = read_reg(m, d->rn);
+  *base = base_addr;
+
+  switch (d->opc) {
+  case UNSIGNED_OFFSET:
+    // imm12 already scaled by the transfer size
+    return base_addr + d->imm;
+  case REGISTER_OFFSET:
+    return base_addr + read_reg(m, d->rm);
+  case PRE_INDEXED:
+    *base = base_addr + d->imm;
+    return *base;
+  case POST_INDEXED:
+  default:
+    *base = base_addr + d->imm;
+    return base_addr;
   }
 }
 
-static u64 calculate_offset(instruction instr, u64 target, bool in_64) {
-  u32 xn = extract_bits_u32(instr, XN_START, XN_END); // base address reg
-  u64 base_addr = machine.regs[xn];
+bool exec_load(machine_t *m, const decoded_instr_t *d) {
+  u64 base;
+  u64 target_addr = calculate_offset(m, d, &base);
+  u64 value = load(m, target_addr, d->size);
+  write_reg(m, d->rn, base);
+  write_reg(m, d->rd, extend(d, value));
+  return true;
+}
 
-  if (check_bit_u32(instr, UNSIGNED_OFFSET_BIT)) {
-    // MID: Unsigned Offset mode
-    u64 uoffset;
-    u32 imm12;
-    imm12 = extract_bits_u32(instr, OFFSET_START, OFFSET_END);
+bool exec_store(machine_t *m, const decoded_instr_t *d) {
+  u64 base;
+  u64 target_addr = calculate_offset(m, d, &base);
+  // storing the base register itself stores its written back value
+  u64 value = d->rd == d->rn ? base : read_reg(m, d->rd);
+  memory_store(m, target_addr, value, d->size);
+  write_reg(m, d->rn, base);
+  return true;
+}
 
-    uoffset = (u64)imm12 * (in_64 ? 8 : 4);
-    target = base_addr + uoffset;
+// the literal address is resolved against the PC at decode time
+bool exec_load_literal(machine_t *m, const decoded_instr_t *d) {
+  write_reg(m, d->rd, extend(d, load(m, d->imm, d->size)));
+  return true;
+}
 
-  } else if (check_bit_u32(instr, REGISTER_OFFSET_BIT)) {
-    // MID: Register offset mode
-    reg xm = extract_bits_u32(instr, XM_START, XM_END); // offset address reg
-    u64 offset_addr = machine.regs[xm];
-    target = base_addr + offset_addr;
+bool exec_load_pair(machine_t *m, const decoded_instr_t *d) {
+  u64 base;
+  u64 target_addr = calculate_offset(m, d, &base);
+  u64 first, second;
+  memory_load_pair(m, target_addr, d->size, &first, &second);
+  write_reg(m, d->rn, base);
+  write_reg(m, d->rd, extend(d, first));
+  write_reg(m, d->ra, extend(d, second));
+  return true;
+}
 
-  } else if (check_bit_u32(instr, I_BIT)) {
-    // MID: Pre-Indexed mode
-    u32 simm9 = extract_bits_u32(instr, SIMM9_START, SIMM9_END);
-    target = base_addr + sign_extend(simm9, 9);
-    machine.regs[xn] = target;
+bool exec_store_pair(machine_t *m, const decoded_instr_t *d) {
+  u64 base;
+  u64 target_addr = calculate_offset(m, d, &base);
+  // as for single stores, the base register stores its written back value
+  u64 first = d->rd == d->rn ? base : read_reg(m, d->rd);
+  u64 second = d->ra == d->rn ? base : read_reg(m, d->ra);
+  memory_store_pair(m, target_addr, first, second, d->size);
+  write_reg(m, d->rn, base);
+  return true;
+}
 
+/* address of an exclusive or ordered transfer, which must be aligned */
+static u64 aligned_address(machine_t *m, const decoded_instr_t *d) {
+  u64 address = read_reg(m, d->rn);
+  if (address & (d->size - 1))
+    machine_fault(m, MACHINE_ALIGNMENT_FAULT, address);
+  return address;
+}
+
+bool exec_load_exclusive(machine_t *m, const decoded_instr_t *d) {
+  u64 address = aligned_address(m, d);
+  u64 value = load(m, address, d->size);
+  m->exclusive_address = address;
+  m->exclusive_value = value;
+  // LDXR is ordered as strongly as LDAXR
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  write_reg(m, d->rd, value);
+  return true;
+}
+
+bool exec_store_exclusive(machine_t *m, const decoded_instr_t *d) {
+  u64 address = aligned_address(m, d);
+  // the compare and swap orders STXR as strongly as STLXR
+  bool stored = m->exclusive_address == address &&
+                memory_compare_exchange(m, address, m->exclusive_value,
+                                        read_reg(m, d->rd), d->size);
+  m->exclusive_address = EXCLUSIVE_NONE;
+  write_reg(m, d->rm, stored ? 0 : 1);
+  return true;
+}
+
+bool exec_load_acquire(machine_t *m, const decoded_instr_t *d) {
+  u64 value = load(m, aligned_address(m, d), d->size);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  write_reg(m, d->rd, value);
+  return true;
+}
+
+bool exec_store_release(machine_t *m, const decoded_instr_t *d) {
+  u64 address = aligned_address(m, d);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memory_store(m, address, read_reg(m, d->rd), d->size);
+  // a later LDAR may not be satisfied before the store is visible
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  return true;
+}
+
+static void decode_exclusive(instruction instr, decoded_instr_t *d) {
+  d->rm = extract_bits_u32(instr, RS_START, RS_END);  // status register
+  d->size = 1 << extract_bits_u32(instr, SIZE_START, SIZE_END);
+  d->sf = d->size == 8;
+  bool load = check_bit_u32(instr, OPERATION_BIT);
+
+  if (check_bit_u32(instr, PAIR_BIT)) {
+    // MID: LDXP, STXP and the compare and swap instructions
+    d->exec = exec_invalid;
+    d->msg = "Unsupported exclusive transfer\n";
+  } else if (check_bit_u32(instr, ORDERED_BIT)) {
+    // MID: LDAR or STLR
+    d->exec = load ? exec_load_acquire : exec_store_release;
   } else {
-    // MID: Post-Indexed mode
-    u32 simm9 = extract_bits_u32(instr, SIMM9_START, SIMM9_END);
-    target = base_addr;
-    machine.regs[xn] = base_addr + sign_extend(simm9, 9);
-  };
+    // MID: LDXR, LDAXR, STXR or STLXR
+    d->exec = load ? exec_load_exclusive : exec_store_exclusive;
+  }
+}
 
-  return target;
+static void decode_pair(instruction instr, decoded_instr_t *d) {
+  // opc: 00 for W registers, 01 for LDPSW and 10 for X registers
+  u32 opc = extract_bits_u32(instr, SIZE_START, SIZE_END);
+  bool load = check_bit_u32(instr, OPERATION_BIT);
+  if (opc == 3 || (opc == 1 && !load)) {
+    d->exec = exec_invalid;
+    d->msg = "Unsupported load/store pair\n";
+    return;
+  }
+  d->ra = extract_bits_u32(instr, RT2_START, RT2_END);
+  d->size = opc == 2 ? 8 : 4;
+  d->sf = opc != 0;
+  d->is_signed = opc == 1;
+
+  u32 imm7 = extract_bits_u32(instr, IMM7_START, IMM7_END);
+  d->imm = (u64)sign_extend(imm7, 7) * d->size;
+  switch (extract_bits_u32(instr, PAIR_MODE_START, PAIR_MODE_END)) {
+  case PAIR_POST_INDEXED:
+    d->opc = POST_INDEXED;
+    break;
+  case PAIR_PRE_INDEXED:
+    d->opc = PRE_INDEXED;
+    break;
+  default:
+    // signed offset, or its non-temporal form (LDNP and STNP)
+    d->opc = UNSIGNED_OFFSET;
+    break;
+  }
+  d->exec = load ? exec_load_pair : exec_store_pair;
 }
 
-void execute_load_store(instruction instr) {
+void decode_load_store(instruction instr, reg pc, decoded_instr_t *d) {
   // PRE: instr(OP0) = x1x0
   u32 op0 = extract_bits_u32(instr, OP0_START, OP0_END);
   assert(op0 == OP0a || op0 == OP0b || op0 == OP0c || op0 == OP0d);
 
-  bool sf = check_bit_u32(instr, SF_BIT);             // sf = 1: 64bit
-  u32 rt = extract_bits_u32(instr, RT_START, RT_END); // target register
-  u64 target_addr = 0;                                // Transfer address
-  bool load_literal = 0;                              // Load literal flag
+  d->rd = extract_bits_u32(instr, RT_START, RT_END);  // target register
+  d->rn = extract_bits_u32(instr, XN_START, XN_END);  // base address reg
+  d->rm = extract_bits_u32(instr, XM_START, XM_END);  // offset address reg
 
-  // Calculate offset depending on instruction
-  if (check_bit_u32(instr, SINGLE_TRANSFER_BIT)) {
-    target_addr = calculate_offset(instr, target_addr, sf);
-  } else {
-    // MID: Load Literal, set load_literal flag to true
-    load_literal = true;
-    u32 simm19 = extract_bits_u32(instr, SIMM19_START, SIMM19_END);
-    target_addr = machine.PC + sign_extend(simm19, 19) * 4;
+  if (extract_bits_u32(instr, EXCLUSIVE_START, EXCLUSIVE_END) ==
+      EXCLUSIVE_PATTERN) {
+    decode_exclusive(instr, d);
+    return;
   }
 
-  // Store and Load is split up into two branches for both 32 and 64 bit
-  if (sf) {
-    // MID: Rt is 64-bit
-    if (check_bit_u32(instr, OPERATION_BIT) || load_literal) {
-      // MID: load operation
-      u64 value = 0;
-      check_memory_in_bounds(target_addr, 8);
-      for (int i = 0; i < 8; i++) {
-        value |= ((u64)machine.memory[target_addr + i]) << (8 * i);
-      }
-      machine.regs[rt] = value;
-    } else {
-      store(target_addr, rt, 8);
+  u32 transfer = extract_bits_u32(instr, TRANSFER_START, TRANSFER_END);
+  if (transfer == TRANSFER_PAIR) {
+    decode_pair(instr, d);
+    return;
+  }
+
+  // size: 00 for bytes up to 11 for doublewords
+  u32 size = extract_bits_u32(instr, SIZE_START, SIZE_END);
+  if (transfer == TRANSFER_LITERAL) {
+    // MID: Load Literal, with size 10 for LDRSW
+    if (size == 3) {
+      d->exec = exec_invalid;
+      d->msg = "Unsupported load literal\n";
+      return;
     }
+    u32 simm19 = extract_bits_u32(instr, SIMM19_START, SIMM19_END);
+    d->imm = pc + sign_extend(simm19, 19) * 4;
+    d->size = size == 1 ? 8 : 4;
+    d->sf = size != 0;
+    d->is_signed = size == 2;
+    d->exec = exec_load_literal;
+    return;
+  }
 
+  u32 opc = extract_bits_u32(instr, OPC_START, OPC_END);
+  if ((opc == OPC_LOAD_SIGNED_64 && size == 3) ||
+      (opc == OPC_LOAD_SIGNED_32 && size >= 2)) {
+    // MID: prefetches, and sign extending loads as wide as the register
+    d->exec = exec_invalid;
+    d->msg = "Unsupported single data transfer\n";
+    return;
+  }
+  d->size = 1 << size;
+  d->sf = size == 3 || opc == OPC_LOAD_SIGNED_64;
+  d->is_signed = opc == OPC_LOAD_SIGNED_64 || opc == OPC_LOAD_SIGNED_32;
+
+  if (check_bit_u32(instr, UNSIGNED_OFFSET_BIT)) {
+    // MID: Unsigned Offset mode
+    u32 imm12 = extract_bits_u32(instr, OFFSET_START, OFFSET_END);
+    d->opc = UNSIGNED_OFFSET;
+    d->imm = (u64)imm12 * d->size;
+  } else if (check_bit_u32(instr, REGISTER_OFFSET_BIT)) {
+    // MID: Register offset mode
+    d->opc = REGISTER_OFFSET;
   } else {
-    // MID: Rt is 32-bit
-    if (check_bit_u32(instr, OPERATION_BIT) || load_literal) {
-      // MID: load operation
-      u32 value = 0;
-      check_memory_in_bounds(target_addr, 4);
-      for (int i = 0; i < 4; i++) {
-        value |= ((u32)machine.memory[target_addr + i]) << (8 * i);
-      }
-      machine.regs[rt] = (reg)value;
-    } else {
-      store(target_addr, rt, 4);
-    }
+    // MID: Pre-Indexed or Post-Indexed mode
+    u32 simm9 = extract_bits_u32(instr, SIMM9_START, SIMM9_END);
+    d->opc = check_bit_u32(instr, I_BIT) ? PRE_INDEXED : POST_INDEXED;
+    d->imm = sign_extend(simm9, 9);
   }
+
+  d->exec = opc == OPC_STORE ? exec_store : exec_load;
 }
@@ -1,15 +1,19 @@
 #ifndef LOAD_STORE
 #define LOAD_STORE
 
+#include "../decode.h"
 #include "../emulate.h"
 
 //Definition of bits in instruction
-#define SINGLE_TRANSFER_BIT   31
 #define SF_BIT                30
+#define TRANSFER_END          29
 #define OP0_END               28
+#define TRANSFER_START        27
 #define OP0_START             25
 #define UNSIGNED_OFFSET_BIT   24
+#define OPC_END               23
 #define SIMM19_END            23
+#define OPC_START             22
 #define OPERATION_BIT         22
 #define OFFSET_END            21
 #define REGISTER_OFFSET_BIT   21
@@ -25,12 +29,91 @@
 #define RT_END                 4
 #define RT_START               0
 
+//Kinds of transfer, told apart by bits 27-29
+#define TRANSFER_LITERAL      0x3
+#define TRANSFER_PAIR         0x5
+
+//Load/store pair: opc 101 V mode L imm7 Rt2 Rn Rt
+#define PAIR_MODE_END         24
+#define PAIR_MODE_START       23
+#define IMM7_END              21
+#define IMM7_START            15
+#define RT2_END               14
+#define RT2_START             10
+
+//Exclusive and ordered transfers: size 001000 o2 L o1 Rs o0 Rt2 Rn Rt
+#define EXCLUSIVE_END         29
+#define EXCLUSIVE_START       24
+#define EXCLUSIVE_PATTERN     0x08
+#define SIZE_END              31
+#define SIZE_START            30
+#define ORDERED_BIT           23
+#define PAIR_BIT              21
+#define RS_END                20
+#define RS_START              16
+
+//Values of opc in a single data transfer
+#define OPC_STORE             0x0
+#define OPC_LOAD              0x1
+#define OPC_LOAD_SIGNED_64    0x2
+#define OPC_LOAD_SIGNED_32    0x3
+
+//Addressing modes of a load/store pair
+#define PAIR_POST_INDEXED     0x1
+#define PAIR_OFFSET           0x2
+#define PAIR_PRE_INDEXED      0x3
+
 //Possible values for OP0 for LOAD/STORE
 #define OP0a 0x4 
 #define OP0b 0x6
 #define OP0c 0xc
 #define OP0d 0xe
 
-void execute_load_store(instruction instr);
+// Addressing mode of a single data transfer or pair, kept in
+// decoded_instr_t.opc. UNSIGNED_OFFSET adds imm, which is signed for pairs.
+typedef enum {
+  UNSIGNED_OFFSET,
+  REGISTER_OFFSET,
+  PRE_INDEXED,
+  POST_INDEXED
+} addressing_mode_t;
+
+/**
+ * Decodes a single data transfer of any size (LDR, LDRB, LDRSW, STRH...), load
+ * literal, load/store pair (LDP, LDPSW and STP), or exclusive or ordered
+ * transfer (LDXR, STXR, LDAXR, STLXR, LDAR and STLR) instruction.
+ *
+ * @param instr PRE: Is a load/store instruction; op0 = x1x0
+ * @param pc    The address of the instruction, used to resolve literals.
+ * @param d     The record to fill in.
+ */
+void decode_load_store(instruction instr, reg pc, decoded_instr_t *d);
+
+/*
+ * Handlers for decoded loads and stores, exposed for the block engine. They
+ * move size bytes per register, loads zero extending what they read unless
+ * is_signed is set.
+ */
+bool exec_load(machine_t *m, const decoded_instr_t *d);
+bool exec_store(machine_t *m, const decoded_instr_t *d);
+bool exec_load_literal(machine_t *m, const decoded_instr_t *d);
+
+/* pairs transfer rd at the address and ra right after it */
+bool exec_load_pair(machine_t *m, const decoded_instr_t *d);
+bool exec_store_pair(machine_t *m, const decoded_instr_t *d);
+
+/*
+ * Exclusive and ordered transfers. They stop the machine with
+ * MACHINE_ALIGNMENT_FAULT if the address is not a multiple of their size.
+ *
+ * STXR succeeds if the marked address still holds the value LDXR loaded from
+ * it, checked and stored as one atomic compare and swap. Another core storing
+ * the same value in between goes unnoticed, which no lock or counter built on
+ * the pair can tell apart from the real monitor.
+ */
+bool exec_load_exclusive(machine_t *m, const decoded_instr_t *d);
+bool exec_store_exclusive(machine_t *m, const decoded_instr_t *d);
+bool exec_load_acquire(machine_t *m, const decoded_instr_t *d);
+bool exec_store_release(machine_t *m, const decoded_instr_t *d);
 
 #endif //LOAD_STORE
@@ -1,6 +1,7 @@
 #include "register_instruction.h"
 #include "../../defs.h"
 #include "../../utils/bits_utils.h"
+#include "../flags.h"
 #include <assert.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -36,49 +37,26 @@ static void shift(u64 *b, u32 shift, u32 operand, bool is_arith, bool sf) {
     }
     break;
   }
-  case OPP_ROR:     // rotate right
-    if (is_arith) { // should be only for logic
-      fprintf(stderr, "no shift 11 for arithmetic (no rotate right)  \n");
-      exit(1);
-    } else {
-      *b = (*b >> operand) | (*b << (BITS_WIDTH(sf) - operand));
-    }
+  case OPP_ROR: // rotate right
+    assert(!is_arith); // should be only for logic, rejected by the decoder
+    *b = (*b >> operand) | (*b << (BITS_WIDTH(sf) - operand));
     break;
   default:
     assert(false);
   }
 }
 
-static u64 arithmetic(u64 lhs, u64 operand, u32 opc, bool sf) {
+static u64 arithmetic(machine_t *m, u64 lhs, u64 operand, u32 opc, bool sf) {
   bool update_flags = (opc & 1);
   bool is_sub = (opc >> 1);
   u64 result = is_sub ? (lhs - operand) : (lhs + operand);
 
-  if (update_flags) {
-    machine.pstate.N = check_bit_u64(result, sf ? MSB_64 : MSB_32);
-    machine.pstate.Z = (sf ? result == 0 : zero_upper_32(result) == 0);
-
-    if (!is_sub) {
-      machine.pstate.C =
-          (lhs > (sf ? UINT64_MAX - operand : UINT32_MAX - operand));
-      machine.pstate.V =
-          (sf ? ((i64)lhs > 0 && (i64)operand > 0 && (i64)result < 0) ||
-                    ((i64)lhs < 0 && (i64)operand < 0 && (i64)result > 0)
-              : ((i32)lhs > 0 && (i32)operand > 0 && (i32)result < 0) ||
-                    ((i32)lhs < 0 && (i32)operand < 0 && (i32)result > 0));
-    } else {
-      machine.pstate.C = (lhs >= operand);
-      machine.pstate.V =
-          (sf ? ((i64)lhs > 0 && (i64)operand < 0 && (i64)result < 0) ||
-                    ((i64)lhs < 0 && (i64)operand > 0 && (i64)result > 0)
-              : ((i32)lhs > 0 && (i32)operand < 0 && (i32)result < 0) ||
-                    ((i32)lhs < 0 && (i32)operand > 0 && (i32)result > 0));
-    }
-  }
+  if (update_flags)
+    record_arith_flags(&m->pstate, lhs, operand, result, is_sub, sf);
   return result;
 }
 
-static u64 logic(u64 a, u64 b, u32 opc, bool sf) {
+static u64 logic(machine_t *m, u64 a, u64 b, u32 opc, bool sf) {
   switch (opc) {
   case OPP_AND: // and
     return (a & b);
@@ -88,12 +66,7 @@ static u64 logic(u64 a, u64 b, u32 opc, bool sf) {
     return (a ^ b);
   case OPP_AND_FLAGS: { // and with condition flags
     u64 result = a & b;
-
-    machine.pstate.N = check_bit_u64(result, sf ? MSB_64 : MSB_32);
-    machine.pstate.Z = (sf ? result == 0 : zero_upper_32(result) == 0);
-    machine.pstate.C = 0;
-    machine.pstate.V = 0;
-
+    record_logic_flags(&m->pstate, result, sf);
     return result;
   }
   default:
@@ -101,76 +74,145 @@ static u64 logic(u64 a, u64 b, u32 opc, bool sf) {
   }
 }
 
-u64 read_reg_from_instr(u32 instr, int start, int end) {
-  int index = extract_bits_u32(instr, start, end);
+static inline u64 read_reg(const machine_t *m, u8 index) {
   if (index < 31) {
-    return machine.regs[index];
+    return m->regs[index];
   } else {
     return ZR;
   }
 }
 
-// PRE: Is a register instruction; op0 = x101
-void register_execute(instruction instr) {
-  assert(extract_bits_u32(instr, OP0_START_REG, OP0_END_REG) == OP1_REGISTER ||
-         extract_bits_u32(instr, OP0_START_REG, OP0_END_REG) == OP2_REGISTER);
-  // REPLACE ABOVE WITH OP1 when defined
+static inline void write_result(machine_t *m, const decoded_instr_t *d, u64 result) {
+  if (d->rd != REG_COUNT) {
+    m->regs[d->rd] = d->sf ? result : zero_upper_32(result);
+  }
+}
 
-  bool sf = check_bit_u32(instr, SF_BIT_REG);
-  u32 opc = extract_bits_u32(instr, OPC_START_REG, OPC_END_REG);
-  bool is_arith = check_bit_u32(instr, OPR_FIRST_BIT_REG);
-  u32 shift_op = extract_bits_u32(instr, SHIFT_START_REG, SHIFT_END_REG);
-  bool negate = check_bit_u32(instr, NEGATE_BIT_REG);
+bool exec_multiply(machine_t *m, const decoded_instr_t *d) {
+  bool sf = d->sf;
+  reg a = read_reg(m, d->rn);
+  reg b = read_reg(m, d->rm);
+  reg c = read_reg(m, d->ra);
 
-  reg a = read_reg_from_instr(instr, RN_START_REG, RN_END_REG);
-  reg b = read_reg_from_instr(instr, RM_START_REG, RM_END_REG);
+  if (!sf) {
+    a = zero_upper_32(a);
+    b = zero_upper_32(b);
+  }
+
+  reg aMb = a * b;
+  if (!sf) {
+    c = zero_upper_32(c);
+    aMb = zero_upper_32(aMb);
+  }
+  write_result(m, d, arithmetic(m, c, aMb, d->opc, sf));
+  return true;
+}
 
-  u32 res_index = extract_bits_u32(instr, RD_START_REG, RD_END_REG);
-  u64 result = 0;
+bool exec_arith_reg(machine_t *m, const decoded_instr_t *d) {
+  bool sf = d->sf;
+  reg a = read_reg(m, d->rn);
+  reg b = read_reg(m, d->rm);
 
   if (!sf) {
     a = zero_upper_32(a);
     b = zero_upper_32(b);
   }
 
+  if (d->amount)
+    shift(&b, d->shift, d->amount, true, sf);
+
+  write_result(m, d, arithmetic(m, a, b, d->opc, sf));
+  return true;
+}
+
+bool exec_logic_reg(machine_t *m, const decoded_instr_t *d) {
+  bool sf = d->sf;
+  reg a = read_reg(m, d->rn);
+  reg b = read_reg(m, d->rm);
+
+  if (!sf) {
+    a = zero_upper_32(a);
+    b = zero_upper_32(b);
+  }
+
+  if (d->amount)
+    shift(&b, d->shift, d->amount, false, sf);
+
+  if (d->negate) {
+    b = ~b;
+    if (!sf) {
+      b = zero_upper_32(b);
+    }
+  }
+  write_result(m, d, logic(m, a, b, d->opc, sf));
+  return true;
+}
+
+bool exec_cond_select(machine_t *m, const decoded_instr_t *d) {
+  u64 result;
+  if (condition_holds(&m->pstate, d->opc)) {
+    result = read_reg(m, d->rn);
+  } else {
+    result = read_reg(m, d->rm);
+    if (d->negate)
+      result = ~result;
+    result += d->imm;
+  }
+  write_result(m, d, result);
+  return true;
+}
+
+// PRE: Is a register instruction; op0 = x101
+void decode_register(instruction instr, decoded_instr_t *d) {
+  assert(extract_bits_u32(instr, OP0_START_REG, OP0_END_REG) == OP1_REGISTER ||
+         extract_bits_u32(instr, OP0_START_REG, OP0_END_REG) == OP2_REGISTER);
+
+  bool sf = check_bit_u32(instr, SF_BIT_REG);
+  bool is_arith = check_bit_u32(instr, OPR_FIRST_BIT_REG);
+
+  d->sf = sf;
+  d->rd = extract_bits_u32(instr, RD_START_REG, RD_END_REG);
+  d->rn = extract_bits_u32(instr, RN_START_REG, RN_END_REG);
+  d->rm = extract_bits_u32(instr, RM_START_REG, RM_END_REG);
+
+  if (extract_bits_u32(instr, OP_CSEL_START, OP_CSEL_END) ==
+      OP_CSEL_REGISTER) { // conditional select
+    d->opc = extract_bits_u32(instr, COND_START_CSEL, COND_END_CSEL);
+    d->negate = check_bit_u32(instr, NOT_BIT_CSEL);
+    d->imm = check_bit_u32(instr, INC_BIT_CSEL);
+    d->exec = exec_cond_select;
+    return;
+  }
+
   if (check_bit_u32(instr, M_BIT)) { // multiply
     if (extract_bits_u32(instr, OP_M_START, OP_M_END) != OP_M_REGISTER) {
-      fprintf(stderr, "wrong opcode for multiply \n");
-      exit(1);
-    }
-    reg c = read_reg_from_instr(instr, RA_START_REG, RA_END_REG);
-    reg aMb = a * b;
-    if (!sf) {
-      c = zero_upper_32(c);
-      aMb = zero_upper_32(aMb);
+      d->exec = exec_fatal;
+      d->msg = "wrong opcode for multiply \n";
+      return;
     }
+    d->ra = extract_bits_u32(instr, RA_START_REG, RA_END_REG);
     // 2 * X, because x=1 -> 10 (sub); x=0 -> 00 (add)
-    result = arithmetic(c, aMb, extract_bits_u32(instr, X_BIT, X_BIT) << 1, sf);
-  } else { // arithmetic or logic
-    u32 operand = extract_bits_u32(instr, OPERAND_START_REG, OPERAND_END_REG);
-    assert(operand < BITS_WIDTH(sf));
-    // perform shift:
-    if (operand)
-      shift(&b, shift_op, operand, is_arith, sf);
-
-    if (is_arith) { // arithmetic
-      if (negate) { // CHECK: negate should be 0
-        fprintf(stderr, "arith shouldn't be negate - \n");
-        exit(1);
-      }
-      result = arithmetic(a, b, opc, sf);
-
-    } else { // logic
-      if (negate) {
-        b = ~b;
-        if (!sf) {
-          b = zero_upper_32(b);
-        }
-      }
-      result = logic(a, b, opc, sf);
-    }
+    d->opc = extract_bits_u32(instr, X_BIT, X_BIT) << 1;
+    d->exec = exec_multiply;
+    return;
   }
-  if (res_index != REG_COUNT) {
-    machine.regs[res_index] = sf ? result : zero_upper_32(result);
+
+  // arithmetic or logic
+  d->opc = extract_bits_u32(instr, OPC_START_REG, OPC_END_REG);
+  d->shift = extract_bits_u32(instr, SHIFT_START_REG, SHIFT_END_REG);
+  d->amount = extract_bits_u32(instr, OPERAND_START_REG, OPERAND_END_REG);
+  d->negate = check_bit_u32(instr, NEGATE_BIT_REG);
+  assert(d->amount < BITS_WIDTH(sf));
+
+  if (!is_arith) {
+    d->exec = exec_logic_reg;
+  } else if (d->amount && d->shift == OPP_ROR) {
+    d->exec = exec_fatal;
+    d->msg = "no shift 11 for arithmetic (no rotate right)  \n";
+  } else if (d->negate) { // CHECK: negate should be 0
+    d->exec = exec_fatal;
+    d->msg = "arith shouldn't be negate - \n";
+  } else {
+    d->exec = exec_arith_reg;
   }
 }
@@ -1,6 +1,7 @@
 #ifndef REGISTER_INSTRUCION
 #define REGISTER_INSTRUCION
 
+#include "../decode.h"
 #include "../emulate.h"
 #include <stdio.h>
 
@@ -36,6 +37,15 @@
 #define OP_M_END 30
 #define OP_M_START 21
 
+// for conditional select only: S 11010100, so S is checked too
+#define OP_CSEL_REGISTER 0xd4
+#define OP_CSEL_END 29
+#define OP_CSEL_START 21
+#define NOT_BIT_CSEL 30
+#define COND_END_CSEL 15
+#define COND_START_CSEL 12
+#define INC_BIT_CSEL 10
+
 // for arithmetic and logic only:
 #define OPERAND_END_REG 15
 #define OPERAND_START_REG 10
@@ -49,10 +59,19 @@ typedef enum { OPP_ADD, OPP_ADD_FLAGS, OPP_SUB, OPP_SUB_FLAGS } ArithOp;
 typedef enum { OPP_AND, OPP_OR, OPP_XOR, OPP_AND_FLAGS } LogicOp;
 
 /**
- * Executes a register instruction.
+ * Decodes a data processing (register) instruction.
  *
  * @param instr PRE: Is a register instruction; op0 = x101
+ * @param d     The record to fill in.
  */
-void register_execute(instruction instr);
+void decode_register(instruction instr, decoded_instr_t *d);
+
+/* handlers for decoded register instructions, exposed for the block engine */
+bool exec_multiply(machine_t *m, const decoded_instr_t *d);
+bool exec_arith_reg(machine_t *m, const decoded_instr_t *d);
+bool exec_logic_reg(machine_t *m, const decoded_instr_t *d);
+/* CSEL, CSINC, CSINV and CSNEG: opc is the condition, negate inverts rm and
+ * a non-zero imm increments it */
+bool exec_cond_select(machine_t *m, const decoded_instr_t *d);
 
 #endif
@@ -0,0 +1,478 @@
+#include "simd.h"
+#include "../../utils/bits_utils.h"
+#include "../memory.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+
+#define THREE_SAME_MASK 0x9f200400
+#define THREE_SAME_PATTERN 0x0e200400
+#define ACROSS_LANES_MASK 0x9f3e0c00
+#define ACROSS_LANES_PATTERN 0x0e300800
+#define COPY_MASK 0xbfe08400
+#define COPY_PATTERN 0x0e000400
+#define MULTIPLE_MASK 0xbf000000
+#define MULTIPLE_PATTERN 0x0c000000
+
+#define Q_BIT 30
+#define U_BIT 29
+#define POST_INDEX_BIT 23
+#define LOAD_BIT 22
+#define SIZE_END 23
+#define SIZE_START 22
+#define IMM5_END 20
+#define IMM5_START 16
+#define RM_END 20
+#define RM_START 16
+#define OPCODE_END 15
+#define OPCODE_START 11
+#define REDUCE_OPCODE_END 16
+#define REDUCE_OPCODE_START 12
+#define IMM4_END 14
+#define IMM4_START 11
+#define STRUCTURE_OPCODE_END 15
+#define STRUCTURE_OPCODE_START 12
+#define STRUCTURE_SIZE_END 11
+#define STRUCTURE_SIZE_START 10
+#define RN_END 9
+#define RN_START 5
+#define RD_END 4
+#define RD_START 0
+
+/* three same opcodes */
+#define OPCODE_ADD 0x10 /* SUB with U set */
+#define OPCODE_MUL 0x13
+#define OPCODE_LOGIC 0x03 /* size and U pick the operation */
+
+/* across lanes opcodes */
+#define OPCODE_ADDV 0x1b
+#define OPCODE_MAXV 0x0a
+#define OPCODE_MINV 0x1a
+
+/* copy imm4 */
+#define IMM4_DUP 0x1
+#define IMM4_UMOV 0x7
+
+/* ======== lanes ======== */
+
+static inline u64 read_lane(const vreg *v, int index, u8 size) {
+  u64 value = 0;
+  memcpy(&value, v->b + index * size, size);
+  return value;
+}
+
+/* writes rd, zeroing its upper half unless the op was on all 128 bits */
+static inline void write_vreg(machine_t *m, const decoded_instr_t *d,
+                              vreg value) {
+  if (!d->sf)
+    value.d[1] = 0;
+  m->vregs[d->rd] = value;
+}
+
+#ifdef __SSE2__
+static inline __m128i load_lanes(const vreg *v) {
+  return _mm_load_si128((const __m128i *)v->b);
+}
+
+static inline vreg store_lanes(__m128i lanes) {
+  vreg v;
+  _mm_store_si128((__m128i *)v.b, lanes);
+  return v;
+}
+
+static __m128i multiply_lanes(__m128i x, __m128i y, u8 size) {
+  switch (size) {
+  case 1: {
+    /* there is no byte multiply: the even and odd bytes go in 16-bit lanes */
+    __m128i even = _mm_mullo_epi16(x, y);
+    __m128i odd =
+        _mm_mullo_epi16(_mm_srli_epi16(x, 8), _mm_srli_epi16(y, 8));
+    return _mm_or_si128(_mm_and_si128(even, _mm_set1_epi16(0xff)),
+                        _mm_slli_epi16(odd, 8));
+  }
+  case 2:
+    return _mm_mullo_epi16(x, y);
+  default: {
+#ifdef __SSE4_1__
+    return _mm_mullo_epi32(x, y);
+#else
+    /* SSE2 only multiplies the even 32-bit lanes, so the odd ones are moved */
+    __m128i even = _mm_mul_epu32(x, y);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(x, 32), _mm_srli_epi64(y, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+#endif
+  }
+  }
+}
+#else
+typedef enum { LANE_ADD, LANE_SUB, LANE_MUL } lane_op_t;
+
+/* the portable fallback, a lane at a time */
+static vreg lanewise(const vreg *a, const vreg *b, u8 size, lane_op_t op) {
+  vreg r;
+  for (int i = 0; i < (int)sizeof(vreg) / size; i++) {
+    u64 x = read_lane(a, i, size);
+    u64 y = read_lane(b, i, size);
+    u64 z = op == LANE_ADD ? x + y : op == LANE_SUB ? x - y : x * y;
+    memcpy(r.b + i * size, &z, size);
+  }
+  return r;
+}
+#endif
+
+/* ======== data processing ======== */
+
+bool exec_vector_add(machine_t *m, const decoded_instr_t *d) {
+#ifdef __SSE2__
+  __m128i x = load_lanes(&m->vregs[d->rn]);
+  __m128i y = load_lanes(&m->vregs[d->rm]);
+  switch (d->size) {
+  case 1:
+    write_vreg(m, d, store_lanes(_mm_add_epi8(x, y)));
+    break;
+  case 2:
+    write_vreg(m, d, store_lanes(_mm_add_epi16(x, y)));
+    break;
+  case 4:
+    write_vreg(m, d, store_lanes(_mm_add_epi32(x, y)));
+    break;
+  default:
+    write_vreg(m, d, store_lanes(_mm_add_epi64(x, y)));
+    break;
+  }
+#else
+  write_vreg(m, d,
+             lanewise(&m->vregs[d->rn], &m->vregs[d->rm], d->size, LANE_ADD));
+#endif
+  return true;
+}
+
+bool exec_vector_sub(machine_t *m, const decoded_instr_t *d) {
+#ifdef __SSE2__
+  __m128i x = load_lanes(&m->vregs[d->rn]);
+  __m128i y = load_lanes(&m->vregs[d->rm]);
+  switch (d->size) {
+  case 1:
+    write_vreg(m, d, store_lanes(_mm_sub_epi8(x, y)));
+    break;
+  case 2:
+    write_vreg(m, d, store_lanes(_mm_sub_epi16(x, y)));
+    break;
+  case 4:
+    write_vreg(m, d, store_lanes(_mm_sub_epi32(x, y)));
+    break;
+  default:
+    write_vreg(m, d, store_lanes(_mm_sub_epi64(x, y)));
+    break;
+  }
+#else
+  write_vreg(m, d,
+             lanewise(&m->vregs[d->rn], &m->vregs[d->rm], d->size, LANE_SUB));
+#endif
+  return true;
+}
+
+bool exec_vector_mul(machine_t *m, const decoded_instr_t *d) {
+#ifdef __SSE2__
+  write_vreg(m, d,
+             store_lanes(multiply_lanes(load_lanes(&m->vregs[d->rn]),
+                                        load_lanes(&m->vregs[d->rm]),
+                                        d->size)));
+#else
+  write_vreg(m, d,
+             lanewise(&m->vregs[d->rn], &m->vregs[d->rm], d->size, LANE_MUL));
+#endif
+  return true;
+}
+
+bool exec_vector_logic(machine_t *m, const decoded_instr_t *d) {
+#ifdef __SSE2__
+  __m128i x = load_lanes(&m->vregs[d->rn]);
+  __m128i y = load_lanes(&m->vregs[d->rm]);
+  switch (d->opc) {
+  case VECTOR_AND:
+    write_vreg(m, d, store_lanes(_mm_and_si128(x, y)));
+    break;
+  case VECTOR_ORR:
+    write_vreg(m, d, store_lanes(_mm_or_si128(x, y)));
+    break;
+  default:
+    write_vreg(m, d, store_lanes(_mm_xor_si128(x, y)));
+    break;
+  }
+#else
+  const vreg *a = &m->vregs[d->rn];
+  const vreg *b = &m->vregs[d->rm];
+  vreg r;
+  for (int i = 0; i < 2; i++) {
+    r.d[i] = d->opc == VECTOR_AND   ? a->d[i] & b->d[i]
+             : d->opc == VECTOR_ORR ? a->d[i] | b->d[i]
+                                    : a->d[i] ^ b->d[i];
+  }
+  write_vreg(m, d, r);
+#endif
+  return true;
+}
+
+/* the result is a scalar, the rest of rd is zeroed */
+bool exec_vector_reduce(machine_t *m, const decoded_instr_t *d) {
+  const vreg *v = &m->vregs[d->rn];
+  int lanes = (d->sf ? 16 : 8) / d->size;
+  int bits = 8 * d->size;
+  u64 result = read_lane(v, 0, d->size);
+  for (int i = 1; i < lanes; i++) {
+    u64 lane = read_lane(v, i, d->size);
+    switch (d->opc) {
+    case VECTOR_ADDV:
+      result += lane;
+      break;
+    case VECTOR_SMAXV:
+      if (sign_extend(lane, bits) > sign_extend(result, bits))
+        result = lane;
+      break;
+    case VECTOR_SMINV:
+      if (sign_extend(lane, bits) < sign_extend(result, bits))
+        result = lane;
+      break;
+    case VECTOR_UMAXV:
+      if (lane > result)
+        result = lane;
+      break;
+    default:
+      if (lane < result)
+        result = lane;
+      break;
+    }
+  }
+  vreg r = {0};
+  memcpy(r.b, &result, d->size);
+  m->vregs[d->rd] = r;
+  return true;
+}
+
+bool exec_vector_dup(machine_t *m, const decoded_instr_t *d) {
+  u64 value = d->rn < REG_COUNT ? m->regs[d->rn] : ZR;
+#ifdef __SSE2__
+  switch (d->size) {
+  case 1:
+    write_vreg(m, d, store_lanes(_mm_set1_epi8((char)value)));
+    break;
+  case 2:
+    write_vreg(m, d, store_lanes(_mm_set1_epi16((short)value)));
+    break;
+  case 4:
+    write_vreg(m, d, store_lanes(_mm_set1_epi32((int)value)));
+    break;
+  default:
+    write_vreg(m, d, store_lanes(_mm_set1_epi64x((long long)value)));
+    break;
+  }
+#else
+  vreg r;
+  for (int i = 0; i < (int)sizeof(vreg); i += d->size)
+    memcpy(r.b + i, &value, d->size);
+  write_vreg(m, d, r);
+#endif
+  return true;
+}
+
+bool exec_vector_move(machine_t *m, const decoded_instr_t *d) {
+  if (d->rd < REG_COUNT)
+    m->regs[d->rd] = read_lane(&m->vregs[d->rn], d->amount, d->size);
+  return true;
+}
+
+/* ======== loads and stores ======== */
+
+/* the base register moves on past what was accessed, by Xm if one is given */
+static void write_back(machine_t *m, const decoded_instr_t *d, u64 address) {
+  if (!d->opc || d->rn >= REG_COUNT)
+    return;
+  m->regs[d->rn] = address + (d->rm < REG_COUNT ? m->regs[d->rm] : d->imm);
+}
+
+bool exec_vector_load(machine_t *m, const decoded_instr_t *d) {
+  u64 address = d->rn < REG_COUNT ? m->regs[d->rn] : ZR;
+  u64 bytes = d->sf ? 16 : 8;
+  vreg loaded[4] = {0};
+  for (int i = 0; i < d->amount; i++) {
+    u64 at = address + i * bytes;
+    if (d->sf)
+      memory_load_pair(m, at, 8, &loaded[i].d[0], &loaded[i].d[1]);
+    else
+      loaded[i].d[0] = memory_load(m, at, 8);
+  }
+  /* nothing is written unless every load went through */
+  for (int i = 0; i < d->amount; i++)
+    m->vregs[(d->rd + i) % VREG_COUNT] = loaded[i];
+  write_back(m, d, address);
+  return true;
+}
+
+bool exec_vector_store(machine_t *m, const decoded_instr_t *d) {
+  u64 address = d->rn < REG_COUNT ? m->regs[d->rn] : ZR;
+  u64 bytes = d->sf ? 16 : 8;
+  for (int i = 0; i < d->amount; i++) {
+    const vreg *v = &m->vregs[(d->rd + i) % VREG_COUNT];
+    u64 at = address + i * bytes;
+    if (d->sf)
+      memory_store_pair(m, at, v->d[0], v->d[1], 8);
+    else
+      memory_store(m, at, v->d[0], 8);
+  }
+  write_back(m, d, address);
+  return true;
+}
+
+/* ======== decoding ======== */
+
+static bool decode_three_same(instruction instr, decoded_instr_t *d) {
+  u32 size = extract_bits_u32(instr, SIZE_START, SIZE_END);
+  bool u = check_bit_u32(instr, U_BIT);
+  switch (extract_bits_u32(instr, OPCODE_START, OPCODE_END)) {
+  case OPCODE_ADD:
+    if (size == 3 && !d->sf)
+      return false;
+    d->exec = u ? exec_vector_sub : exec_vector_add;
+    return true;
+  case OPCODE_MUL:
+    if (u || size == 3)
+      return false;
+    d->exec = exec_vector_mul;
+    return true;
+  case OPCODE_LOGIC:
+    if (!u && size == 0)
+      d->opc = VECTOR_AND;
+    else if (!u && size == 2)
+      d->opc = VECTOR_ORR;
+    else if (u && size == 0)
+      d->opc = VECTOR_EOR;
+    else
+      return false; /* BIC, ORN and the bitwise selects */
+    d->exec = exec_vector_logic;
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool decode_across_lanes(instruction instr, decoded_instr_t *d) {
+  u32 size = extract_bits_u32(instr, SIZE_START, SIZE_END);
+  bool u = check_bit_u32(instr, U_BIT);
+  /* there are no 64-bit lanes to reduce, nor pairs of 32-bit ones */
+  if (size == 3 || (size == 2 && !d->sf))
+    return false;
+  switch (extract_bits_u32(instr, REDUCE_OPCODE_START, REDUCE_OPCODE_END)) {
+  case OPCODE_ADDV:
+    if (u)
+      return false;
+    d->opc = VECTOR_ADDV;
+    break;
+  case OPCODE_MAXV:
+    d->opc = u ? VECTOR_UMAXV : VECTOR_SMAXV;
+    break;
+  case OPCODE_MINV:
+    d->opc = u ? VECTOR_UMINV : VECTOR_SMINV;
+    break;
+  default:
+    return false;
+  }
+  d->exec = exec_vector_reduce;
+  return true;
+}
+
+static bool decode_copy(instruction instr, decoded_instr_t *d) {
+  /* the lowest set bit of imm5 is the lane size, the bits above the index */
+  u32 imm5 = extract_bits_u32(instr, IMM5_START, IMM5_END);
+  u32 size = 0;
+  while (size < 4 && !((imm5 >> size) & 1))
+    size++;
+  if (size == 4)
+    return false;
+  d->size = 1 << size;
+
+  switch (extract_bits_u32(instr, IMM4_START, IMM4_END)) {
+  case IMM4_DUP:
+    if (size == 3 && !d->sf)
+      return false;
+    d->exec = exec_vector_dup;
+    return true;
+  case IMM4_UMOV:
+    /* Xd for 64-bit lanes, Wd for the others */
+    if (d->sf != (size == 3))
+      return false;
+    d->amount = imm5 >> (size + 1);
+    d->exec = exec_vector_move;
+    return true;
+  default:
+    return false;
+  }
+}
+
+void decode_simd(instruction instr, decoded_instr_t *d) {
+  d->rd = extract_bits_u32(instr, RD_START, RD_END);
+  d->rn = extract_bits_u32(instr, RN_START, RN_END);
+  d->rm = extract_bits_u32(instr, RM_START, RM_END);
+  d->sf = check_bit_u32(instr, Q_BIT);
+  d->size = 1 << extract_bits_u32(instr, SIZE_START, SIZE_END);
+
+  bool decoded = false;
+  if ((instr & THREE_SAME_MASK) == THREE_SAME_PATTERN)
+    decoded = decode_three_same(instr, d);
+  else if ((instr & ACROSS_LANES_MASK) == ACROSS_LANES_PATTERN)
+    decoded = decode_across_lanes(instr, d);
+  else if ((instr & COPY_MASK) == COPY_PATTERN)
+    decoded = decode_copy(instr, d);
+
+  if (!decoded) {
+    d->exec = exec_invalid;
+    d->msg = "Unsupported SIMD instruction\n";
+  }
+}
+
+/* number of registers moved, by the opcode of LD1 and ST1, or 0 */
+static int structure_registers(u32 opcode) {
+  switch (opcode) {
+  case 0x7:
+    return 1;
+  case 0xa:
+    return 2;
+  case 0x6:
+    return 3;
+  case 0x2:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+void decode_simd_load_store(instruction instr, decoded_instr_t *d) {
+  d->rd = extract_bits_u32(instr, RD_START, RD_END);
+  d->rn = extract_bits_u32(instr, RN_START, RN_END);
+  d->rm = extract_bits_u32(instr, RM_START, RM_END);
+  d->sf = check_bit_u32(instr, Q_BIT);
+  d->size = 1 << extract_bits_u32(instr, STRUCTURE_SIZE_START,
+                                  STRUCTURE_SIZE_END);
+  d->opc = check_bit_u32(instr, POST_INDEX_BIT);
+
+  int count = structure_registers(
+      extract_bits_u32(instr, STRUCTURE_OPCODE_START, STRUCTURE_OPCODE_END));
+  /* without post-index, instr[21-16] must be zero, with it only instr[21] */
+  u32 unused = d->opc ? check_bit_u32(instr, 21)
+                      : extract_bits_u32(instr, RM_START, 21);
+  if ((instr & MULTIPLE_MASK) != MULTIPLE_PATTERN || count == 0 || unused) {
+    /* single structures, LD2 to LD4 and the scalar registers */
+    d->exec = exec_invalid;
+    d->msg = "Unsupported SIMD load/store\n";
+    return;
+  }
+  d->amount = count;
+  d->imm = count * (d->sf ? 16 : 8);
+  d->exec = check_bit_u32(instr, LOAD_BIT) ? exec_vector_load
+                                           : exec_vector_store;
+}
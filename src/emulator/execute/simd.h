@@ -0,0 +1,65 @@
+#ifndef SIMD
+#define SIMD
+
+#include "../decode.h"
+#include "../emulate.h"
+/*
+ * A subset of AdvSIMD on the 128-bit V registers. Data processing has
+ * op0 = x111, with instr[31] = 0 and instr[28-24] = 01110:
+ *   three same:   0 Q U 01110 size 1 Rm opcode 1 Rn Rd
+ *                 ADD, SUB, MUL and the bitwise AND, ORR and EOR
+ *   across lanes: 0 Q U 01110 size 11000 opcode 10 Rn Rd
+ *                 ADDV, SMAXV, SMINV, UMAXV and UMINV
+ *   copy:         0 Q 0 01110000 imm5 0 imm4 1 Rn Rd
+ *                 DUP from a general purpose register and UMOV
+ * Loads and stores have op0 = x110, the V bit set:
+ *   multiple structures: 0 Q 001100 P L 0 Rm opcode size Rn Rt
+ *                        LD1 and ST1 of one to four registers, P is set for
+ *                        post-index by Rm, or by the size moved if Rm = 31
+ *
+ * Q selects all 128 bits rather than the lower 64, which then leaves the
+ * upper half of the destination zero. Lanes are computed with SSE2 where the
+ * host has it, and one at a time otherwise.
+ */
+
+/* vector instruction operations, in decoded_instr_t.opc */
+typedef enum { VECTOR_AND, VECTOR_ORR, VECTOR_EOR } vector_logic_t;
+typedef enum {
+  VECTOR_ADDV,
+  VECTOR_SMAXV,
+  VECTOR_SMINV,
+  VECTOR_UMAXV,
+  VECTOR_UMINV
+} vector_reduce_t;
+
+/**
+ * Decodes a SIMD data processing instruction.
+ *
+ * @param instr PRE: op0 = x111
+ * @param d     The record to fill in, size is the bytes per lane, sf is Q.
+ */
+void decode_simd(instruction instr, decoded_instr_t *d);
+
+/**
+ * Decodes a load or store of SIMD registers.
+ *
+ * @param instr PRE: op0 = x110
+ * @param d     The record to fill in, amount is the number of registers, opc
+ *              is set for post-index and imm is the bytes moved.
+ */
+void decode_simd_load_store(instruction instr, decoded_instr_t *d);
+
+/* handlers for decoded vector instructions, exposed for the block engine */
+bool exec_vector_add(machine_t *m, const decoded_instr_t *d);
+bool exec_vector_sub(machine_t *m, const decoded_instr_t *d);
+bool exec_vector_mul(machine_t *m, const decoded_instr_t *d);
+bool exec_vector_logic(machine_t *m, const decoded_instr_t *d);
+bool exec_vector_reduce(machine_t *m, const decoded_instr_t *d);
+/* DUP reads the general purpose register rn */
+bool exec_vector_dup(machine_t *m, const decoded_instr_t *d);
+/* UMOV writes the general purpose register rd */
+bool exec_vector_move(machine_t *m, const decoded_instr_t *d);
+bool exec_vector_load(machine_t *m, const decoded_instr_t *d);
+bool exec_vector_store(machine_t *m, const decoded_instr_t *d);
+
+#endif /* SIMD */
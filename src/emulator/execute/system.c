@@ -0,0 +1,69 @@
+#include "system.h"
+
+#define SYSTEM_PATTERN 0x354 /* instr[31-22] */
+
+#define HINT_MASK 0xfffff01f
+#define HINT_PATTERN 0xd503201f
+#define BARRIER_MASK 0xfffff0ff
+#define CLREX_PATTERN 0xd503305f
+#define DSB_PATTERN 0xd503309f
+#define DMB_PATTERN 0xd50330bf
+#define ISB_PATTERN 0xd50330df
+#define MRS_MPIDR_MASK 0xffffffe0
+#define MRS_MPIDR_PATTERN 0xd53800a0
+
+/* MPIDR_EL1 has bit 31 set, and the core number in Aff0 */
+#define MPIDR_RES1 0x80000000
+
+bool system_instr(instruction instr) { return (instr >> 22) == SYSTEM_PATTERN; }
+
+/*
+ * Plain guest loads and stores are host loads and stores, so a full host fence
+ * orders them as strongly as any of the guest barriers.
+ */
+bool exec_barrier(machine_t *m, const decoded_instr_t *d) {
+  (void)m;
+  (void)d;
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  return true;
+}
+
+bool exec_clear_exclusive(machine_t *m, const decoded_instr_t *d) {
+  (void)d;
+  m->exclusive_address = EXCLUSIVE_NONE;
+  return true;
+}
+
+bool exec_read_core_id(machine_t *m, const decoded_instr_t *d) {
+  if (d->rd < REG_COUNT)
+    m->regs[d->rd] = MPIDR_RES1 | m->core_id;
+  return true;
+}
+
+void decode_system(instruction instr, decoded_instr_t *d) {
+  if ((instr & HINT_MASK) == HINT_PATTERN) {
+    /* hints may be ignored: WFE and YIELD in a spin loop just spin */
+    d->exec = exec_nop;
+    return;
+  }
+
+  switch (instr & BARRIER_MASK) {
+  case DSB_PATTERN:
+  case DMB_PATTERN:
+  case ISB_PATTERN:
+    d->exec = exec_barrier;
+    return;
+  case CLREX_PATTERN:
+    d->exec = exec_clear_exclusive;
+    return;
+  }
+
+  if ((instr & MRS_MPIDR_MASK) == MRS_MPIDR_PATTERN) {
+    d->rd = instr & 0x1f;
+    d->exec = exec_read_core_id;
+    return;
+  }
+
+  d->exec = exec_invalid;
+  d->msg = "Unsupported system instruction\n";
+}
@@ -0,0 +1,31 @@
+#ifndef SYSTEM
+#define SYSTEM
+
+#include "../decode.h"
+#include "../emulate.h"
+/*
+ * System instructions share op0 = 101x with the branches:
+ * instr[31-22] = 1101010100
+ * Supported are the hints (NOP, YIELD, WFE, ...), which do nothing, the
+ * barriers DMB, DSB and ISB, CLREX, and reading MPIDR_EL1 with MRS.
+ */
+
+/**
+ * Checks whether an instruction is a system instruction.
+ */
+bool system_instr(instruction instr);
+
+/**
+ * Decodes a system instruction.
+ *
+ * @param instr PRE: system_instr(instr)
+ * @param d     The record to fill in.
+ */
+void decode_system(instruction instr, decoded_instr_t *d);
+
+/* handlers for decoded system instructions */
+bool exec_barrier(machine_t *m, const decoded_instr_t *d);
+bool exec_clear_exclusive(machine_t *m, const decoded_instr_t *d);
+bool exec_read_core_id(machine_t *m, const decoded_instr_t *d);
+
+#endif /* SYSTEM */
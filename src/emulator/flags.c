@@ -0,0 +1,77 @@
+#include "flags.h"
+#include "../utils/bits_utils.h"
+#include <stdint.h>
+
+#define MSB_64 63
+#define MSB_32 31
+
+/* the value of one condition for the flags nzcv */
+#define N(nzcv) (((nzcv) >> 3) & 1)
+#define Z(nzcv) (((nzcv) >> 2) & 1)
+#define C(nzcv) (((nzcv) >> 1) & 1)
+#define V(nzcv) ((nzcv) & 1)
+#define EQ(nzcv) Z(nzcv)
+#define CS(nzcv) C(nzcv)
+#define MI(nzcv) N(nzcv)
+#define VS(nzcv) V(nzcv)
+#define HI(nzcv) (C(nzcv) && !Z(nzcv))
+#define GE(nzcv) (N(nzcv) == V(nzcv))
+#define GT(nzcv) (!Z(nzcv) && N(nzcv) == V(nzcv))
+#define AL(nzcv) 1
+
+/* the truth table of one condition over all 16 values of nzcv */
+#define ROW(f)                                                                 \
+  (u16)(f(0) << 0 | f(1) << 1 | f(2) << 2 | f(3) << 3 | f(4) << 4 |           \
+        f(5) << 5 | f(6) << 6 | f(7) << 7 | f(8) << 8 | f(9) << 9 |           \
+        f(10) << 10 | f(11) << 11 | f(12) << 12 | f(13) << 13 |               \
+        f(14) << 14 | f(15) << 15)
+
+/* odd conditions are the inverse of the one before, except NV */
+#define INVERSE(f) (u16) ~ROW(f)
+
+const u16 condition_table[COND_COUNT] = {
+    [COND_EQ] = ROW(EQ), [COND_NE] = INVERSE(EQ),
+    [COND_CS] = ROW(CS), [COND_CC] = INVERSE(CS),
+    [COND_MI] = ROW(MI), [COND_PL] = INVERSE(MI),
+    [COND_VS] = ROW(VS), [COND_VC] = INVERSE(VS),
+    [COND_HI] = ROW(HI), [COND_LS] = INVERSE(HI),
+    [COND_GE] = ROW(GE), [COND_LT] = INVERSE(GE),
+    [COND_GT] = ROW(GT), [COND_LE] = INVERSE(GT),
+    [COND_AL] = ROW(AL), [COND_NV] = ROW(AL)};
+
+void materialise_flags(PSTATE *p) {
+  bool c = false, v = false;
+  u64 lhs = p->lhs;
+  u64 operand = p->operand;
+  u64 result = p->result;
+  bool sf = p->sf;
+
+  switch (p->pending) {
+  case FLAGS_NONE:
+    return;
+  case FLAGS_ADD:
+    c = (lhs > (sf ? UINT64_MAX - operand : UINT32_MAX - operand));
+    v = (sf ? ((i64)lhs > 0 && (i64)operand > 0 && (i64)result < 0) ||
+                  ((i64)lhs < 0 && (i64)operand < 0 && (i64)result > 0)
+            : ((i32)lhs > 0 && (i32)operand > 0 && (i32)result < 0) ||
+                  ((i32)lhs < 0 && (i32)operand < 0 && (i32)result > 0));
+    break;
+  case FLAGS_SUB:
+    c = (lhs >= operand);
+    v = (sf ? ((i64)lhs > 0 && (i64)operand < 0 && (i64)result < 0) ||
+                  ((i64)lhs < 0 && (i64)operand > 0 && (i64)result > 0)
+            : ((i32)lhs > 0 && (i32)operand < 0 && (i32)result < 0) ||
+                  ((i32)lhs < 0 && (i32)operand > 0 && (i32)result > 0));
+    break;
+  case FLAGS_LOGIC:
+    c = 0;
+    v = 0;
+    break;
+  }
+
+  bool n = check_bit_u64(result, sf ? MSB_64 : MSB_32);
+  bool z = (sf ? result == 0 : zero_upper_32(result) == 0);
+  p->nzcv = (n ? FLAG_N : 0) | (z ? FLAG_Z : 0) | (c ? FLAG_C : 0) |
+            (v ? FLAG_V : 0);
+  p->pending = FLAGS_NONE;
+}
@@ -0,0 +1,108 @@
+#ifndef FLAGS
+#define FLAGS
+
+#include "../defs.h"
+#include "emulate.h"
+#include <stdbool.h>
+
+/*
+ * NZCV is evaluated lazily: flag-setting instructions only record their
+ * operands and result in PSTATE, and the flags are worked out from the record
+ * the first time something reads them. Most flag results are overwritten
+ * before any conditional branch looks at them.
+ *
+ * Once worked out, the flags are packed into one nibble, laid out as in the
+ * NZCV system register. Conditions are looked up in a table of which of the
+ * 16 possible nibbles satisfy them, rather than tested flag by flag.
+ */
+
+#define FLAG_N 0x8
+#define FLAG_Z 0x4
+#define FLAG_C 0x2
+#define FLAG_V 0x1
+
+/* AArch64 condition encodings, each odd one is the inverse of the one before */
+typedef enum {
+  COND_EQ,
+  COND_NE,
+  COND_CS,
+  COND_CC,
+  COND_MI,
+  COND_PL,
+  COND_VS,
+  COND_VC,
+  COND_HI,
+  COND_LS,
+  COND_GE,
+  COND_LT,
+  COND_GT,
+  COND_LE,
+  COND_AL,
+  COND_NV, /* behaves as AL */
+  COND_COUNT
+} condition_t;
+
+/* bit nzcv of condition_table[cond] is set if cond holds for those flags */
+extern const u16 condition_table[COND_COUNT];
+
+/**
+ * Records an addition or subtraction as the source of the flags.
+ *
+ * @param p       The PSTATE to update.
+ * @param lhs     The first operand.
+ * @param operand The second operand.
+ * @param result  lhs + operand, or lhs - operand if is_sub.
+ * @param is_sub  Whether the operation was a subtraction.
+ * @param sf      Whether the operation was 64-bit.
+ */
+static inline void record_arith_flags(PSTATE *p, u64 lhs, u64 operand,
+                                      u64 result, bool is_sub, bool sf) {
+  p->pending = is_sub ? FLAGS_SUB : FLAGS_ADD;
+  p->sf = sf;
+  p->lhs = lhs;
+  p->operand = operand;
+  p->result = result;
+}
+
+/**
+ * Records a logical operation as the source of the flags.
+ *
+ * @param p      The PSTATE to update.
+ * @param result The result of the operation.
+ * @param sf     Whether the operation was 64-bit.
+ */
+static inline void record_logic_flags(PSTATE *p, u64 result, bool sf) {
+  p->pending = FLAGS_LOGIC;
+  p->sf = sf;
+  p->result = result;
+}
+
+/**
+ * Brings N, Z, C and V up to date with the last flag-setting operation.
+ * Must be called before reading any of them.
+ */
+void materialise_flags(PSTATE *p);
+
+/**
+ * Returns the Z flag, without materialising the others.
+ */
+static inline bool flags_zero(const PSTATE *p) {
+  if (p->pending == FLAGS_NONE)
+    return p->nzcv & FLAG_Z;
+  return p->sf ? p->result == 0 : (u32)p->result == 0;
+}
+
+/**
+ * Returns whether a condition holds. EQ and NE only need Z, the other
+ * conditions materialise all the flags.
+ *
+ * @param cond PRE: A condition_t.
+ */
+static inline bool condition_holds(PSTATE *p, u8 cond) {
+  if (cond <= COND_NE)
+    return flags_zero(p) != (cond & 1);
+  materialise_flags(p);
+  return (condition_table[cond] >> p->nzcv) & 1;
+}
+
+#endif /* FLAGS */
@@ -0,0 +1,79 @@
+#include "hooks.h"
+#include "execute/branches.h"
+#include "memory.h"
+#include <stdlib.h>
+
+struct hooks {
+  const machine_hooks_t *attached[HOOKS_MAX];
+  int count;
+  bool executing; /* between hooks_begin and the end of the instruction */
+};
+
+/* calls the callback named event of every attached set that has one */
+#define RAISE(m, event, ...)                                                   \
+  do {                                                                         \
+    struct hooks *h = (m)->hooks;                                              \
+    for (int i = 0; i < h->count; i++) {                                       \
+      if (h->attached[i]->event != NULL)                                       \
+        h->attached[i]->event(h->attached[i]->ctx, (m), __VA_ARGS__);          \
+    }                                                                          \
+  } while (0)
+
+bool hooks_attach(machine_t *m, const machine_hooks_t *hooks) {
+  if (m->hooks == NULL) {
+    m->hooks = calloc(1, sizeof(struct hooks));
+    if (m->hooks == NULL)
+      return false;
+    /* pages already in the TLB would bypass the memory hooks */
+    memory_flush_tlb(m);
+  }
+  if (m->hooks->count == HOOKS_MAX)
+    return false;
+  m->hooks->attached[m->hooks->count++] = hooks;
+  return true;
+}
+
+void hooks_detach(machine_t *m, const machine_hooks_t *hooks) {
+  struct hooks *h = m->hooks;
+  if (h == NULL)
+    return;
+  for (int i = 0; i < h->count; i++) {
+    if (h->attached[i] == hooks) {
+      /* keep the rest in the order they were attached */
+      for (h->count--; i < h->count; i++)
+        h->attached[i] = h->attached[i + 1];
+      break;
+    }
+  }
+  if (h->count == 0)
+    hooks_destroy(m);
+}
+
+void hooks_destroy(machine_t *m) {
+  free(m->hooks);
+  m->hooks = NULL;
+}
+
+void hooks_begin(machine_t *m) { m->hooks->executing = true; }
+
+void hooks_retire(machine_t *m, reg pc, const decoded_instr_t *d) {
+  m->hooks->executing = false;
+  if (branch_taken(m, d))
+    RAISE(m, branch, pc, m->PC);
+  RAISE(m, retire, pc, d);
+}
+
+void hooks_halt(machine_t *m, reg pc) {
+  m->hooks->executing = false;
+  RAISE(m, halt, pc);
+}
+
+void hooks_mem_read(machine_t *m, u64 address, u64 value, int num_bytes) {
+  if (m->hooks->executing)
+    RAISE(m, mem_read, address, value, num_bytes);
+}
+
+void hooks_mem_write(machine_t *m, u64 address, u64 value, int num_bytes) {
+  if (m->hooks->executing)
+    RAISE(m, mem_write, address, value, num_bytes);
+}
@@ -0,0 +1,75 @@
+#ifndef HOOKS
+#define HOOKS
+
+#include "../defs.h"
+#include "decode.h"
+#include "emulate.h"
+
+/*
+ * Callbacks that tools such as tracers, coverage collectors or cache
+ * simulators attach to a machine to watch it run.
+ *
+ * A machine without hooks runs exactly as before: run_machine looks at
+ * m->hooks once and only takes the instrumented path if some are attached.
+ * That path single steps through a copy of the step loop specialised at
+ * compile time, and bypasses the TLB so every load and store reaches the slow
+ * paths of memory.h, where they are reported.
+ */
+
+/* tools attached to one machine at the same time */
+#define HOOKS_MAX 8
+
+/*
+ * Any callback may be NULL, ctx is passed back to each of them. Callbacks must
+ * not attach or detach hooks.
+ */
+typedef struct {
+  /* an instruction at pc has run, m->PC is the address of the next one */
+  void (*retire)(void *ctx, machine_t *m, reg pc, const decoded_instr_t *d);
+  /* an instruction read or wrote num_bytes of guest memory */
+  void (*mem_read)(void *ctx, machine_t *m, u64 address, u64 value,
+                   int num_bytes);
+  void (*mem_write)(void *ctx, machine_t *m, u64 address, u64 value,
+                    int num_bytes);
+  /* a taken branch at from, even one to from + 4, called before retire */
+  void (*branch)(void *ctx, machine_t *m, reg from, reg to);
+  /* the instruction at pc stopped the machine, it is not retired */
+  void (*halt)(void *ctx, machine_t *m, reg pc);
+  void *ctx;
+} machine_hooks_t;
+
+/**
+ * Attaches a set of hooks to a machine, after any already attached.
+ *
+ * @param hooks Must stay valid until it is detached.
+ * @return false if HOOKS_MAX sets are already attached or memory ran out.
+ */
+bool hooks_attach(machine_t *m, const machine_hooks_t *hooks);
+
+/**
+ * Detaches a set of hooks, if it is attached. Once the last one is gone the
+ * machine runs uninstrumented again.
+ */
+void hooks_detach(machine_t *m, const machine_hooks_t *hooks);
+
+/**
+ * Detaches every set of hooks.
+ */
+void hooks_destroy(machine_t *m);
+
+/*
+ * Events, raised by the instrumented step loop and the memory slow paths.
+ * PRE: m->hooks != NULL.
+ */
+
+/**
+ * Marks the start of an instruction, memory accesses are only reported
+ * between this and its retirement or halt (so fetches are not).
+ */
+void hooks_begin(machine_t *m);
+void hooks_retire(machine_t *m, reg pc, const decoded_instr_t *d);
+void hooks_halt(machine_t *m, reg pc);
+void hooks_mem_read(machine_t *m, u64 address, u64 value, int num_bytes);
+void hooks_mem_write(machine_t *m, u64 address, u64 value, int num_bytes);
+
+#endif /* HOOKS */
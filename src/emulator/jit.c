@@ -0,0 +1,813 @@
+#include "jit.h"
+#include "block.h"
+#include "decode.h"
+#include "emulate.h"
+#include "flags.h"
+#include "execute/load_store.h"
+#include "execute/register_instruction.h"
+#include "execute/simd.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+struct jit {
+  u8 *code;         /* JIT_CODE_SIZE bytes of executable memory */
+  size_t code_used; /* bytes of it holding compiled blocks */
+};
+
+#if defined(__x86_64__)
+
+/*
+ * Compiles translated blocks to x86-64. Every guest instruction is emitted as
+ * a short load/compute/store sequence on scratch registers, with the most used
+ * guest registers of the block held in callee-saved host registers for the
+ * whole block. Flags are recorded for lazy evaluation exactly as the
+ * interpreter does, and memory accesses call the interpreter handlers, so the
+ * compiled code can never disagree with it.
+ *
+ * Register usage inside compiled code:
+ *   rbp            machine_t *
+ *   rbx, r12-r15   cached guest registers
+ *   rax, rcx, rdx  scratch
+ *   rdi, rsi, r8   arguments to helper calls
+ */
+
+enum {
+  RAX,
+  RCX,
+  RDX,
+  RBX,
+  RSP,
+  RBP,
+  RSI,
+  RDI,
+  R8,
+  R9,
+  R10,
+  R11,
+  R12,
+  R13,
+  R14,
+  R15
+};
+
+/* x86 condition codes, as used by jcc and setcc */
+enum { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_LE = 0xe };
+
+typedef enum { ALU_ADD, ALU_OR, ALU_AND, ALU_SUB, ALU_XOR, ALU_CMP } alu_op_t;
+static const u8 alu_opcodes[] = {0x01, 0x09, 0x21, 0x29, 0x31, 0x39};
+static const u8 alu_digits[] = {0, 1, 4, 5, 6, 7};
+
+/* /digit of the shift group, indexed by ShiftOp */
+static const u8 shift_digits[] = {[OPP_LSL] = 4,
+                                  [OPP_LSR] = 5,
+                                  [OPP_ASR] = 7,
+                                  [OPP_ROR] = 1};
+
+#define MACHINE_REG RBP
+#define CACHED_REGS 5
+static const u8 cache_hosts[CACHED_REGS] = {RBX, R12, R13, R14, R15};
+
+#define REG_OFFSET(g) ((i32)(offsetof(machine_t, regs) + (g) * sizeof(reg)))
+#define PC_OFFSET ((i32)offsetof(machine_t, PC))
+#define FLAG_OFFSET(f) ((i32)offsetof(machine_t, pstate.f))
+#define INTERRUPTED_OFFSET ((i32)offsetof(machine_t, interrupted))
+#define BUDGET_OFFSET ((i32)offsetof(machine_t, budget))
+
+#define MAX_EPILOGUE_JUMPS (4 * BLOCK_MAX_INSTRS + 4)
+
+typedef struct {
+  u8 *p;                    /* next byte to emit */
+  i8 host[REG_COUNT];       /* host register caching a guest one, or -1 */
+  bool written[REG_COUNT];  /* guest registers the block may write */
+  u8 *loop_start;           /* first instruction, for blocks looping on
+                               themselves */
+  bool shared;              /* other cores run too, see cores.h */
+  i8 flags_sf; /* width of the last flag-setting op so far, -1 if none */
+  u8 *epilogue_jumps[MAX_EPILOGUE_JUMPS]; /* rel32 fields to patch */
+  int epilogue_jump_count;
+} jit_ctx_t;
+
+/* ======== x86-64 encoding ======== */
+
+static void emit8(jit_ctx_t *c, u8 byte) { *c->p++ = byte; }
+
+static void emit32(jit_ctx_t *c, u32 value) {
+  memcpy(c->p, &value, sizeof(value));
+  c->p += sizeof(value);
+}
+
+static void emit64(jit_ctx_t *c, u64 value) {
+  memcpy(c->p, &value, sizeof(value));
+  c->p += sizeof(value);
+}
+
+/* REX prefix, omitted when it would be empty */
+static void emit_rex(jit_ctx_t *c, bool w, int reg, int rm) {
+  u8 rex = 0x40 | (w << 3) | (((reg >> 3) & 1) << 2) | ((rm >> 3) & 1);
+  if (rex != 0x40)
+    emit8(c, rex);
+}
+
+static void emit_modrm_reg(jit_ctx_t *c, int reg, int rm) {
+  emit8(c, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* [rbp + disp32] */
+static void emit_modrm_machine(jit_ctx_t *c, int reg, i32 disp) {
+  emit8(c, 0x80 | ((reg & 7) << 3) | (MACHINE_REG & 7));
+  emit32(c, (u32)disp);
+}
+
+/* mov dst, src (32-bit moves zero the upper half) */
+static void emit_mov_rr(jit_ctx_t *c, bool w, int dst, int src) {
+  emit_rex(c, w, src, dst);
+  emit8(c, 0x89);
+  emit_modrm_reg(c, src, dst);
+}
+
+/* mov dst, [rbp + disp] */
+static void emit_load(jit_ctx_t *c, bool w, int dst, i32 disp) {
+  emit_rex(c, w, dst, MACHINE_REG);
+  emit8(c, 0x8b);
+  emit_modrm_machine(c, dst, disp);
+}
+
+/* mov [rbp + disp], src */
+static void emit_store(jit_ctx_t *c, bool w, int src, i32 disp) {
+  emit_rex(c, w, src, MACHINE_REG);
+  emit8(c, 0x89);
+  emit_modrm_machine(c, src, disp);
+}
+
+static void emit_mov_imm(jit_ctx_t *c, int dst, u64 imm) {
+  if (imm <= UINT32_MAX) {
+    emit_rex(c, false, 0, dst);
+    emit8(c, 0xb8 + (dst & 7));
+    emit32(c, (u32)imm);
+  } else {
+    emit_rex(c, true, 0, dst);
+    emit8(c, 0xb8 + (dst & 7));
+    emit64(c, imm);
+  }
+}
+
+/* op dst, src */
+static void emit_alu_rr(jit_ctx_t *c, bool w, alu_op_t op, int dst, int src) {
+  emit_rex(c, w, src, dst);
+  emit8(c, alu_opcodes[op]);
+  emit_modrm_reg(c, src, dst);
+}
+
+/* op dst, imm32 (sign extended for 64-bit operations) */
+static void emit_alu_ri(jit_ctx_t *c, bool w, alu_op_t op, int dst, i32 imm) {
+  emit_rex(c, w, 0, dst);
+  emit8(c, 0x81);
+  emit_modrm_reg(c, alu_digits[op], dst);
+  emit32(c, (u32)imm);
+}
+
+static void emit_shift_ri(jit_ctx_t *c, bool w, ShiftOp op, int dst, u8 n) {
+  emit_rex(c, w, 0, dst);
+  emit8(c, 0xc1);
+  emit_modrm_reg(c, shift_digits[op], dst);
+  emit8(c, n);
+}
+
+static void emit_not(jit_ctx_t *c, bool w, int dst) {
+  emit_rex(c, w, 0, dst);
+  emit8(c, 0xf7);
+  emit_modrm_reg(c, 2, dst);
+}
+
+/* imul dst, src */
+static void emit_imul_rr(jit_ctx_t *c, bool w, int dst, int src) {
+  emit_rex(c, w, dst, src);
+  emit8(c, 0x0f);
+  emit8(c, 0xaf);
+  emit_modrm_reg(c, dst, src);
+}
+
+static void emit_push(jit_ctx_t *c, int r) {
+  emit_rex(c, false, 0, r);
+  emit8(c, 0x50 + (r & 7));
+}
+
+static void emit_pop(jit_ctx_t *c, int r) {
+  emit_rex(c, false, 0, r);
+  emit8(c, 0x58 + (r & 7));
+}
+
+static void emit_call(jit_ctx_t *c, const void *fn) {
+  emit_rex(c, true, 0, RAX); /* movabs rax, fn */
+  emit8(c, 0xb8);
+  emit64(c, (u64)(uintptr_t)fn);
+  emit8(c, 0xff); /* call rax */
+  emit_modrm_reg(c, 2, RAX);
+}
+
+/* jcc rel32, returns the displacement to patch */
+static u8 *emit_jcc(jit_ctx_t *c, u8 cc) {
+  emit8(c, 0x0f);
+  emit8(c, 0x80 | cc);
+  u8 *rel = c->p;
+  emit32(c, 0);
+  return rel;
+}
+
+/* jmp rel32, returns the displacement to patch */
+static u8 *emit_jmp(jit_ctx_t *c) {
+  emit8(c, 0xe9);
+  u8 *rel = c->p;
+  emit32(c, 0);
+  return rel;
+}
+
+static void patch_rel32(u8 *rel, const u8 *target) {
+  i32 disp = (i32)(target - (rel + 4));
+  memcpy(rel, &disp, sizeof(disp));
+}
+
+/* ======== guest state ======== */
+
+/* loads a guest register, zero extended from 32 bits unless sf */
+static void load_guest(jit_ctx_t *c, int dst, u8 g, bool sf) {
+  if (g >= REG_COUNT) {
+    emit_alu_rr(c, false, ALU_XOR, dst, dst); /* zero register */
+  } else if (c->host[g] >= 0) {
+    emit_mov_rr(c, sf, dst, c->host[g]);
+  } else {
+    emit_load(c, sf, dst, REG_OFFSET(g));
+  }
+}
+
+/* PRE: src holds the value already zero extended for 32-bit results */
+static void store_guest(jit_ctx_t *c, u8 g, int src) {
+  if (g >= REG_COUNT)
+    return;
+  if (c->host[g] >= 0)
+    emit_mov_rr(c, true, c->host[g], src);
+  else
+    emit_store(c, true, src, REG_OFFSET(g));
+}
+
+/* writes back cached registers before calling C code that reads them */
+static void spill_cached(jit_ctx_t *c) {
+  for (int g = 0; g < REG_COUNT; g++) {
+    if (c->host[g] >= 0 && c->written[g])
+      emit_store(c, true, c->host[g], REG_OFFSET(g));
+  }
+}
+
+static void reload_cached(jit_ctx_t *c, u8 g) {
+  if (g < REG_COUNT && c->host[g] >= 0)
+    emit_load(c, true, c->host[g], REG_OFFSET(g));
+}
+
+static void emit_set_pc(jit_ctx_t *c, u64 pc) {
+  if (pc <= INT32_MAX) {
+    emit8(c, 0x48); /* mov qword [rbp + PC], imm32 */
+    emit8(c, 0xc7);
+    emit_modrm_machine(c, 0, PC_OFFSET);
+    emit32(c, (u32)pc);
+  } else {
+    emit_mov_imm(c, RAX, pc);
+    emit_store(c, true, RAX, PC_OFFSET);
+  }
+}
+
+/* sets the PC and leaves the block, returning keep_running */
+static void emit_exit(jit_ctx_t *c, u64 pc, bool keep_running) {
+  emit_set_pc(c, pc);
+  emit_mov_imm(c, RAX, keep_running);
+  c->epilogue_jumps[c->epilogue_jump_count++] = emit_jmp(c);
+}
+
+/* materialises the lazily evaluated flags, see flags.h */
+static void emit_materialise_flags(jit_ctx_t *c) {
+  emit_rex(c, true, RDI, MACHINE_REG); /* lea rdi, [rbp + pstate] */
+  emit8(c, 0x8d);
+  emit_modrm_machine(c, RDI, (i32)offsetof(machine_t, pstate));
+  emit_call(c, (const void *)materialise_flags);
+}
+
+/* evaluates a condition on PSTATE, returns the jcc code taken if it holds */
+static u8 emit_condition(jit_ctx_t *c, u8 cond) {
+  if (cond <= COND_NE) {
+    if (c->flags_sf >= 0) {
+      /* Z of a flag-setting op earlier in the block is just its result */
+      emit_load(c, c->flags_sf, RAX, FLAG_OFFSET(result));
+      emit_rex(c, c->flags_sf, RAX, RAX); /* test rax, rax */
+      emit8(c, 0x85);
+      emit_modrm_reg(c, RAX, RAX);
+      return cond == COND_EQ ? CC_E : CC_NE;
+    }
+    emit_materialise_flags(c);
+    emit8(c, 0xf6); /* test byte [rbp + nzcv], FLAG_Z */
+    emit_modrm_machine(c, 0, FLAG_OFFSET(nzcv));
+    emit8(c, FLAG_Z);
+    return cond == COND_EQ ? CC_NE : CC_E;
+  }
+  /* look the flags up in the condition's row of the truth table */
+  emit_materialise_flags(c);
+  emit8(c, 0x0f); /* movzx eax, byte [rbp + nzcv] */
+  emit8(c, 0xb6);
+  emit_modrm_machine(c, RAX, FLAG_OFFSET(nzcv));
+  emit_mov_imm(c, RCX, condition_table[cond]);
+  emit8(c, 0x0f); /* bt ecx, eax */
+  emit8(c, 0xa3);
+  emit_modrm_reg(c, RAX, RCX);
+  return CC_B;
+}
+
+/* ======== instructions ======== */
+
+/* mov byte [rbp + disp], imm8 */
+static void emit_store_byte(jit_ctx_t *c, i32 disp, u8 value) {
+  emit8(c, 0xc6);
+  emit_modrm_machine(c, 0, disp);
+  emit8(c, value);
+}
+
+/* records a flag-setting operation for lazy evaluation, as flags.h does */
+static void emit_record_flags(jit_ctx_t *c, flags_op_t kind, bool sf, int lhs,
+                              int operand, int result) {
+  emit_store_byte(c, FLAG_OFFSET(pending), kind);
+  emit_store_byte(c, FLAG_OFFSET(sf), sf);
+  if (kind != FLAGS_LOGIC) {
+    emit_store(c, true, lhs, FLAG_OFFSET(lhs));
+    emit_store(c, true, operand, FLAG_OFFSET(operand));
+  }
+  emit_store(c, true, result, FLAG_OFFSET(result));
+  c->flags_sf = sf;
+}
+
+static void emit_arith_imm(jit_ctx_t *c, const decoded_instr_t *d) {
+  bool is_sub = d->opc >> 1;
+  load_guest(c, RAX, d->rn, d->sf);
+  emit_mov_rr(c, d->sf, RDX, RAX);
+  emit_alu_ri(c, d->sf, is_sub ? ALU_SUB : ALU_ADD, RDX, (i32)d->imm);
+  store_guest(c, d->rd, RDX);
+  if (d->opc & 1) {
+    emit_mov_imm(c, RCX, d->imm);
+    emit_record_flags(c, is_sub ? FLAGS_SUB : FLAGS_ADD, d->sf, RAX, RCX, RDX);
+  }
+}
+
+static void emit_shifted_rm(jit_ctx_t *c, const decoded_instr_t *d) {
+  load_guest(c, RCX, d->rm, d->sf);
+  if (d->amount)
+    emit_shift_ri(c, d->sf, d->shift, RCX, d->amount);
+}
+
+static void emit_arith_reg(jit_ctx_t *c, const decoded_instr_t *d) {
+  bool is_sub = d->opc >> 1;
+  load_guest(c, RAX, d->rn, d->sf);
+  emit_shifted_rm(c, d);
+  emit_mov_rr(c, d->sf, RDX, RAX);
+  emit_alu_rr(c, d->sf, is_sub ? ALU_SUB : ALU_ADD, RDX, RCX);
+  store_guest(c, d->rd, RDX);
+  if (d->opc & 1)
+    emit_record_flags(c, is_sub ? FLAGS_SUB : FLAGS_ADD, d->sf, RAX, RCX, RDX);
+}
+
+static void emit_logic_reg(jit_ctx_t *c, const decoded_instr_t *d) {
+  static const alu_op_t logic_ops[] = {[OPP_AND] = ALU_AND,
+                                       [OPP_OR] = ALU_OR,
+                                       [OPP_XOR] = ALU_XOR,
+                                       [OPP_AND_FLAGS] = ALU_AND};
+  load_guest(c, RAX, d->rn, d->sf);
+  emit_shifted_rm(c, d);
+  if (d->negate)
+    emit_not(c, d->sf, RCX);
+  emit_alu_rr(c, d->sf, logic_ops[d->opc], RAX, RCX);
+  store_guest(c, d->rd, RAX);
+  if (d->opc == OPP_AND_FLAGS)
+    emit_record_flags(c, FLAGS_LOGIC, d->sf, RAX, RCX, RAX);
+}
+
+static void emit_multiply(jit_ctx_t *c, const decoded_instr_t *d) {
+  load_guest(c, RAX, d->rn, d->sf);
+  load_guest(c, RCX, d->rm, d->sf);
+  load_guest(c, RDX, d->ra, d->sf);
+  emit_imul_rr(c, d->sf, RAX, RCX);
+  emit_alu_rr(c, d->sf, (d->opc >> 1) ? ALU_SUB : ALU_ADD, RDX, RAX);
+  store_guest(c, d->rd, RDX);
+}
+
+static void emit_cond_select(jit_ctx_t *c, const decoded_instr_t *d) {
+  u8 *holds = emit_jcc(c, emit_condition(c, d->opc));
+  load_guest(c, RAX, d->rm, d->sf);
+  if (d->negate)
+    emit_not(c, d->sf, RAX);
+  if (d->imm)
+    emit_alu_ri(c, d->sf, ALU_ADD, RAX, 1);
+  u8 *done = emit_jmp(c);
+  patch_rel32(holds, c->p);
+  load_guest(c, RAX, d->rn, d->sf);
+  patch_rel32(done, c->p);
+  store_guest(c, d->rd, RAX);
+}
+
+static void emit_move_keep(jit_ctx_t *c, const decoded_instr_t *d) {
+  if (d->rd >= REG_COUNT)
+    return;
+  load_guest(c, RAX, d->rd, true);
+  emit_mov_imm(c, RCX, ~(0xffffULL << d->amount));
+  emit_alu_rr(c, true, ALU_AND, RAX, RCX);
+  emit_mov_imm(c, RCX, d->imm << d->amount);
+  emit_alu_rr(c, true, ALU_OR, RAX, RCX);
+  if (!d->sf)
+    emit_mov_rr(c, false, RAX, RAX);
+  store_guest(c, d->rd, RAX);
+}
+
+/* loads and stores call their interpreter handler on the decoded op */
+static void emit_memory_op(jit_ctx_t *c, const block_op_t *op, reg pc,
+                           const bool *flushed) {
+  spill_cached(c);
+  /* a fault reports the PC, see machine_fault */
+  emit_set_pc(c, pc);
+  emit_mov_rr(c, true, RDI, MACHINE_REG);
+  emit_mov_imm(c, RSI, (u64)(uintptr_t)&op->d);
+  emit_call(c, (const void *)op->d.exec);
+
+  emit8(c, 0x84); /* test al, al */
+  emit_modrm_reg(c, RAX, RAX);
+  u8 *ok = emit_jcc(c, CC_NE);
+  emit_exit(c, pc, false);
+  patch_rel32(ok, c->p);
+
+  /* rd of a vector transfer is a V register */
+  if (op->kind != OP_VECTOR_LOAD && op->kind != OP_VECTOR_STORE)
+    reload_cached(c, op->d.rd);
+  reload_cached(c, op->d.rn);
+  if (op->kind == OP_LOAD_PAIR)
+    reload_cached(c, op->d.ra);
+
+  if (op->kind == OP_STORE || op->kind == OP_STORE_PAIR ||
+      op->kind == OP_VECTOR_STORE) {
+    /* the store may have overwritten translated code */
+    emit_mov_imm(c, RAX, (u64)(uintptr_t)flushed);
+    emit8(c, 0x80); /* cmp byte [rax], 0 */
+    emit8(c, 0x38);
+    emit8(c, 0);
+    u8 *unchanged = emit_jcc(c, CC_E);
+    emit_exit(c, pc + sizeof(instruction), true);
+    patch_rel32(unchanged, c->p);
+  }
+}
+
+/* vector ops call their interpreter handler too, but cannot fail */
+static void emit_vector_op(jit_ctx_t *c, const decoded_instr_t *d) {
+  /* DUP reads a general purpose register, which may only be cached */
+  if (d->exec == exec_vector_dup && d->rn < REG_COUNT && c->host[d->rn] >= 0)
+    emit_store(c, true, c->host[d->rn], REG_OFFSET(d->rn));
+  emit_mov_rr(c, true, RDI, MACHINE_REG);
+  emit_mov_imm(c, RSI, (u64)(uintptr_t)d);
+  emit_call(c, (const void *)d->exec);
+  /* and UMOV writes one */
+  if (d->exec == exec_vector_move)
+    reload_cached(c, d->rd);
+}
+
+/* jumps to the start of the block or leaves it at target */
+static void emit_goto(jit_ctx_t *c, const block_t *b, u64 target) {
+  if (target == b->pc && c->shared) {
+    /* a core spinning here has to notice the end of its turn, see
+     * run_core_turn, and another one stopping the machine */
+    emit_rex(c, true, 0, MACHINE_REG); /* sub qword [rbp + budget], len */
+    emit8(c, 0x83);
+    emit_modrm_machine(c, 5, BUDGET_OFFSET);
+    emit8(c, b->len);
+    u8 *turn_over = emit_jcc(c, CC_LE);
+    emit8(c, 0x80); /* cmp byte [rbp + interrupted], 0 */
+    emit_modrm_machine(c, 7, INTERRUPTED_OFFSET);
+    emit8(c, 0);
+    patch_rel32(emit_jcc(c, CC_E), c->loop_start);
+    patch_rel32(turn_over, c->p);
+    emit_exit(c, target, true);
+  } else if (target == b->pc) {
+    patch_rel32(emit_jmp(c), c->loop_start);
+  } else {
+    emit_exit(c, target, true);
+  }
+}
+
+static void emit_branch_cond(jit_ctx_t *c, const block_t *b,
+                             const decoded_instr_t *d, reg pc) {
+  /* a branch to itself falls through, as in the interpreter */
+  u64 taken = d->imm == pc ? pc + sizeof(instruction) : d->imm;
+  if (d->opc >= COND_AL) {
+    emit_goto(c, b, taken);
+    return;
+  }
+  u8 *jump = emit_jcc(c, emit_condition(c, d->opc));
+  emit_exit(c, pc + sizeof(instruction), true);
+  patch_rel32(jump, c->p);
+  emit_goto(c, b, taken);
+}
+
+/* CBZ, CBNZ, TBZ and TBNZ */
+static void emit_compare_branch(jit_ctx_t *c, const block_t *b,
+                                const block_op_t *op, reg pc) {
+  const decoded_instr_t *d = &op->d;
+  u64 taken = d->imm == pc ? pc + sizeof(instruction) : d->imm;
+  u8 cc;
+  if (op->kind == OP_TEST_BRANCH) {
+    load_guest(c, RAX, d->rd, true);
+    emit_rex(c, true, 0, RAX); /* bt rax, amount */
+    emit8(c, 0x0f);
+    emit8(c, 0xba);
+    emit_modrm_reg(c, 4, RAX);
+    emit8(c, d->amount);
+    cc = d->negate ? CC_B : CC_AE;
+  } else {
+    load_guest(c, RAX, d->rd, d->sf);
+    emit_rex(c, d->sf, RAX, RAX); /* test rax, rax */
+    emit8(c, 0x85);
+    emit_modrm_reg(c, RAX, RAX);
+    cc = d->negate ? CC_NE : CC_E;
+  }
+  u8 *jump = emit_jcc(c, cc);
+  emit_exit(c, pc + sizeof(instruction), true);
+  patch_rel32(jump, c->p);
+  emit_goto(c, b, taken);
+}
+
+static void emit_branch_reg(jit_ctx_t *c, const decoded_instr_t *d, reg pc) {
+  load_guest(c, RAX, d->rn, true);
+  if (pc <= INT32_MAX) {
+    emit_alu_ri(c, true, ALU_CMP, RAX, (i32)pc);
+  } else {
+    emit_mov_imm(c, RCX, pc);
+    emit_alu_rr(c, true, ALU_CMP, RAX, RCX);
+  }
+  u8 *moved = emit_jcc(c, CC_NE);
+  emit_alu_ri(c, true, ALU_ADD, RAX, sizeof(instruction));
+  patch_rel32(moved, c->p);
+  emit_store(c, true, RAX, PC_OFFSET);
+  emit_mov_imm(c, RAX, true);
+  c->epilogue_jumps[c->epilogue_jump_count++] = emit_jmp(c);
+}
+
+/* ======== blocks ======== */
+
+static bool is_supported(const block_op_t *op) {
+  switch (op->kind) {
+  case OP_CALL:
+    return op->d.exec == exec_nop;
+  case OP_CALL_EXIT:
+    return op->d.exec == exec_halt;
+  default:
+    return true;
+  }
+}
+
+static void note_use(u32 *uses, u8 g) {
+  if (g < REG_COUNT)
+    uses[g]++;
+}
+
+/* caches the most used guest registers of the block in host registers */
+static void allocate_registers(jit_ctx_t *c, const block_t *b) {
+  u32 uses[REG_COUNT] = {0};
+  memset(c->host, -1, sizeof(c->host));
+  memset(c->written, 0, sizeof(c->written));
+
+  for (u32 i = 0; i < b->len; i++) {
+    const decoded_instr_t *d = &b->ops[i].d;
+    switch (b->ops[i].kind) {
+    case OP_MULTIPLY:
+      note_use(uses, d->ra);
+      /* fallthrough */
+    case OP_COND_SELECT:
+    case OP_ARITH_REG:
+    case OP_LOGIC_REG:
+      note_use(uses, d->rm);
+      /* fallthrough */
+    case OP_ARITH_IMM:
+      note_use(uses, d->rn);
+      /* fallthrough */
+    case OP_MOVE_WIDE:
+    case OP_MOVE_KEEP:
+      note_use(uses, d->rd);
+      if (d->rd < REG_COUNT)
+        c->written[d->rd] = true;
+      break;
+    case OP_LOAD_PAIR:
+      if (d->ra < REG_COUNT)
+        c->written[d->ra] = true;
+      /* fallthrough */
+    case OP_LOAD:
+    case OP_LOAD_LITERAL:
+      if (d->rd < REG_COUNT)
+        c->written[d->rd] = true;
+      /* fallthrough */
+    case OP_STORE:
+    case OP_STORE_PAIR:
+    case OP_VECTOR_LOAD:
+    case OP_VECTOR_STORE:
+      if (d->rn < REG_COUNT)
+        c->written[d->rn] = true;
+      break;
+    case OP_BRANCH_REG:
+      note_use(uses, d->rn);
+      break;
+    case OP_COMPARE_BRANCH:
+    case OP_TEST_BRANCH:
+      note_use(uses, d->rd);
+      break;
+    default:
+      break;
+    }
+  }
+
+  for (int slot = 0; slot < CACHED_REGS; slot++) {
+    int best = -1;
+    for (int g = 0; g < REG_COUNT; g++) {
+      if (c->host[g] < 0 && uses[g] > 1 && (best < 0 || uses[g] > uses[best]))
+        best = g;
+    }
+    if (best < 0)
+      break;
+    c->host[best] = cache_hosts[slot];
+  }
+}
+
+jit_fn jit_compile(machine_t *m, block_t *b, const bool *flushed) {
+  struct jit *jit = m->jit;
+  u32 count = b->len + (b->ops[b->len - 1].d.ends_block ? 0 : 1);
+  for (u32 i = 0; i < count; i++) {
+    if (!is_supported(&b->ops[i]))
+      return NULL;
+  }
+
+  if (jit->code_used + JIT_MAX_BLOCK_CODE > JIT_CODE_SIZE) {
+    /* out of space: start again with an empty cache */
+    block_cache_flush(m);
+    return NULL;
+  }
+
+  jit_ctx_t c;
+  u8 *start = jit->code + jit->code_used;
+  c.p = start;
+  c.epilogue_jump_count = 0;
+  c.flags_sf = -1;
+  c.shared = m->shared_memory;
+  allocate_registers(&c, b);
+
+  /* prologue: save callee-saved registers, keeping rsp 16-byte aligned */
+  emit_push(&c, RBP);
+  for (int slot = 0; slot < CACHED_REGS; slot++)
+    emit_push(&c, cache_hosts[slot]);
+  emit_rex(&c, true, 0, RSP); /* sub rsp, 8 */
+  emit8(&c, 0x83);
+  emit_modrm_reg(&c, 5, RSP);
+  emit8(&c, 8);
+  emit_mov_rr(&c, true, MACHINE_REG, RDI);
+  for (int g = 0; g < REG_COUNT; g++)
+    reload_cached(&c, g);
+
+  c.loop_start = c.p;
+  if (m->profile != NULL) {
+    /* count every run, including those looping back here */
+    emit_mov_imm(&c, RAX, (u64)(uintptr_t)&b->count);
+    emit_rex(&c, true, 0, RAX); /* inc qword [rax] */
+    emit8(&c, 0xff);
+    emit8(&c, 0x00);
+  }
+  for (u32 i = 0; i < count; i++) {
+    const block_op_t *op = &b->ops[i];
+    const decoded_instr_t *d = &op->d;
+    reg pc = b->pc + i * sizeof(instruction);
+    switch (op->kind) {
+    case OP_ARITH_IMM:
+      emit_arith_imm(&c, d);
+      break;
+    case OP_MOVE_WIDE:
+      if (d->rd < REG_COUNT) {
+        emit_mov_imm(&c, RAX, d->imm);
+        store_guest(&c, d->rd, RAX);
+      }
+      break;
+    case OP_MOVE_KEEP:
+      emit_move_keep(&c, d);
+      break;
+    case OP_ARITH_REG:
+      emit_arith_reg(&c, d);
+      break;
+    case OP_LOGIC_REG:
+      emit_logic_reg(&c, d);
+      break;
+    case OP_MULTIPLY:
+      emit_multiply(&c, d);
+      break;
+    case OP_COND_SELECT:
+      emit_cond_select(&c, d);
+      break;
+    case OP_LOAD:
+    case OP_STORE:
+    case OP_LOAD_LITERAL:
+    case OP_LOAD_PAIR:
+    case OP_STORE_PAIR:
+    case OP_VECTOR_LOAD:
+    case OP_VECTOR_STORE:
+      emit_memory_op(&c, op, pc, flushed);
+      break;
+    case OP_VECTOR:
+      emit_vector_op(&c, d);
+      break;
+    case OP_BRANCH:
+      emit_goto(&c, b, d->imm == pc ? pc + sizeof(instruction) : d->imm);
+      break;
+    case OP_BRANCH_REG:
+      emit_branch_reg(&c, d, pc);
+      break;
+    case OP_BRANCH_COND:
+      emit_branch_cond(&c, b, d, pc);
+      break;
+    case OP_COMPARE_BRANCH:
+    case OP_TEST_BRANCH:
+      emit_compare_branch(&c, b, op, pc);
+      break;
+    case OP_CALL_EXIT: /* halt */
+      emit_exit(&c, pc, false);
+      break;
+    case OP_END:
+      emit_exit(&c, pc, true);
+      break;
+    default: /* nop */
+      break;
+    }
+  }
+
+  /* epilogue: eax holds the return value */
+  for (int i = 0; i < c.epilogue_jump_count; i++)
+    patch_rel32(c.epilogue_jumps[i], c.p);
+  spill_cached(&c);
+  emit_rex(&c, true, 0, RSP); /* add rsp, 8 */
+  emit8(&c, 0x83);
+  emit_modrm_reg(&c, 0, RSP);
+  emit8(&c, 8);
+  for (int slot = CACHED_REGS - 1; slot >= 0; slot--)
+    emit_pop(&c, cache_hosts[slot]);
+  emit_pop(&c, RBP);
+  emit8(&c, 0xc3); /* ret */
+
+  jit->code_used += c.p - start;
+  return (jit_fn)(void *)start;
+}
+
+bool jit_init(machine_t *m) {
+  if (m->jit != NULL)
+    return true;
+
+  struct jit *jit = malloc(sizeof(*jit));
+  if (jit == NULL)
+    return false;
+  void *code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) {
+    fprintf(stderr, "Could not allocate executable memory for the JIT.\n");
+    free(jit);
+    return false;
+  }
+  jit->code = code;
+  jit->code_used = 0;
+  m->jit = jit;
+  return true;
+}
+
+void jit_destroy(machine_t *m) {
+  if (m->jit == NULL)
+    return;
+  munmap(m->jit->code, JIT_CODE_SIZE);
+  free(m->jit);
+  m->jit = NULL;
+}
+
+void jit_flush(machine_t *m) { m->jit->code_used = 0; }
+
+#else /* !__x86_64__ */
+
+bool jit_init(machine_t *m) {
+  (void)m;
+  fprintf(stderr, "The JIT is only available on x86-64 hosts.\n");
+  return false;
+}
+
+void jit_destroy(machine_t *m) { (void)m; }
+
+jit_fn jit_compile(machine_t *m, block_t *b, const bool *flushed) {
+  (void)m;
+  (void)b;
+  (void)flushed;
+  return NULL;
+}
+
+void jit_flush(machine_t *m) { (void)m; }
+
+#endif /* __x86_64__ */
@@ -0,0 +1,47 @@
+#ifndef JIT
+#define JIT
+
+#include "../defs.h"
+#include "block.h"
+#include "emulate.h"
+#include <stdbool.h>
+
+/* a block is compiled once it has been entered this many times */
+#define JIT_THRESHOLD 32
+
+/* size of the executable buffer holding compiled blocks */
+#define JIT_CODE_SIZE (4 << 20)
+/* largest amount of code a single block can compile to */
+#define JIT_MAX_BLOCK_CODE (32 << 10)
+
+/**
+ * Sets up a code buffer for the machine, enabling the JIT for it.
+ *
+ * @return false if the JIT is not available on this host.
+ */
+bool jit_init(machine_t *m);
+
+/**
+ * Frees the code buffer of the machine, if it has one.
+ */
+void jit_destroy(machine_t *m);
+
+/**
+ * Compiles a translated block to native code.
+ *
+ * @param m       The machine the block belongs to.
+ * @param b       The block to compile, its count is updated by the code if
+ *                the machine is profiled.
+ * @param flushed Flag set by the block engine whenever its cache is flushed.
+ *                Compiled stores check it to leave code that may be stale.
+ * @return the compiled code, or NULL if the block uses an unsupported op.
+ */
+jit_fn jit_compile(machine_t *m, block_t *b, const bool *flushed);
+
+/**
+ * Drops all compiled code. Must only be called when no compiled block is
+ * executing, or by a handler called from one that returns straight away.
+ */
+void jit_flush(machine_t *m);
+
+#endif /* JIT */
@@ -0,0 +1,161 @@
+#include "libemulator.h"
+#include "block.h"
+#include "decode.h"
+#include "emulate.h"
+#include "flags.h"
+#include "machine.h"
+#include "memory.h"
+#include <inttypes.h>
+#include <string.h>
+
+/*
+ * The public interface, on top of the run loops in machine.c. The machine
+ * catches its own faults, so each call leaves machine->exit filled in.
+ */
+
+machine_exit_t machine_run(machine_t *machine) {
+  run_machine(machine);
+  return machine->exit;
+}
+
+machine_exit_t machine_run_for(machine_t *machine, uint64_t n) {
+  run_machine_steps(machine, n);
+  return machine->exit;
+}
+
+machine_exit_t machine_step(machine_t *machine) {
+  return machine_run_for(machine, 1);
+}
+
+machine_exit_t machine_last_exit(const machine_t *machine) {
+  return machine->exit;
+}
+
+void machine_print_exit(FILE *out, const machine_exit_t *exit) {
+  if (exit->core != 0 && exit->reason != MACHINE_RUNNING &&
+      exit->reason != MACHINE_HALTED)
+    fprintf(out, "Core %" PRIu32 ": ", exit->core);
+  switch (exit->reason) {
+  case MACHINE_RUNNING:
+  case MACHINE_HALTED:
+    break;
+  case MACHINE_INVALID_INSTRUCTION:
+  case MACHINE_UNSUPPORTED_INSTRUCTION:
+    fprintf(out, "%s", exit->message);
+    break;
+  case MACHINE_MEMORY_FAULT:
+    fprintf(out, "Memory access out of bounds at %" PRIx64 "\n",
+            exit->address);
+    break;
+  case MACHINE_OUT_OF_MEMORY:
+    fprintf(out, "Could not allocate guest memory at %" PRIx64 "\n",
+            exit->address);
+    break;
+  case MACHINE_ALIGNMENT_FAULT:
+    fprintf(out, "Misaligned exclusive or ordered access at %" PRIx64 "\n",
+            exit->address);
+    break;
+  }
+}
+
+/* ======== registers ======== */
+
+uint64_t machine_get_reg(const machine_t *machine, int n) {
+  return n >= 0 && n < REG_COUNT ? machine->regs[n] : ZR;
+}
+
+void machine_set_reg(machine_t *machine, int n, uint64_t value) {
+  if (n >= 0 && n < REG_COUNT)
+    machine->regs[n] = value;
+}
+
+bool machine_get_vreg(const machine_t *machine, int n,
+                      uint8_t bytes[MACHINE_VREG_SIZE]) {
+  if (n < 0 || n >= VREG_COUNT)
+    return false;
+  memcpy(bytes, machine->vregs[n].b, MACHINE_VREG_SIZE);
+  return true;
+}
+
+bool machine_set_vreg(machine_t *machine, int n,
+                      const uint8_t bytes[MACHINE_VREG_SIZE]) {
+  if (n < 0 || n >= VREG_COUNT)
+    return false;
+  memcpy(machine->vregs[n].b, bytes, MACHINE_VREG_SIZE);
+  return true;
+}
+
+uint64_t machine_get_pc(const machine_t *machine) { return machine->PC; }
+
+void machine_set_pc(machine_t *machine, uint64_t pc) { machine->PC = pc; }
+
+uint64_t machine_get_sp(const machine_t *machine) { return machine->SP; }
+
+void machine_set_sp(machine_t *machine, uint64_t sp) { machine->SP = sp; }
+
+uint8_t machine_get_flags(machine_t *machine) {
+  materialise_flags(&machine->pstate);
+  return machine->pstate.nzcv;
+}
+
+/* ======== memory ======== */
+
+static bool in_bounds(const machine_t *m, u64 address, size_t size) {
+  return size <= m->memory_size && address <= m->memory_size - size;
+}
+
+/* bytes from address to the end of its page, at most size */
+static size_t page_chunk(u64 address, size_t size) {
+  size_t left = PAGE_SIZE - (address & PAGE_MASK);
+  return size < left ? size : left;
+}
+
+bool machine_read(machine_t *machine, uint64_t address, void *out,
+                  size_t size) {
+  if (!in_bounds(machine, address, size))
+    return false;
+  u8 *bytes = out;
+  while (size > 0) {
+    size_t n = page_chunk(address, size);
+    const u8 *data = memory_page(machine, address);
+    if (data != NULL)
+      memcpy(bytes, data + (address & PAGE_MASK), n);
+    else
+      memset(bytes, 0, n);
+    bytes += n;
+    address += n;
+    size -= n;
+  }
+  return true;
+}
+
+typedef struct {
+  u64 address;
+  const u8 *data;
+  size_t size;
+} write_t;
+
+static void write_pages(machine_t *machine, void *arg) {
+  write_t *w = arg;
+  while (w->size > 0) {
+    size_t n = page_chunk(w->address, w->size);
+    u8 *data = memory_page_for_write(machine, w->address);
+    memcpy(data + (w->address & PAGE_MASK), w->data, n);
+    decode_cache_invalidate(machine, w->address, (int)n);
+    w->data += n;
+    w->address += n;
+    w->size -= n;
+  }
+}
+
+bool machine_write(machine_t *machine, uint64_t address, const void *data,
+                   size_t size) {
+  if (!in_bounds(machine, address, size))
+    return false;
+  write_t w = {.address = address, .data = data, .size = size};
+  bool written = machine_catch_faults(machine, write_pages, &w);
+  /* pages may have been copied from under the TLB, and blocks overwritten */
+  memory_flush_tlb(machine);
+  block_cache_flush(machine);
+  return written;
+}
@@ -0,0 +1,171 @@
+#ifndef LIBEMULATOR_H
+#define LIBEMULATOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * The public interface of libemulator.a: the emulator core, to drive any
+ * number of guests from one process. Guests are independent of each other, so
+ * different threads may run different machines at the same time.
+ *
+ * Nothing a guest does ends the process: every way a run can stop is reported
+ * as a machine_exit_t, and a machine that stopped on an error can still be
+ * inspected, then reloaded.
+ */
+
+/* general purpose registers X0 to X30 */
+#define MACHINE_REG_COUNT 31
+
+/* SIMD registers V0 to V31, 16 bytes each */
+#define MACHINE_VREG_COUNT 32
+#define MACHINE_VREG_SIZE 16
+
+typedef struct machine machine_t;
+
+/* why a machine stopped */
+typedef enum {
+  MACHINE_RUNNING, /* it ran all the instructions it was asked to */
+  MACHINE_HALTED,  /* it ran the halt instruction */
+  MACHINE_INVALID_INSTRUCTION,     /* it reached an undefined encoding */
+  MACHINE_UNSUPPORTED_INSTRUCTION, /* a malformed encoding of a known one */
+  MACHINE_MEMORY_FAULT,            /* it accessed memory out of bounds */
+  MACHINE_OUT_OF_MEMORY,           /* the host could not back guest memory */
+  MACHINE_ALIGNMENT_FAULT, /* an exclusive or ordered access was misaligned */
+} machine_stop_t;
+
+typedef struct {
+  machine_stop_t reason;
+  uint64_t pc;         /* the instruction the machine stopped at */
+  uint64_t address;    /* the guest address, for the memory reasons */
+  const char *message; /* describes an instruction error, or NULL */
+  uint32_t core;       /* the core that stopped, see machine_set_cores */
+} machine_exit_t;
+
+/**
+ * Allocates a machine with zeroed registers and memory. Memory pages are only
+ * allocated once they are written.
+ *
+ * @param memory_size Size of the guest address space in bytes, rounded up to
+ *                    whole 4KB pages. At most 1TB.
+ * @return the machine, or NULL if it could not be allocated.
+ */
+machine_t *machine_create(uint64_t memory_size);
+
+/**
+ * Frees a machine created by machine_create.
+ */
+void machine_destroy(machine_t *machine);
+
+/**
+ * Gives the machine count cores sharing its memory. Every core starts at
+ * address 0 with zeroed registers and tells itself apart from the others by
+ * reading MPIDR_EL1, whose low bits hold its number.
+ *
+ * Core 0 is the machine itself, the register accessors apply to it. A run
+ * stops once every core has halted, or as soon as any of them stops on an
+ * error, which is then the exit of the run; machine_run_for runs every core
+ * at most n instructions, in turns of the quantum.
+ *
+ * @param count   Number of cores, 1 to go back to a single one.
+ * @param quantum 0 to run every core on a thread of its own, otherwise the
+ *                cores take turns on the calling thread, running quantum
+ *                instructions each, up to the end of the basic block they
+ *                are in, so that runs are deterministic.
+ * @return false if count is out of range or the cores could not be allocated,
+ *         the machine is then left with a single core.
+ */
+bool machine_set_cores(machine_t *machine, int count, uint64_t quantum);
+
+/**
+ * Resets the machine and copies an image to address 0.
+ *
+ * @param image The image, which is not referenced once this returns.
+ * @return false if the image does not fit or memory ran out.
+ */
+bool machine_load(machine_t *machine, const void *image, size_t size);
+
+/**
+ * Runs the machine until it stops.
+ */
+machine_exit_t machine_run(machine_t *machine);
+
+/**
+ * Runs at most n instructions, leaving the PC at the next one.
+ *
+ * @return MACHINE_RUNNING if all n ran, otherwise why the machine stopped.
+ */
+machine_exit_t machine_run_for(machine_t *machine, uint64_t n);
+
+/**
+ * Runs a single instruction.
+ */
+machine_exit_t machine_step(machine_t *machine);
+
+/**
+ * Returns how the last run of the machine ended.
+ */
+machine_exit_t machine_last_exit(const machine_t *machine);
+
+/**
+ * Prints a one line description of an exit that stopped on an error, and
+ * nothing for MACHINE_RUNNING or MACHINE_HALTED.
+ */
+void machine_print_exit(FILE *out, const machine_exit_t *exit);
+
+/**
+ * Reads Xn. Index 31 is the zero register.
+ */
+uint64_t machine_get_reg(const machine_t *machine, int n);
+
+/**
+ * Writes Xn. Writes to index 31, the zero register, are ignored.
+ */
+void machine_set_reg(machine_t *machine, int n, uint64_t value);
+
+/**
+ * Copies Vn out, lane 0 first as the guest stores it.
+ *
+ * @return false if n is not a SIMD register.
+ */
+bool machine_get_vreg(const machine_t *machine, int n,
+                      uint8_t bytes[MACHINE_VREG_SIZE]);
+
+/**
+ * Writes Vn, the inverse of machine_get_vreg.
+ *
+ * @return false if n is not a SIMD register.
+ */
+bool machine_set_vreg(machine_t *machine, int n,
+                      const uint8_t bytes[MACHINE_VREG_SIZE]);
+
+uint64_t machine_get_pc(const machine_t *machine);
+void machine_set_pc(machine_t *machine, uint64_t pc);
+uint64_t machine_get_sp(const machine_t *machine);
+void machine_set_sp(machine_t *machine, uint64_t sp);
+
+/**
+ * Returns the condition flags, with N, Z, C and V in bits 3 to 0.
+ */
+uint8_t machine_get_flags(machine_t *machine);
+
+/**
+ * Copies guest memory out. Memory that was never written reads as zero.
+ *
+ * @return false if [address, address + size) is not all in the address space.
+ */
+bool machine_read(machine_t *machine, uint64_t address, void *out,
+                  size_t size);
+
+/**
+ * Copies data into guest memory, dropping any translated code it overwrites.
+ *
+ * @return false if [address, address + size) is not all in the address space,
+ *         or memory ran out part way through.
+ */
+bool machine_write(machine_t *machine, uint64_t address, const void *data,
+                   size_t size);
+
+#endif /* LIBEMULATOR_H */
@@ -1,155 +1,312 @@
 #include "machine.h"
 #include "../utils/bits_utils.h"
 #include "emulate.h"
-#include "execute/branches.h"
-#include "execute/halt.h"
-#include "execute/immediate_instructions.h"
-#include "execute/load_store.h"
-#include "execute/register_instruction.h"
+#include "block.h"
+#include "cores.h"
+#include "decode.h"
+#include "flags.h"
+#include "hooks.h"
+#include "jit.h"
+#include "memory.h"
+#include "profile.h"
+#include "timeline.h"
+#include "timing.h"
+#include "trace.h"
 #include <inttypes.h>
+#include <setjmp.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 
-#define DP_IMM_BIT_PATTERN_1 0x8
-#define DP_IMM_BIT_PATTERN_2 0x9
-#define DP_REG_BIT_PATTERN_1 0x5
-#define DP_REG_BIT_PATTERN_2 0xd
-#define LS_BIT_PATTERN_1 0x4
-#define LS_BIT_PATTERN_2 0xc
-#define LS_BIT_PATTERN_3 0x6
-#define LS_BIT_PATTERN_4 0xe
-#define B_BIT_PATTERN_1 0xa
-#define B_BIT_PATTERN_2 0xb
+machine_t *machine_create(u64 memory_size) {
+  /* sizeof(machine_t) is a multiple of the cache line size */
+  machine_t *machine = aligned_alloc(CACHE_LINE_SIZE, sizeof(machine_t));
+  if (machine == NULL)
+    return NULL;
+  memset(machine, 0, sizeof(machine_t));
+  machine->fast_forward = true;
+  machine->exclusive_address = EXCLUSIVE_NONE;
 
+  if (!memory_init(machine, memory_size) || !decode_cache_create(machine) ||
+      !block_cache_create(machine)) {
+    machine_destroy(machine);
+    return NULL;
+  }
+  return machine;
+}
 
-extern machine_t machine;
+void machine_destroy(machine_t *machine) {
+  if (machine == NULL)
+    return;
+  cores_destroy(machine);
+  jit_destroy(machine);
+  timeline_stop(machine);
+  profile_destroy(machine);
+  timing_destroy(machine);
+  trace_stop(machine);
+  hooks_destroy(machine);
+  block_cache_destroy(machine);
+  decode_cache_destroy(machine);
+  memory_destroy(machine);
+  free(machine);
+}
 
-static instruction fetch(machine_t *m) {
-  /* instructions are stored in little-endian format in the memory */
-  /* so, reverse the byte order while fetching the instruction */
-  u8 instr1 = m->memory[m->PC];     /* least significant byte */
-  u8 instr2 = m->memory[m->PC + 1]; /* mid bytes */
-  u8 instr3 = m->memory[m->PC + 2]; /* mid bytes */
-  u8 instr4 = m->memory[m->PC + 3]; /* most significant byte*/
+void reset_core(machine_t *machine) {
+  memset(machine->regs, 0, sizeof(machine->regs));
+  memset(machine->vregs, 0, sizeof(machine->vregs));
+  machine->SP = 0;
+  machine->PC = START_INSTR_ADDR;
+  machine->pstate.nzcv = FLAG_Z;
+  machine->pstate.pending = FLAGS_NONE;
+  machine->exclusive_address = EXCLUSIVE_NONE;
+  decode_cache_flush(machine);
+  block_cache_flush(machine);
+}
 
-  instruction instr = 0x0;
-  insert_bits_u32(&instr, 0, 7, instr1);
-  insert_bits_u32(&instr, 8, 15, instr2);
-  insert_bits_u32(&instr, 16, 23, instr3);
-  insert_bits_u32(&instr, 24, 31, instr4);
+void reset_machine(machine_t *machine) {
+  /* machines are reused across programs, so nothing may leak from the last */
+  memory_reset(machine);
+  reset_core(machine);
+  if (machine->cores != NULL)
+    cores_reset(machine);
+  machine->exit = (machine_exit_t){.reason = MACHINE_RUNNING};
+}
 
-  return instr;
+/*
+ * The single step loop. It is always called with a constant hooked, so each
+ * caller gets a copy with the hooks either compiled in or left out entirely.
+ */
+static inline bool step_machine(machine_t *machine, u64 n, bool hooked) {
+  for (u64 i = 0; i < n; i++) {
+    if (__atomic_load_n(&machine->interrupted, __ATOMIC_RELAXED))
+      return TRUE; /* another core stopped the machine, see cores.h */
+    reg pc = machine->PC;
+    const decoded_instr_t *d = decode_cache_lookup(machine, pc);
+    if (machine->profile != NULL)
+      profile_count(machine, pc, d);
+    if (hooked)
+      hooks_begin(machine);
+    if (!d->exec(machine, d)) {
+      machine->PC = pc;
+      if (hooked)
+        hooks_halt(machine, pc);
+      return FALSE;
+    }
+    /* as in run_blocks, only advance if the instruction did not branch */
+    if (machine->PC == pc)
+      machine->PC += sizeof(instruction);
+    if (hooked)
+      hooks_retire(machine, pc, d);
+  }
+  return TRUE;
 }
 
-static bool decode_and_execute(instruction instr) {
-  if (halt_instr(instr))
-    return FALSE;
+_Noreturn void machine_fault(machine_t *machine, machine_stop_t reason,
+                             u64 address) {
+  machine->exit = (machine_exit_t){
+      .reason = reason, .pc = machine->PC, .address = address};
+  if (machine->fault_handler == NULL) {
+    machine_print_exit(stderr, &machine->exit);
+    exit(1);
+  }
+  longjmp(*machine->fault_handler, 1);
+}
 
-  u8 op0 = (u8)extract_bits_u32(instr, 25, 28);
-  switch (op0) {
-  case DP_IMM_BIT_PATTERN_1:
-  case DP_IMM_BIT_PATTERN_2:
-    /* data processing (immediate) */
-    immediate_exectution(instr);
-    break;
-  case DP_REG_BIT_PATTERN_1:
-  case DP_REG_BIT_PATTERN_2:
-    /* data processing (register) */
-    register_execute(instr);
-    break;
-  case LS_BIT_PATTERN_1:
-  case LS_BIT_PATTERN_2:
-  case LS_BIT_PATTERN_3:
-  case LS_BIT_PATTERN_4:
-    /* loads and stores */
-    execute_load_store(instr);
-    break;
-  case B_BIT_PATTERN_1:
-  case B_BIT_PATTERN_2:
-    /* branches */
-    if (!branch_instr(instr))
-      return false;
-    break;
-  default:
-    fprintf(stderr, "Invalid instruction op0\n");
-    return FALSE;
+/*
+ * Nothing is left to clean up after a fault: the loops hold no resources and
+ * write the guest registers back before every memory access.
+ */
+bool machine_catch_faults(machine_t *machine,
+                          void (*body)(machine_t *machine, void *arg),
+                          void *arg) {
+  jmp_buf handler;
+  jmp_buf *outer = machine->fault_handler;
+  machine->fault_handler = &handler;
+  if (setjmp(handler) != 0) {
+    machine->fault_handler = outer;
+    return false;
   }
-  return TRUE;
+  body(machine, arg);
+  machine->fault_handler = outer;
+  return true;
 }
 
-static void init_machine(machine_t *machine) {
-  machine->PC = START_INSTR_ADDR;
-  machine->pstate.Z = TRUE;
-  machine->pstate.C = FALSE;
-  machine->pstate.N = FALSE;
-  machine->pstate.V = FALSE;
+/*
+ * records how a run ended, halting being the one way nothing else records; a
+ * core that was interrupted has not stopped by itself, so it is still running
+ */
+static void finish_run(machine_t *machine, bool faulted, bool stopped) {
+  if (faulted && machine->hooks != NULL)
+    hooks_halt(machine, machine->PC);
+  if (stopped && machine->exit.reason == MACHINE_RUNNING &&
+      !machine->interrupted)
+    machine->exit.reason = MACHINE_HALTED;
+  machine->exit.pc = machine->PC;
+  machine->exit.core = machine->core_id;
+}
+
+static void run_to_end(machine_t *machine, void *arg) {
+  (void)arg;
+  /*
+   * instructions are executed a basic block at a time, the PC is only brought
+   * up to date at block boundaries (and when the machine stops); hooks have
+   * to see every instruction, so instrumented machines single step instead
+   */
+  if (machine->hooks != NULL)
+    step_machine(machine, UINT64_MAX, true);
+  else
+    run_blocks(machine);
+}
+
+void run_core(machine_t *machine) {
+  machine->exit = (machine_exit_t){.reason = MACHINE_RUNNING};
+  machine->budget = INT64_MAX;
+  bool faulted = !machine_catch_faults(machine, run_to_end, NULL);
+  finish_run(machine, faulted, true);
+}
+
+bool run_core_turn(machine_t *machine, u64 n) {
+  if (machine->hooks != NULL)
+    return run_core_steps(machine, n);
+  machine->exit = (machine_exit_t){.reason = MACHINE_RUNNING};
+  machine->budget = n < INT64_MAX ? (i64)n : INT64_MAX;
+  bool faulted = !machine_catch_faults(machine, run_to_end, NULL);
+  /* a core that used up its budget has not stopped */
+  finish_run(machine, faulted, faulted || machine->budget > 0);
+  return !faulted && machine->exit.reason == MACHINE_RUNNING;
 }
 
 void run_machine(machine_t *machine) {
+  if (machine->cores != NULL)
+    cores_run(machine, UINT64_MAX);
+  else
+    run_core(machine);
+}
 
-  while (TRUE) {
-    /* fetch instruction */
-    reg old_pc = machine->PC;
-    instruction instr = fetch(machine);
-    /* decode and execute instruction */
-    if (!decode_and_execute(instr)) /* if the instruction couldn't be parsed (or
-    it is the halt instruction) break */
-      break;
-
-    /*
-     * increment PC by instruction byte size after so that PC is pointing
-     *  to the instruction currently being executed (the same instruction that
-     * has been) fetched and decoded.
-     */
-    if (machine->PC == old_pc)
-      machine->PC += sizeof(instruction);
-  }
+typedef struct {
+  u64 n;
+  bool running;
+} steps_t;
+
+static void run_steps(machine_t *machine, void *arg) {
+  steps_t *steps = arg;
+  if (machine->hooks != NULL)
+    steps->running = step_machine(machine, steps->n, true);
+  else
+    steps->running = step_machine(machine, steps->n, false);
 }
 
-void shutdown_machine(machine_t *machine, FILE *out_stream) {
-  fprintf(out_stream, "Registers:\n");
+bool run_core_steps(machine_t *machine, u64 n) {
+  steps_t steps = {.n = n};
+  machine->exit = (machine_exit_t){.reason = MACHINE_RUNNING};
+  bool faulted = !machine_catch_faults(machine, run_steps, &steps);
+  finish_run(machine, faulted, faulted || !steps.running);
+  return !faulted && steps.running;
+}
+
+bool run_machine_steps(machine_t *machine, u64 n) {
+  if (machine->cores != NULL)
+    return cores_run(machine, n);
+  return run_core_steps(machine, n);
+}
+
+static void print_registers(machine_t *machine, FILE *out_stream) {
   for (int i = 0; i < REG_COUNT; i++) {
     fprintf(out_stream, "X%02d    = %016" PRIx64 "\n", i, machine->regs[i]);
   }
 
   fprintf(out_stream, "PC     = %016" PRIx64 "\n", machine->PC);
-  fprintf(out_stream, "PSTATE : %c%c%c%c\n", machine->pstate.N ? 'N' : '-',
-          machine->pstate.Z ? 'Z' : '-', machine->pstate.C ? 'C' : '-',
-          machine->pstate.V ? 'V' : '-');
+  materialise_flags(&machine->pstate);
+  u8 nzcv = machine->pstate.nzcv;
+  fprintf(out_stream, "PSTATE : %c%c%c%c\n", nzcv & FLAG_N ? 'N' : '-',
+          nzcv & FLAG_Z ? 'Z' : '-', nzcv & FLAG_C ? 'C' : '-',
+          nzcv & FLAG_V ? 'V' : '-');
+  /* most programs never touch the SIMD registers, so only used ones show */
+  for (int i = 0; i < VREG_COUNT; i++) {
+    const vreg *v = &machine->vregs[i];
+    if (v->d[0] != 0 || v->d[1] != 0)
+      fprintf(out_stream, "V%02d    = %016" PRIx64 "%016" PRIx64 "\n", i,
+              v->d[1], v->d[0]);
+  }
+}
+
+void shutdown_machine(machine_t *machine, FILE *out_stream) {
+  fprintf(out_stream, "Registers:\n");
+  print_registers(machine, out_stream);
+  for (u32 i = 1; i < cores_count(machine); i++) {
+    fprintf(out_stream, "Core %" PRIu32 " registers:\n", i);
+    print_registers(cores_get(machine, i), out_stream);
+  }
   fprintf(out_stream, "Non-zero memory:\n");
-  for (int addr = 0; addr < MEMORY_SIZE; addr += 4) {
-    /* TODO: move this to bits_utils? */
-    u32 data = (u32)(machine->memory[addr]) |
-               (u32)(machine->memory[addr + 1] << 8) |
-               (u32)(machine->memory[addr + 2] << 16) |
-               (u32)(machine->memory[addr + 3] << 24);
-    if (data != 0) {
-      fprintf(out_stream, "0x%" PRIx32 ": 0x%" PRIx32 "\n", addr, data);
+  /* pages that were never written are all zero */
+  for (u64 page = memory_next_dirty(machine, 0); page < machine->memory_size;
+       page = memory_next_dirty(machine, page + PAGE_SIZE)) {
+    const u8 *bytes = memory_page(machine, page);
+    for (u32 offset = 0; offset < PAGE_SIZE; offset += 4) {
+      u32 data;
+      memcpy(&data, bytes + offset, sizeof(data));
+      if (data != 0) {
+        fprintf(out_stream, "0x%" PRIx64 ": 0x%" PRIx32 "\n", page + offset,
+                data);
+      }
     }
   }
 }
 
 static bool machine_load_program_file(machine_t *machine, FILE *file) {
-  u8 *mem = machine->memory + machine->PC;
-  /* load memory with bytes fetched from the image file */
-  const size_t ret_code = fread(mem, 1, MEMORY_SIZE, file);
-  if (ret_code == 0 && ferror(file)) {
-    return FALSE;
+  /* load memory a page at a time with bytes fetched from the image file */
+  u8 buf[PAGE_SIZE];
+  for (u64 addr = machine->PC; addr < machine->memory_size; addr += PAGE_SIZE) {
+    const size_t ret_code = fread(buf, 1, PAGE_SIZE, file);
+    if (ret_code == 0) {
+      return !ferror(file);
+    }
+    memcpy(memory_page_for_write(machine, addr), buf, ret_code);
   }
 
   return TRUE;
 }
 
-void machine_load_program(machine_t *machine, const char *prg) {
-  init_machine(machine);
+typedef struct {
+  const u8 *data;
+  size_t size;
+} image_t;
+
+static void copy_image(machine_t *machine, void *arg) {
+  const image_t *image = arg;
+  for (u64 addr = 0; addr < image->size; addr += PAGE_SIZE) {
+    size_t n = image->size - addr < PAGE_SIZE ? image->size - addr : PAGE_SIZE;
+    memcpy(memory_page_for_write(machine, START_INSTR_ADDR + addr),
+           image->data + addr, n);
+  }
+}
+
+bool machine_load(machine_t *machine, const void *image, size_t size) {
+  reset_machine(machine);
+  if (size > machine->memory_size - START_INSTR_ADDR)
+    return FALSE;
+  image_t copy = {.data = image, .size = size};
+  return machine_catch_faults(machine, copy_image, &copy);
+}
+
+bool machine_load_program(machine_t *machine, const char *prg) {
+  reset_machine(machine);
   FILE *infile = fopen(prg, "rb");
   if (!infile) {
     fprintf(stderr, "An error occured while trying to read the program file.");
-    return;
+    return FALSE;
   }
 
-  bool read = machine_load_program_file(machine, infile);
+  /* map the image where possible, copying it in is the fallback */
+  struct stat st;
+  bool read = fstat(fileno(infile), &st) == 0 && S_ISREG(st.st_mode) &&
+              memory_map_image(machine, fileno(infile), st.st_size);
+  if (!read)
+    read = machine_load_program_file(machine, infile);
   if (!read) {
     fprintf(stderr, "Error reading %s\n", prg);
   }
   fclose(infile);
+  return read;
 }
@@ -4,9 +4,88 @@
 #include "../defs.h"
 #include "emulate.h"
 
+/*
+ * machine_create, machine_destroy and the rest of the public interface are
+ * declared in libemulator.h.
+ */
+
+/**
+ * Runs the machine until it stops, leaving how in machine->exit. A machine
+ * with several cores runs all of them, see cores.h.
+ */
 void run_machine(machine_t *machine);
+
+/**
+ * Runs at most n instructions, one at a time, leaving the PC at the next one.
+ * A machine with several cores runs at most n on each.
+ *
+ * @return false if the machine stopped before running all of them, see
+ *         machine->exit for why.
+ */
+bool run_machine_steps(machine_t *machine, u64 n);
+
+/**
+ * Runs a single core of a machine as run_machine does, leaving its other
+ * cores alone, see cores.h.
+ */
+void run_core(machine_t *machine);
+
+/**
+ * Runs a single core of a machine as run_machine_steps does, leaving its
+ * other cores alone.
+ */
+bool run_core_steps(machine_t *machine, u64 n);
+
+/**
+ * Runs a single core of a machine for a turn of about n instructions, through
+ * the block engine and the JIT, stopping at the first block boundary after n.
+ * Cores with hooks attached run exactly n, as run_core_steps does.
+ *
+ * @return false if the core stopped, see machine->exit for why.
+ */
+bool run_core_turn(machine_t *machine, u64 n);
+
+/**
+ * Resets the registers, exclusive monitor and instruction caches of a core,
+ * but not its memory.
+ */
+void reset_core(machine_t *machine);
+
+/**
+ * Resets the memory and every core of a machine, so that nothing is left of
+ * the last program it ran.
+ */
+void reset_machine(machine_t *machine);
+
+/**
+ * Stops the running machine on an error, unwinding out of the instruction that
+ * raised it. Outside of a run there is nothing to unwind to, so the error is
+ * printed and the process exits.
+ *
+ * @param reason  MACHINE_MEMORY_FAULT, MACHINE_OUT_OF_MEMORY or
+ *                MACHINE_ALIGNMENT_FAULT.
+ * @param address The guest address that could not be accessed.
+ */
+_Noreturn void machine_fault(machine_t *machine, machine_stop_t reason,
+                             u64 address);
+
+/**
+ * Calls body, unwinding out of it if it faults. Calls nest, the innermost one
+ * catches the fault.
+ *
+ * @return false if body faulted, machine->exit says how.
+ */
+bool machine_catch_faults(machine_t *machine,
+                          void (*body)(machine_t *machine, void *arg),
+                          void *arg);
+
 void shutdown_machine(machine_t *machine, FILE *out_stream);
 
-void machine_load_program(machine_t *machine, const char *prg);
+/**
+ * Resets the machine and loads an image file at address 0.
+ *
+ * @return false if the file could not be read.
+ */
+bool machine_load_program(machine_t *machine, const char *prg);
 
 #endif /* MACHINE */
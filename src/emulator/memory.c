@@ -0,0 +1,539 @@
+#include "memory.h"
+#include "block.h"
+#include "decode.h"
+#include "hooks.h"
+#include "machine.h"
+#include "timeline.h"
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define TABLE_SPAN_BITS (PAGE_BITS + TABLE_BITS)
+
+/* backs loads from pages that have never been written */
+static const u8 zero_page[PAGE_SIZE];
+
+#define WORD_BITS 64
+
+/*
+ * Page data is preceded by its reference count: the machine holds one
+ * reference, and so does every snapshot the page was captured by.
+ */
+#define PAGE_HEADER 16
+
+static u32 *page_refs(u8 *data) { return (u32 *)(data - PAGE_HEADER); }
+
+static u8 *page_data_alloc(void) {
+  u8 *block = calloc(1, PAGE_HEADER + PAGE_SIZE);
+  if (block == NULL)
+    return NULL;
+  *(u32 *)block = 1;
+  return block + PAGE_HEADER;
+}
+
+void page_data_retain(u8 *data) {
+  __atomic_fetch_add(page_refs(data), 1, __ATOMIC_RELAXED);
+}
+
+void page_data_release(u8 *data) {
+  if (__atomic_sub_fetch(page_refs(data), 1, __ATOMIC_ACQ_REL) == 0)
+    free(data - PAGE_HEADER);
+}
+
+/* the last holder of shared data may write to it in place */
+static bool page_data_unique(u8 *data) {
+  return __atomic_load_n(page_refs(data), __ATOMIC_ACQUIRE) == 1;
+}
+
+/* drops the machine's reference to the data of a page */
+static void release_data(page_t *page) {
+  if (page->data != NULL && !(page->flags & PAGE_MAPPED))
+    page_data_release(page->data);
+  page->data = NULL;
+}
+
+static u64 table_count(const machine_t *m) {
+  return (m->memory_size + (1ULL << TABLE_SPAN_BITS) - 1) >> TABLE_SPAN_BITS;
+}
+
+static u64 dirty_word_count(const machine_t *m) {
+  u64 pages = m->memory_size >> PAGE_BITS;
+  return (pages + WORD_BITS - 1) / WORD_BITS;
+}
+
+static u64 summary_word_count(const machine_t *m) {
+  return (dirty_word_count(m) + WORD_BITS - 1) / WORD_BITS;
+}
+
+static bool is_dirty(const machine_t *m, u64 page_number) {
+  return (m->dirty_pages[page_number / WORD_BITS] >> (page_number % WORD_BITS)) &
+         1;
+}
+
+/* other cores may be marking pages of the same word, see cores.h */
+static void mark_dirty(machine_t *m, u64 page_number) {
+  if (is_dirty(m, page_number))
+    return;
+  u64 word = page_number / WORD_BITS;
+  __atomic_fetch_or(&m->dirty_pages[word], 1ULL << (page_number % WORD_BITS),
+                    __ATOMIC_RELAXED);
+  __atomic_fetch_or(&m->dirty_summary[word / WORD_BITS],
+                    1ULL << (word % WORD_BITS), __ATOMIC_RELAXED);
+}
+
+static void clear_dirty(machine_t *m, u64 page_number) {
+  u64 word = page_number / WORD_BITS;
+  m->dirty_pages[word] &= ~(1ULL << (page_number % WORD_BITS));
+  if (m->dirty_pages[word] == 0)
+    m->dirty_summary[word / WORD_BITS] &= ~(1ULL << (word % WORD_BITS));
+}
+
+/*
+ * Tables and page data are installed with a compare and swap, so cores sharing
+ * the memory can allocate the same page at once: the loser frees its copy.
+ * Once installed, neither is replaced while the cores run.
+ */
+static page_t *find_page(const machine_t *m, u64 address) {
+  page_t *table =
+      __atomic_load_n(&m->page_tables[address >> TABLE_SPAN_BITS],
+                      __ATOMIC_ACQUIRE);
+  if (table == NULL)
+    return NULL;
+  return &table[(address >> PAGE_BITS) & (TABLE_SIZE - 1)];
+}
+
+/* finds the page holding address, allocating its table but not its data */
+static page_t *table_page(machine_t *m, u64 address) {
+  page_t **slot = &m->page_tables[address >> TABLE_SPAN_BITS];
+  page_t *table = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+  if (table == NULL) {
+    page_t *fresh = calloc(TABLE_SIZE, sizeof(page_t));
+    if (fresh == NULL) {
+      machine_fault(m, MACHINE_OUT_OF_MEMORY, address);
+    }
+    if (__atomic_compare_exchange_n(slot, &table, fresh, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      table = fresh;
+    else
+      free(fresh);
+  }
+  return &table[(address >> PAGE_BITS) & (TABLE_SIZE - 1)];
+}
+
+static page_t *alloc_page(machine_t *m, u64 address) {
+  page_t *page = table_page(m, address);
+  u8 *data = __atomic_load_n(&page->data, __ATOMIC_ACQUIRE);
+  if (data == NULL) {
+    u8 *fresh = page_data_alloc();
+    if (fresh == NULL) {
+      machine_fault(m, MACHINE_OUT_OF_MEMORY, address);
+    }
+    if (!__atomic_compare_exchange_n(&page->data, &data, fresh, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      page_data_release(fresh);
+  }
+  return page;
+}
+
+/* unmaps the page holding address from the TLB */
+static void tlb_drop(machine_t *m, u64 address) {
+  u64 page_number = address >> PAGE_BITS;
+  tlb_entry_t *entry = &m->tlb[page_number & TLB_MASK];
+  if (entry->read_tag == page_number || entry->write_tag == page_number) {
+    entry->read_tag = TLB_INVALID;
+    entry->write_tag = TLB_INVALID;
+  }
+}
+
+/* gives the page private data the guest can write to */
+static page_t *writable_page(machine_t *m, u64 address) {
+  const page_t *known = find_page(m, address);
+  const u8 *before = known != NULL ? known->data : NULL;
+  page_t *page = alloc_page(m, address);
+  if ((page->flags & PAGE_SHARED) &&
+      ((page->flags & PAGE_MAPPED) || !page_data_unique(page->data))) {
+    u8 *copy = page_data_alloc();
+    if (copy == NULL) {
+      machine_fault(m, MACHINE_OUT_OF_MEMORY, address);
+    }
+    memcpy(copy, page->data, PAGE_SIZE);
+    release_data(page);
+    page->data = copy;
+  }
+  /* pages are unshared before cores run, so this only ever races with
+   * memory_set_flags when there is nothing to clear */
+  if (page->flags & (PAGE_SHARED | PAGE_MAPPED))
+    page->flags &= ~(PAGE_SHARED | PAGE_MAPPED);
+  mark_dirty(m, address >> PAGE_BITS);
+  /* the TLB may still map the zero page or the data just copied */
+  if (page->data != before)
+    tlb_drop(m, address);
+  return page;
+}
+
+static void release_image(machine_t *m) {
+  mapping_release(m->image);
+  m->image = NULL;
+}
+
+void memory_flush_tlb(machine_t *m) {
+  for (int i = 0; i < TLB_SIZE; i++) {
+    m->tlb[i].read_tag = TLB_INVALID;
+    m->tlb[i].write_tag = TLB_INVALID;
+  }
+}
+
+/* maps the page holding address, stores only go through it if it is dirty
+ * and unflagged; nothing is mapped while accesses are hooked */
+static void tlb_fill(machine_t *m, u64 address) {
+  if (m->hooks != NULL)
+    return;
+  u64 page_number = address >> PAGE_BITS;
+  tlb_entry_t *entry = &m->tlb[page_number & TLB_MASK];
+  const u8 *data = memory_page(m, address);
+
+  entry->read_tag = page_number;
+  if (data != NULL) {
+    entry->data = (u8 *)data;
+    bool writable = !find_page(m, address)->flags &&
+                    is_dirty(m, page_number) && m->timeline == NULL;
+    entry->write_tag = writable ? page_number : TLB_INVALID;
+  } else if (!m->shared_memory) {
+    /* never written to through this entry */
+    entry->data = (u8 *)zero_page;
+    entry->write_tag = TLB_INVALID;
+  } else {
+    /* another core may allocate the page at any time, so loads from it keep
+     * taking the slow path until it has data */
+    entry->read_tag = TLB_INVALID;
+    entry->write_tag = TLB_INVALID;
+  }
+}
+
+bool memory_init(machine_t *m, u64 size) {
+  if (size == 0 || size > MAX_MEMORY_SIZE)
+    return false;
+  m->memory_size = (size + PAGE_MASK) & ~PAGE_MASK;
+  m->page_tables = calloc(table_count(m), sizeof(page_t *));
+  m->dirty_pages = calloc(dirty_word_count(m), sizeof(u64));
+  m->dirty_summary = calloc(summary_word_count(m), sizeof(u64));
+  memory_flush_tlb(m);
+  return m->page_tables != NULL && m->dirty_pages != NULL &&
+         m->dirty_summary != NULL;
+}
+
+u64 memory_next_dirty(const machine_t *m, u64 address) {
+  u64 page_number = address >> PAGE_BITS;
+  u64 word = page_number / WORD_BITS;
+  u64 words = dirty_word_count(m);
+  if (word >= words)
+    return m->memory_size;
+
+  /* the rest of the current word */
+  u64 bits = m->dirty_pages[word] & (~0ULL << (page_number % WORD_BITS));
+  if (bits == 0) {
+    /* the summary points straight at the next non-zero word */
+    u64 summary_word = (word + 1) / WORD_BITS;
+    u64 summary = ~0ULL << ((word + 1) % WORD_BITS);
+    u64 summaries = summary_word_count(m);
+    while (summary_word < summaries &&
+           (m->dirty_summary[summary_word] & summary) == 0) {
+      summary_word++;
+      summary = ~0ULL;
+    }
+    if (summary_word >= summaries)
+      return m->memory_size;
+    word = summary_word * WORD_BITS +
+           __builtin_ctzll(m->dirty_summary[summary_word] & summary);
+    bits = m->dirty_pages[word];
+  }
+  return (word * WORD_BITS + __builtin_ctzll(bits)) << PAGE_BITS;
+}
+
+void memory_reset(machine_t *m) {
+  for (u64 page = memory_next_dirty(m, 0); page < m->memory_size;
+       page = memory_next_dirty(m, page + PAGE_SIZE)) {
+    page_t *entry = find_page(m, page);
+    if (entry->flags & PAGE_SHARED)
+      release_data(entry); /* part of the image or a snapshot */
+    else
+      memset(entry->data, 0, PAGE_SIZE);
+    entry->flags = 0;
+  }
+  release_image(m);
+  memset(m->dirty_pages, 0, dirty_word_count(m) * sizeof(u64));
+  memset(m->dirty_summary, 0, summary_word_count(m) * sizeof(u64));
+  memory_flush_tlb(m);
+}
+
+void memory_destroy(machine_t *m) {
+  if (m->page_tables != NULL) {
+    u64 tables = table_count(m);
+    for (u64 t = 0; t < tables; t++) {
+      page_t *table = m->page_tables[t];
+      if (table == NULL)
+        continue;
+      for (int i = 0; i < TABLE_SIZE; i++)
+        release_data(&table[i]);
+      free(table);
+    }
+  }
+  release_image(m);
+  free(m->page_tables);
+  free(m->dirty_pages);
+  free(m->dirty_summary);
+  m->page_tables = NULL;
+  m->dirty_pages = NULL;
+  m->dirty_summary = NULL;
+}
+
+const u8 *memory_page(const machine_t *m, u64 address) {
+  const page_t *page = find_page(m, address);
+  return page != NULL ? __atomic_load_n(&page->data, __ATOMIC_ACQUIRE) : NULL;
+}
+
+u8 *memory_page_for_write(machine_t *m, u64 address) {
+  return writable_page(m, address)->data;
+}
+
+bool memory_map_image(machine_t *m, int fd, u64 size) {
+  if (size == 0)
+    return true;
+  if (size > m->memory_size)
+    size = m->memory_size;
+
+  /* the tail of the last page reads as zeroes */
+  u64 mapped = (size + PAGE_MASK) & ~PAGE_MASK;
+  mapping_t *image = mapping_create(fd, mapped);
+  if (image == NULL)
+    return false;
+
+  mapping_release(m->image);
+  m->image = image;
+  for (u64 offset = 0; offset < mapped; offset += PAGE_SIZE) {
+    page_t *page = table_page(m, offset);
+    release_data(page); /* left over zeroed page of a reused machine */
+    page->data = image->data + offset;
+    page->flags = PAGE_SHARED | PAGE_MAPPED;
+    /* the image counts as written, so it shows up in the dump */
+    mark_dirty(m, offset >> PAGE_BITS);
+  }
+  memory_flush_tlb(m);
+  return true;
+}
+
+u64 memory_dirty_count(const machine_t *m) {
+  u64 count = 0;
+  u64 words = dirty_word_count(m);
+  for (u64 word = 0; word < words; word++)
+    count += __builtin_popcountll(m->dirty_pages[word]);
+  return count;
+}
+
+void memory_share_pages(machine_t *m, saved_page_t *pages) {
+  for (u64 page = memory_next_dirty(m, 0); page < m->memory_size;
+       page = memory_next_dirty(m, page + PAGE_SIZE)) {
+    page_t *entry = find_page(m, page);
+    bool mapped = entry->flags & PAGE_MAPPED;
+    if (!mapped)
+      page_data_retain(entry->data);
+    *pages++ = (saved_page_t){
+        .address = page, .data = entry->data, .mapped = mapped};
+    entry->flags |= PAGE_SHARED;
+  }
+  /* stores have to copy the pages now */
+  memory_flush_tlb(m);
+}
+
+void memory_restore_pages(machine_t *m, const saved_page_t *pages, u64 count) {
+  /* walk the dirty pages and the captured ones side by side */
+  u64 page = memory_next_dirty(m, 0);
+  u64 i = 0;
+  while (page < m->memory_size || i < count) {
+    u64 saved = i < count ? pages[i].address : m->memory_size;
+    if (page < saved) {
+      /* written since, but zero when captured */
+      page_t *entry = find_page(m, page);
+      if (entry->flags & PAGE_SHARED)
+        release_data(entry);
+      else
+        memset(entry->data, 0, PAGE_SIZE);
+      entry->flags = 0;
+      clear_dirty(m, page >> PAGE_BITS);
+      page = memory_next_dirty(m, page + PAGE_SIZE);
+      continue;
+    }
+
+    page_t *entry = table_page(m, saved);
+    if (entry->data != pages[i].data) {
+      /* written since it was captured, or captured from another machine */
+      release_data(entry);
+      entry->data = pages[i].data;
+      if (pages[i].mapped) {
+        entry->flags = PAGE_SHARED | PAGE_MAPPED;
+      } else {
+        page_data_retain(entry->data);
+        entry->flags = PAGE_SHARED;
+      }
+      mark_dirty(m, saved >> PAGE_BITS);
+    }
+    if (page == saved)
+      page = memory_next_dirty(m, page + PAGE_SIZE);
+    i++;
+  }
+  memory_flush_tlb(m);
+}
+
+bool memory_set_flags(machine_t *m, u64 address, u8 flags) {
+  if (address >= m->memory_size)
+    return false;
+  page_t *page = alloc_page(m, address);
+  u8 old = __atomic_fetch_or(&page->flags, flags, __ATOMIC_RELAXED);
+  bool added = (old & flags) != flags;
+
+  /* stores to the page have to take the slow path from now on */
+  u64 page_number = address >> PAGE_BITS;
+  tlb_entry_t *entry = &m->tlb[page_number & TLB_MASK];
+  if (entry->write_tag == page_number)
+    entry->write_tag = TLB_INVALID;
+  return added;
+}
+
+void memory_clear_flags(machine_t *m, u64 address, u8 flags) {
+  if (address >= m->memory_size)
+    return;
+  page_t *page = find_page(m, address);
+  if (page != NULL)
+    __atomic_fetch_and(&page->flags, (u8)~flags, __ATOMIC_RELAXED);
+}
+
+void memory_unshare(machine_t *m) {
+  for (u64 page = memory_next_dirty(m, 0); page < m->memory_size;
+       page = memory_next_dirty(m, page + PAGE_SIZE)) {
+    if (find_page(m, page)->flags & PAGE_SHARED)
+      writable_page(m, page);
+  }
+  memory_flush_tlb(m);
+}
+
+mapping_t *mapping_create(int fd, u64 size) {
+  mapping_t *mapping = malloc(sizeof(mapping_t));
+  if (mapping == NULL)
+    return NULL;
+  void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    free(mapping);
+    return NULL;
+  }
+  *mapping = (mapping_t){.data = data, .size = size, .refs = 1};
+  return mapping;
+}
+
+mapping_t *mapping_retain(mapping_t *mapping) {
+  if (mapping != NULL)
+    __atomic_fetch_add(&mapping->refs, 1, __ATOMIC_RELAXED);
+  return mapping;
+}
+
+void mapping_release(mapping_t *mapping) {
+  if (mapping == NULL ||
+      __atomic_sub_fetch(&mapping->refs, 1, __ATOMIC_ACQ_REL) != 0)
+    return;
+  munmap(mapping->data, mapping->size);
+  free(mapping);
+}
+
+/* the only bounds check: pages outside the address space never reach the TLB */
+static void check_in_bounds(machine_t *m, u64 address, int num_bytes) {
+  if (address > m->memory_size - num_bytes)
+    machine_fault(m, MACHINE_MEMORY_FAULT, address);
+}
+
+u64 memory_load_slow(machine_t *m, u64 address, int num_bytes) {
+  check_in_bounds(m, address, num_bytes);
+  u64 value = 0;
+  if ((address & PAGE_MASK) + num_bytes <= PAGE_SIZE) {
+    const u8 *data = memory_page(m, address);
+    if (data != NULL)
+      memcpy(&value, data + (address & PAGE_MASK), num_bytes);
+  } else {
+    /* straddles two pages */
+    for (int i = 0; i < num_bytes; i++) {
+      const u8 *data = memory_page(m, address + i);
+      if (data != NULL)
+        value |= (u64)data[(address + i) & PAGE_MASK] << (8 * i);
+    }
+  }
+  tlb_fill(m, address);
+  if (m->hooks != NULL)
+    hooks_mem_read(m, address, value, num_bytes);
+  return value;
+}
+
+bool memory_compare_exchange(machine_t *m, u64 address, u64 expected,
+                             u64 desired, int num_bytes) {
+  check_in_bounds(m, address, num_bytes);
+  if (m->timeline != NULL)
+    timeline_record_store(m, address, num_bytes);
+
+  page_t *page = writable_page(m, address);
+  u8 *data = page->data + (address & PAGE_MASK);
+  bool swapped;
+  if (num_bytes == 8) {
+    swapped = __atomic_compare_exchange_n((u64 *)data, &expected, desired,
+                                          false, __ATOMIC_SEQ_CST,
+                                          __ATOMIC_SEQ_CST);
+  } else if (num_bytes == 4) {
+    u32 old = (u32)expected;
+    swapped = __atomic_compare_exchange_n((u32 *)data, &old, (u32)desired,
+                                          false, __ATOMIC_SEQ_CST,
+                                          __ATOMIC_SEQ_CST);
+  } else if (num_bytes == 2) {
+    u16 old = (u16)expected;
+    swapped = __atomic_compare_exchange_n((u16 *)data, &old, (u16)desired,
+                                          false, __ATOMIC_SEQ_CST,
+                                          __ATOMIC_SEQ_CST);
+  } else {
+    u8 old = (u8)expected;
+    swapped = __atomic_compare_exchange_n(data, &old, (u8)desired, false,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  }
+
+  if (swapped) {
+    if (m->hooks != NULL)
+      hooks_mem_write(m, address, desired, num_bytes);
+    if (page->flags & PAGE_DECODED)
+      decode_cache_invalidate(m, address, num_bytes);
+    if (page->flags & PAGE_CODE)
+      block_cache_invalidate(m, address, num_bytes);
+  }
+  tlb_fill(m, address);
+  return swapped;
+}
+
+void memory_store_slow(machine_t *m, u64 address, u64 value, int num_bytes) {
+  check_in_bounds(m, address, num_bytes);
+  if (m->timeline != NULL)
+    timeline_record_store(m, address, num_bytes);
+  if (m->hooks != NULL)
+    hooks_mem_write(m, address, value, num_bytes);
+
+  u8 flags = 0;
+  if ((address & PAGE_MASK) + num_bytes <= PAGE_SIZE) {
+    page_t *page = writable_page(m, address);
+    memcpy(page->data + (address & PAGE_MASK), &value, num_bytes);
+    flags = page->flags;
+  } else {
+    for (int i = 0; i < num_bytes; i++) {
+      page_t *page = writable_page(m, address + i);
+      page->data[(address + i) & PAGE_MASK] = (u8)(value >> (8 * i));
+      flags |= page->flags;
+    }
+  }
+
+  /* the store may have overwritten instructions that are cached */
+  if (flags & PAGE_DECODED)
+    decode_cache_invalidate(m, address, num_bytes);
+  if (flags & PAGE_CODE)
+    block_cache_invalidate(m, address, num_bytes);
+  tlb_fill(m, address);
+}
@@ -0,0 +1,315 @@
+#ifndef MEMORY
+#define MEMORY
+
+#include "../defs.h"
+#include "emulate.h"
+#include <stdbool.h>
+#include <string.h>
+
+/*
+ * Guest memory is a two level page table. Pages are only allocated when they
+ * are first written, reading an untouched page yields zeroes. Pages of the
+ * loaded image point into a read-only mapping of the file until written. Recently used
+ * pages are found through a direct mapped TLB, so most accesses never walk the
+ * table.
+ *
+ * Written pages are tracked in a bitmap, so dumping or resetting memory only
+ * visits those. The TLB only lets stores through to pages that are already
+ * dirty, so the fast path never has to update the bitmap.
+ *
+ * The cores of a machine share its page table and bitmaps, each through a TLB
+ * of its own; see cores.h for what that allows.
+ */
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "guest memory is accessed with host loads, which must be little-endian"
+#endif
+
+#define PAGE_MASK ((u64)PAGE_SIZE - 1)
+#define TLB_MASK (TLB_SIZE - 1)
+#define TLB_INVALID UINT64_MAX
+
+/* each second level table maps 2^TABLE_BITS pages */
+#define TABLE_BITS 9
+#define TABLE_SIZE (1 << TABLE_BITS)
+
+/* largest supported guest address space */
+#define MAX_MEMORY_SIZE (1ULL << 40)
+
+/* page flags, stores to flagged pages never go through the TLB */
+#define PAGE_DECODED 0x1 /* holds instructions in the predecode cache */
+#define PAGE_CODE 0x2    /* holds instructions of translated blocks */
+#define PAGE_SHARED 0x4  /* data may be shared, copied on the first store */
+#define PAGE_MAPPED 0x8  /* data points into the image mapping */
+
+/*
+ * A read-only file mapping that pages point into. It is unmapped once the
+ * last machine or snapshot using it lets go.
+ */
+typedef struct mapping {
+  u8 *data;
+  u64 size;
+  u32 refs;
+} mapping_t;
+
+/* a page captured by a snapshot */
+typedef struct {
+  u64 address;
+  u8 *data;    /* PAGE_SIZE bytes, never written again */
+  bool mapped; /* data points into a mapping rather than being counted */
+} saved_page_t;
+
+/**
+ * Adds a reference to the data of a page that is not PAGE_MAPPED.
+ */
+void page_data_retain(u8 *data);
+
+/**
+ * Drops a reference to the data of a page that is not PAGE_MAPPED, freeing it
+ * if it was the last one.
+ */
+void page_data_release(u8 *data);
+
+/**
+ * Maps the first size bytes of a file read-only, with one reference.
+ *
+ * @return the mapping, or NULL if the file could not be mapped.
+ */
+mapping_t *mapping_create(int fd, u64 size);
+
+/**
+ * Adds a reference to a mapping, which may be NULL.
+ *
+ * @return the mapping.
+ */
+mapping_t *mapping_retain(mapping_t *mapping);
+
+/**
+ * Drops a reference to a mapping, which may be NULL, unmapping it if it was
+ * the last one.
+ */
+void mapping_release(mapping_t *mapping);
+
+/**
+ * Allocates the page directory of a machine.
+ *
+ * @param size Size of the address space, rounded up to whole pages.
+ * @return false if size is too large or the directory could not be allocated.
+ */
+bool memory_init(machine_t *m, u64 size);
+
+/**
+ * Frees every page of a machine and its page directory.
+ */
+void memory_destroy(machine_t *m);
+
+/**
+ * Zeroes every page written since the last reset and unmaps the image. Pages
+ * stay allocated so a reused machine does not have to allocate them again.
+ */
+void memory_reset(machine_t *m);
+
+/**
+ * Maps an image file and installs its pages, starting at address 0, as
+ * copy-on-write backing: nothing is read until the guest touches a page, and
+ * machines loading the same file share its pages until they write to them.
+ *
+ * @param fd   The open image file.
+ * @param size Size of the file in bytes.
+ * @return false if the file could not be mapped, memory is left untouched.
+ */
+bool memory_map_image(machine_t *m, int fd, u64 size);
+
+/**
+ * Returns the number of pages written since the last reset.
+ */
+u64 memory_dirty_count(const machine_t *m);
+
+/**
+ * Captures every page written since the last reset into pages, in address
+ * order, with a reference to each. The machine keeps using the captured data
+ * but copies a page before its next store to it, so capturing never copies
+ * anything.
+ *
+ * @param pages PRE: Has room for memory_dirty_count(m) entries.
+ */
+void memory_share_pages(machine_t *m, saved_page_t *pages);
+
+/**
+ * Makes memory hold exactly the captured pages, sharing them copy-on-write.
+ * Mapped pages must point into m->image.
+ * Only pages whose data differs from the captured data, i.e. were written
+ * since they were captured, are touched. Does not invalidate any cached
+ * instructions.
+ *
+ * @param pages PRE: count pages in address order, all below m->memory_size.
+ */
+void memory_restore_pages(machine_t *m, const saved_page_t *pages, u64 count);
+
+/**
+ * Returns the address of the first page at or after address that has been
+ * written since the last reset, or m->memory_size if there is none.
+ *
+ * @param address PRE: Is page aligned.
+ */
+u64 memory_next_dirty(const machine_t *m, u64 address);
+
+/**
+ * Returns the page holding address, or NULL if it has never been allocated.
+ *
+ * @param address PRE: address < m->memory_size.
+ */
+const u8 *memory_page(const machine_t *m, u64 address);
+
+/**
+ * Returns the page holding address for writing, allocating (or copying) it if
+ * needed and marking it dirty. Does not invalidate any cached instructions.
+ *
+ * @param address PRE: address < m->memory_size.
+ */
+u8 *memory_page_for_write(machine_t *m, u64 address);
+
+/**
+ * Sets flags on the page holding address, allocating it if needed.
+ *
+ * @return true if any of the flags were not set before.
+ */
+bool memory_set_flags(machine_t *m, u64 address, u8 flags);
+
+/**
+ * Clears flags on the page holding address, if it exists.
+ */
+void memory_clear_flags(machine_t *m, u64 address, u8 flags);
+
+/**
+ * Gives every page that is still shared copy-on-write, with the image or a
+ * snapshot, private data of its own, then drops every TLB entry. Afterwards
+ * the data of a page stays where it is until memory is reset, which is what
+ * lets several cores use the same pages.
+ */
+void memory_unshare(machine_t *m);
+
+/**
+ * Drops every TLB entry, e.g. after pages were replaced or stores have to be
+ * seen by the slow path.
+ */
+void memory_flush_tlb(machine_t *m);
+
+/*
+ * Slow paths of memory_load and memory_store. They are also the only place
+ * accesses are bounds checked: the TLB never holds a page outside the address
+ * space, so it doubles as a guard around it. An access outside it is a
+ * MACHINE_MEMORY_FAULT, see machine_fault in machine.h.
+ */
+u64 memory_load_slow(machine_t *m, u64 address, int num_bytes);
+void memory_store_slow(machine_t *m, u64 address, u64 value, int num_bytes);
+
+/**
+ * Atomically replaces the value at address with desired if it still holds
+ * expected, invalidating any cached instructions it overwrites.
+ *
+ * @param address   PRE: Is a multiple of num_bytes.
+ * @param num_bytes PRE: 1, 2, 4 or 8.
+ * @return true if the value was replaced.
+ */
+bool memory_compare_exchange(machine_t *m, u64 address, u64 expected,
+                             u64 desired, int num_bytes);
+
+/**
+ * Reads a little-endian value from guest memory. Whenever the 8 bytes from
+ * address lie in a page held by the TLB this is a single host load.
+ *
+ * @param num_bytes PRE: 1 to 8.
+ */
+static inline u64 memory_load(machine_t *m, u64 address, int num_bytes) {
+  u64 page = address >> PAGE_BITS;
+  const tlb_entry_t *entry = &m->tlb[page & TLB_MASK];
+  if (entry->read_tag == page &&
+      (address & PAGE_MASK) <= PAGE_SIZE - sizeof(u64)) {
+    u64 value;
+    memcpy(&value, entry->data + (address & PAGE_MASK), sizeof(u64));
+    return value & (UINT64_MAX >> (64 - 8 * num_bytes));
+  }
+  return memory_load_slow(m, address, num_bytes);
+}
+
+/**
+ * Writes a little-endian value to guest memory, invalidating any cached
+ * instructions it overwrites.
+ *
+ * @param num_bytes PRE: 1 to 8.
+ */
+static inline void memory_store(machine_t *m, u64 address, u64 value,
+                                int num_bytes) {
+  u64 page = address >> PAGE_BITS;
+  const tlb_entry_t *entry = &m->tlb[page & TLB_MASK];
+  if (entry->write_tag == page &&
+      (address & PAGE_MASK) <= PAGE_SIZE - sizeof(u64)) {
+    u8 *data = entry->data + (address & PAGE_MASK);
+    /* constant sizes become single host stores */
+    if (num_bytes == 8)
+      memcpy(data, &value, 8);
+    else if (num_bytes == 4)
+      memcpy(data, &value, 4);
+    else
+      memcpy(data, &value, num_bytes);
+    return;
+  }
+  memory_store_slow(m, address, value, num_bytes);
+}
+
+/**
+ * Reads the two consecutive values of a load pair. Whenever both lie in a page
+ * held by the TLB this is a single 16-byte host load.
+ *
+ * @param num_bytes PRE: 4 or 8, the size of each value.
+ */
+static inline void memory_load_pair(machine_t *m, u64 address, int num_bytes,
+                                    u64 *first, u64 *second) {
+  u64 page = address >> PAGE_BITS;
+  const tlb_entry_t *entry = &m->tlb[page & TLB_MASK];
+  if (entry->read_tag == page &&
+      (address & PAGE_MASK) <= PAGE_SIZE - 2 * sizeof(u64)) {
+    u64 pair[2];
+    memcpy(pair, entry->data + (address & PAGE_MASK), sizeof(pair));
+    if (num_bytes == 8) {
+      *first = pair[0];
+      *second = pair[1];
+    } else {
+      *first = (u32)pair[0];
+      *second = pair[0] >> 32;
+    }
+    return;
+  }
+  *first = memory_load_slow(m, address, num_bytes);
+  *second = memory_load_slow(m, address + num_bytes, num_bytes);
+}
+
+/**
+ * Writes the two consecutive values of a store pair, invalidating any cached
+ * instructions they overwrite. Whenever both lie in a page held by the TLB
+ * this is a single host store.
+ *
+ * @param num_bytes PRE: 4 or 8, the size of each value.
+ */
+static inline void memory_store_pair(machine_t *m, u64 address, u64 first,
+                                     u64 second, int num_bytes) {
+  u64 page = address >> PAGE_BITS;
+  const tlb_entry_t *entry = &m->tlb[page & TLB_MASK];
+  if (entry->write_tag == page &&
+      (address & PAGE_MASK) <= PAGE_SIZE - 2 * sizeof(u64)) {
+    u8 *data = entry->data + (address & PAGE_MASK);
+    if (num_bytes == 8) {
+      u64 pair[2] = {first, second};
+      memcpy(data, pair, sizeof(pair));
+    } else {
+      u64 pair = (u32)first | second << 32;
+      memcpy(data, &pair, sizeof(pair));
+    }
+    return;
+  }
+  memory_store_slow(m, address, first, num_bytes);
+  memory_store_slow(m, address + num_bytes, second, num_bytes);
+}
+
+#endif /* MEMORY */
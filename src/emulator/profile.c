@@ -0,0 +1,156 @@
+#include "profile.h"
+#include "memory.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct profile {
+  u64 *counts;     /* runs of the instruction at each PC / 4 */
+  u64 count_slots; /* entries in counts */
+  u64 class_counts[CLASS_COUNT];
+};
+
+static const char *const class_names[CLASS_COUNT] = {
+    [CLASS_DP_IMM] = "data processing (immediate)",
+    [CLASS_DP_REG] = "data processing (register)",
+    [CLASS_LOAD_STORE] = "loads and stores",
+    [CLASS_BRANCH] = "branches",
+    [CLASS_SIMD] = "SIMD",
+    [CLASS_OTHER] = "other",
+};
+
+/* a line of the report: a run of instructions and how often it ran */
+typedef struct {
+  reg pc;
+  u64 len;    /* instructions */
+  u64 runs;   /* times each instruction ran */
+  u64 weight; /* what the table is sorted by */
+} hot_entry_t;
+
+bool profile_init(machine_t *m) {
+  profile_destroy(m);
+  struct profile *p = calloc(1, sizeof(struct profile));
+  if (p == NULL)
+    return false;
+  p->count_slots = m->memory_size / sizeof(instruction);
+  /* calloc leaves the pages of code that never runs untouched */
+  p->counts = calloc(p->count_slots, sizeof(u64));
+  if (p->counts == NULL) {
+    free(p);
+    return false;
+  }
+  m->profile = p;
+  return true;
+}
+
+void profile_destroy(machine_t *m) {
+  if (m->profile == NULL)
+    return;
+  free(m->profile->counts);
+  free(m->profile);
+  m->profile = NULL;
+}
+
+void profile_count(machine_t *m, reg pc, const decoded_instr_t *d) {
+  struct profile *p = m->profile;
+  if (pc / sizeof(instruction) < p->count_slots)
+    p->counts[pc / sizeof(instruction)]++;
+  p->class_counts[d->instr_class]++;
+}
+
+void profile_add_block(machine_t *m, const block_t *b) {
+  struct profile *p = m->profile;
+  for (u32 i = 0; i < b->len; i++) {
+    u64 slot = b->pc / sizeof(instruction) + i;
+    if (slot < p->count_slots)
+      p->counts[slot] += b->count;
+    p->class_counts[b->ops[i].d.instr_class] += b->count;
+  }
+}
+
+void profile_skip_block(machine_t *m, const block_t *b, reg pc) {
+  struct profile *p = m->profile;
+  if (pc <= b->pc)
+    return;
+  for (u32 i = (pc - b->pc) / sizeof(instruction); i < b->len; i++) {
+    u64 slot = b->pc / sizeof(instruction) + i;
+    if (slot < p->count_slots)
+      p->counts[slot]--;
+    p->class_counts[b->ops[i].d.instr_class]--;
+  }
+}
+
+/* keeps the PROFILE_TOP heaviest entries, heaviest first */
+static void add_hot(hot_entry_t *top, int *count, hot_entry_t entry) {
+  if (*count == PROFILE_TOP && top[*count - 1].weight >= entry.weight)
+    return;
+  int i = *count < PROFILE_TOP ? (*count)++ : PROFILE_TOP - 1;
+  for (; i > 0 && top[i - 1].weight < entry.weight; i--)
+    top[i] = top[i - 1];
+  top[i] = entry;
+}
+
+static bool ends_block(machine_t *m, reg pc) {
+  decoded_instr_t d;
+  decode_instr(memory_load(m, pc, sizeof(instruction)), pc, &d);
+  return d.ends_block;
+}
+
+static double percent(u64 n, u64 total) {
+  return total != 0 ? 100.0 * n / total : 0.0;
+}
+
+void profile_report(machine_t *m, FILE *out) {
+  struct profile *p = m->profile;
+  /* dropping the live blocks folds in their counts */
+  block_cache_flush(m);
+
+  u64 total = 0;
+  for (int c = 0; c < CLASS_COUNT; c++)
+    total += p->class_counts[c];
+  fprintf(out, "Profile:\n");
+  fprintf(out, "Instructions run: %" PRIu64 "\n", total);
+  for (int c = 0; c < CLASS_COUNT; c++) {
+    fprintf(out, "  %-28s %14" PRIu64 " (%5.1f%%)\n", class_names[c],
+            p->class_counts[c], percent(p->class_counts[c], total));
+  }
+
+  hot_entry_t addresses[PROFILE_TOP], blocks[PROFILE_TOP];
+  int address_count = 0, block_count = 0;
+  for (u64 slot = 0; slot < p->count_slots;) {
+    u64 runs = p->counts[slot];
+    if (runs == 0) {
+      slot++;
+      continue;
+    }
+    /* a block runs until its count changes or an instruction may branch */
+    hot_entry_t block = {.pc = slot * sizeof(instruction), .runs = runs};
+    do {
+      reg pc = slot * sizeof(instruction);
+      add_hot(addresses, &address_count,
+              (hot_entry_t){.pc = pc, .len = 1, .runs = runs, .weight = runs});
+      block.len++;
+      slot++;
+      if (ends_block(m, pc))
+        break;
+    } while (slot < p->count_slots && p->counts[slot] == runs);
+    block.weight = block.len * runs;
+    add_hot(blocks, &block_count, block);
+  }
+
+  fprintf(out, "Hot addresses:\n");
+  for (int i = 0; i < address_count; i++) {
+    fprintf(out, "  0x%08" PRIx64 " %14" PRIu64 " (%5.1f%%)\n",
+            addresses[i].pc, addresses[i].runs,
+            percent(addresses[i].runs, total));
+  }
+  fprintf(out, "Hot blocks:\n");
+  for (int i = 0; i < block_count; i++) {
+    reg last = blocks[i].pc + (blocks[i].len - 1) * sizeof(instruction);
+    fprintf(out,
+            "  0x%08" PRIx64 "-0x%08" PRIx64 " %14" PRIu64
+            " runs, %" PRIu64 " instructions (%5.1f%%)\n",
+            blocks[i].pc, last, blocks[i].runs, blocks[i].weight,
+            percent(blocks[i].weight, total));
+  }
+}
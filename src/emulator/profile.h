@@ -0,0 +1,55 @@
+#ifndef PROFILE
+#define PROFILE
+
+#include "../defs.h"
+#include "block.h"
+#include "decode.h"
+#include "emulate.h"
+#include <stdio.h>
+
+/*
+ * Counts how often every instruction runs, in a flat array indexed by PC / 4.
+ * The block engine only counts block entries; the counts are spread over the
+ * instructions of a block when the translation cache is flushed, so profiling
+ * costs next to nothing per instruction.
+ */
+
+/* entries in each table of the report */
+#define PROFILE_TOP 10
+
+/**
+ * Starts counting the instructions a machine runs.
+ *
+ * @return false if the counters could not be allocated.
+ */
+bool profile_init(machine_t *m);
+
+/**
+ * Frees the counters of a machine, if it has any.
+ */
+void profile_destroy(machine_t *m);
+
+/**
+ * Counts one run of an instruction executed outside of a block.
+ */
+void profile_count(machine_t *m, reg pc, const decoded_instr_t *d);
+
+/**
+ * Adds the runs of a block, each entry counting every instruction in it, to
+ * the counters. Called as the block is dropped.
+ */
+void profile_add_block(machine_t *m, const block_t *b);
+
+/**
+ * Takes back the counts of the instructions of a block from pc on, which were
+ * skipped because the block was left early.
+ */
+void profile_skip_block(machine_t *m, const block_t *b, reg pc);
+
+/**
+ * Writes the number of instructions run by class, and the most run addresses
+ * and blocks.
+ */
+void profile_report(machine_t *m, FILE *out);
+
+#endif /* PROFILE */
@@ -0,0 +1,252 @@
+#include "server.h"
+#include "jit.h"
+#include "machine.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *const stop_names[] = {
+    [MACHINE_RUNNING] = "running",
+    [MACHINE_HALTED] = "halted",
+    [MACHINE_INVALID_INSTRUCTION] = "invalid-instruction",
+    [MACHINE_UNSUPPORTED_INSTRUCTION] = "unsupported-instruction",
+    [MACHINE_MEMORY_FAULT] = "memory-fault",
+    [MACHINE_OUT_OF_MEMORY] = "out-of-memory",
+    [MACHINE_ALIGNMENT_FAULT] = "alignment-fault",
+};
+
+typedef struct {
+  int listener;
+  bool stopping; /* set by a shutdown request, read by every worker */
+  bool failed;   /* the listener stopped working without a request */
+} server_t;
+
+typedef struct {
+  server_t *server;
+  machine_t *m;
+} worker_t;
+
+/* ======== requests ======== */
+
+static bool load_image(machine_t *m, FILE *in, FILE *out, const char *arg) {
+  char *end;
+  u64 size = strtoull(arg, &end, 0);
+  if (end == arg || size > m->memory_size) {
+    fprintf(out, "error invalid image size\n");
+    /* the image can not be skipped without its size, so give up on the client */
+    return false;
+  }
+  u8 *image = malloc(size);
+  if (image == NULL || fread(image, 1, size, in) != size) {
+    free(image);
+    return false;
+  }
+  if (machine_load(m, image, size))
+    fprintf(out, "ok\n");
+  else
+    fprintf(out, "error could not load the image\n");
+  free(image);
+  return true;
+}
+
+static void run(machine_t *m, FILE *out, const char *arg) {
+  if (*arg == '\0')
+    run_machine(m);
+  else
+    run_machine_steps(m, strtoull(arg, NULL, 0));
+  const machine_exit_t *exit = &m->exit;
+  fprintf(out, "ok %s 0x%" PRIx64, stop_names[exit->reason], exit->pc);
+  if (exit->reason == MACHINE_MEMORY_FAULT ||
+      exit->reason == MACHINE_OUT_OF_MEMORY ||
+      exit->reason == MACHINE_ALIGNMENT_FAULT)
+    fprintf(out, " 0x%" PRIx64, exit->address);
+  fprintf(out, "\n");
+}
+
+static void dump(machine_t *m, FILE *out) {
+  char *data = NULL;
+  size_t size = 0;
+  FILE *stream = open_memstream(&data, &size);
+  if (stream == NULL) {
+    fprintf(out, "error out of memory\n");
+    return;
+  }
+  shutdown_machine(m, stream);
+  fclose(stream);
+  fprintf(out, "ok %zu\n", size);
+  fwrite(data, 1, size, out);
+  free(data);
+}
+
+/* serves a client until it disconnects, or asks the server to stop */
+static void serve(worker_t *worker, int fd) {
+  FILE *in = fdopen(fd, "r");
+  int out_fd = dup(fd);
+  FILE *out = out_fd < 0 ? NULL : fdopen(out_fd, "w");
+  if (in == NULL || out == NULL) {
+    if (in != NULL)
+      fclose(in);
+    else
+      close(fd);
+    if (out != NULL)
+      fclose(out);
+    else if (out_fd >= 0)
+      close(out_fd);
+    return;
+  }
+
+  machine_t *m = worker->m;
+  char line[SERVER_MAX_LINE];
+  bool open = true;
+  while (open && fgets(line, sizeof(line), in) != NULL) {
+    line[strcspn(line, "\r\n")] = '\0';
+    char *arg = line + strcspn(line, " ");
+    if (*arg != '\0')
+      *arg++ = '\0';
+
+    if (strcmp(line, "load") == 0) {
+      if (machine_load_program(m, arg))
+        fprintf(out, "ok\n");
+      else
+        fprintf(out, "error could not read %s\n", arg);
+    } else if (strcmp(line, "image") == 0) {
+      open = load_image(m, in, out, arg);
+    } else if (strcmp(line, "run") == 0) {
+      run(m, out, arg);
+    } else if (strcmp(line, "dump") == 0) {
+      dump(m, out);
+    } else if (strcmp(line, "shutdown") == 0) {
+      __atomic_store_n(&worker->server->stopping, true, __ATOMIC_RELEASE);
+      /* wakes every worker waiting in accept */
+      shutdown(worker->server->listener, SHUT_RDWR);
+      fprintf(out, "ok\n");
+      open = false;
+    } else {
+      fprintf(out, "error unknown request %s\n", line);
+    }
+    /* the client waits for each reply before sending anything else */
+    fflush(out);
+  }
+  fclose(in);
+  fclose(out);
+}
+
+static void *worker_main(void *arg) {
+  worker_t *worker = arg;
+  long backoff_ns = 0;
+  while (!__atomic_load_n(&worker->server->stopping, __ATOMIC_ACQUIRE)) {
+    int fd = accept(worker->server->listener, NULL, NULL);
+    if (fd >= 0) {
+      /* nothing of the last client's program is left for the next */
+      reset_machine(worker->m);
+      serve(worker, fd);
+      backoff_ns = 0;
+    } else if (errno == EBADF || errno == EINVAL || errno == ENOTSOCK ||
+               errno == EOPNOTSUPP) {
+      /* the listener is unusable, unless this is the shutdown wakeup */
+      if (!__atomic_load_n(&worker->server->stopping, __ATOMIC_ACQUIRE)) {
+        perror("accept");
+        /* the other workers stop as on a shutdown request */
+        __atomic_store_n(&worker->server->failed, true, __ATOMIC_RELEASE);
+        __atomic_store_n(&worker->server->stopping, true, __ATOMIC_RELEASE);
+        shutdown(worker->server->listener, SHUT_RDWR);
+      }
+      break;
+    } else if (errno != EINTR && errno != ECONNABORTED) {
+      /* out of descriptors or memory, wait for connections to close */
+      backoff_ns = backoff_ns == 0 ? SERVER_BACKOFF_MIN_NS : backoff_ns * 2;
+      if (backoff_ns > SERVER_BACKOFF_MAX_NS)
+        backoff_ns = SERVER_BACKOFF_MAX_NS;
+      struct timespec nap = {.tv_sec = backoff_ns / 1000000000,
+                             .tv_nsec = backoff_ns % 1000000000};
+      nanosleep(&nap, NULL);
+    }
+  }
+  return NULL;
+}
+
+/* ======== setup ======== */
+
+static int listen_on(const char *path) {
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "The socket path %s is too long\n", path);
+    return -1;
+  }
+  strcpy(address.sun_path, path);
+
+  /* a socket left behind by an earlier server is replaced, nothing else is */
+  struct stat st;
+  if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 ||
+      bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(fd, SERVER_BACKLOG) != 0) {
+    perror(path);
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool run_server(const char *path, int threads, bool use_jit, u64 memory_size,
+                bool fast_forward) {
+  if (threads <= 0)
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads < 1)
+    threads = 1;
+
+  /* every machine is allocated up front, not when a client connects */
+  worker_t *workers = calloc(threads, sizeof(worker_t));
+  pthread_t *tids = calloc(threads, sizeof(pthread_t));
+  server_t server = {.listener = -1};
+  bool ready = workers != NULL && tids != NULL;
+  for (int i = 0; ready && i < threads; i++) {
+    workers[i] = (worker_t){.server = &server,
+                            .m = machine_create(memory_size)};
+    ready = workers[i].m != NULL;
+    if (ready) {
+      workers[i].m->fast_forward = fast_forward;
+      if (use_jit)
+        jit_init(workers[i].m);
+    }
+  }
+  if (!ready)
+    fprintf(stderr, "Could not allocate the server machines.\n");
+  else
+    ready = (server.listener = listen_on(path)) >= 0;
+
+  if (ready) {
+    /* a client that goes away mid-reply must not take the server with it */
+    signal(SIGPIPE, SIG_IGN);
+    int started = 0;
+    for (; started < threads; started++) {
+      if (pthread_create(&tids[started], NULL, worker_main, &workers[started]))
+        break;
+    }
+    if (started == 0) /* serve on this thread instead */
+      worker_main(&workers[0]);
+    for (int i = 0; i < started; i++)
+      pthread_join(tids[i], NULL);
+    close(server.listener);
+    unlink(path);
+  }
+
+  for (int i = 0; workers != NULL && i < threads; i++)
+    machine_destroy(workers[i].m);
+  free(workers);
+  free(tids);
+  return ready && !server.failed;
+}
@@ -0,0 +1,56 @@
+#ifndef SERVER
+#define SERVER
+
+#include "../defs.h"
+#include <stdbool.h>
+
+/*
+ * A resident emulator, so that tools running many short programs pay for
+ * starting the process and allocating machines once rather than per program.
+ *
+ * Clients connect to a Unix domain socket and send requests, one per line.
+ * Every request gets a reply line starting with "ok" or "error <why>":
+ *
+ *   load <path>     resets the machine and loads an image file.
+ *   image <size>    the same, for an image of size bytes following the line.
+ *   run [n]         runs until the machine stops, or at most n instructions.
+ *                   Replies "ok <how> <pc>" with how one of running, halted,
+ *                   invalid-instruction, unsupported-instruction,
+ *                   memory-fault, out-of-memory or alignment-fault; the three
+ *                   memory errors are followed by the address.
+ *   dump            replies "ok <size>" followed by size bytes, the state of
+ *                   the machine in the format of shutdown_machine.
+ *   shutdown        stops accepting connections, the server exits once the
+ *                   open ones are closed.
+ *
+ * Each connection has a machine to itself for as long as it is open, reset
+ * when the connection is accepted. The machines are allocated once and kept
+ * from one connection to the next.
+ */
+
+/* longest request line accepted */
+#define SERVER_MAX_LINE 4096
+
+/* pending connections queued before clients are refused */
+#define SERVER_BACKLOG 64
+
+/* bounds of the wait after accept fails for want of resources, doubling */
+#define SERVER_BACKOFF_MIN_NS 1000000L
+#define SERVER_BACKOFF_MAX_NS 1000000000L
+
+/**
+ * Serves requests on a socket until a client asks the server to shut down.
+ *
+ * @param path     Path of the socket, replaced if a socket is already there.
+ * @param threads  Number of machines, so of connections served at once, 0 for
+ *                 one per online CPU.
+ * @param use_jit  Whether the machines compile hot blocks.
+ * @param memory_size Size of the address space of every machine.
+ * @param fast_forward Whether delay loops are skipped, see block.h.
+ * @return false if the socket or the machines could not be set up, or the
+ *         socket stopped accepting connections.
+ */
+bool run_server(const char *path, int threads, bool use_jit, u64 memory_size,
+                bool fast_forward);
+
+#endif /* SERVER */
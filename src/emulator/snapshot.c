@@ -0,0 +1,209 @@
+#include "snapshot.h"
+#include "block.h"
+#include "decode.h"
+#include "flags.h"
+#include "memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_MAGIC "A64SNAP2"
+
+struct snapshot {
+  u32 refs;
+  u64 memory_size;
+  reg PC;
+  reg SP;
+  PSTATE pstate; /* with the flags worked out */
+  reg_file regs;
+  vreg vregs[VREG_COUNT];
+  u64 page_count;
+  saved_page_t *pages; /* in address order */
+  mapping_t *image;    /* mapping the mapped pages point into, or NULL */
+};
+
+/*
+ * Layout of a snapshot file: the header, the address of every page, then the
+ * page data starting at a page aligned offset, so it can be mapped.
+ */
+typedef struct {
+  char magic[8];
+  u64 memory_size;
+  u64 page_count;
+  u64 data_offset;
+  reg PC;
+  reg SP;
+  reg_file regs;
+  u8 nzcv[4];
+  vreg vregs[VREG_COUNT];
+} snapshot_header_t;
+
+static snapshot_t *snapshot_alloc(u64 page_count) {
+  snapshot_t *s = calloc(1, sizeof(snapshot_t));
+  if (s == NULL)
+    return NULL;
+  s->pages = calloc(page_count ? page_count : 1, sizeof(saved_page_t));
+  if (s->pages == NULL) {
+    free(s);
+    return NULL;
+  }
+  s->refs = 1;
+  s->page_count = page_count;
+  return s;
+}
+
+void snapshot_release(snapshot_t *s) {
+  if (s == NULL || __atomic_sub_fetch(&s->refs, 1, __ATOMIC_ACQ_REL) != 0)
+    return;
+  for (u64 i = 0; i < s->page_count; i++) {
+    if (s->pages[i].data != NULL && !s->pages[i].mapped)
+      page_data_release(s->pages[i].data);
+  }
+  free(s->pages);
+  mapping_release(s->image);
+  free(s);
+}
+
+snapshot_t *machine_snapshot(machine_t *m) {
+  snapshot_t *s = snapshot_alloc(memory_dirty_count(m));
+  if (s == NULL)
+    return NULL;
+
+  materialise_flags(&m->pstate);
+  s->memory_size = m->memory_size;
+  s->PC = m->PC;
+  s->SP = m->SP;
+  s->pstate = m->pstate;
+  memcpy(s->regs, m->regs, sizeof(reg_file));
+  memcpy(s->vregs, m->vregs, sizeof(s->vregs));
+  memory_share_pages(m, s->pages);
+  /* pages of the image are shared with the snapshot too */
+  s->image = mapping_retain(m->image);
+  return s;
+}
+
+bool machine_restore(machine_t *m, snapshot_t *s) {
+  if (s->memory_size != m->memory_size)
+    return false;
+
+  /* mapped pages of the machine have to point into its image */
+  mapping_retain(s->image);
+  memory_restore_pages(m, s->pages, s->page_count);
+  mapping_release(m->image);
+  m->image = s->image;
+
+  m->PC = s->PC;
+  m->SP = s->SP;
+  m->pstate = s->pstate;
+  memcpy(m->regs, s->regs, sizeof(reg_file));
+  memcpy(m->vregs, s->vregs, sizeof(s->vregs));
+
+  /* any page may hold different instructions now */
+  decode_cache_flush(m);
+  block_cache_flush(m);
+  return true;
+}
+
+static u64 data_offset(u64 page_count) {
+  u64 end = sizeof(snapshot_header_t) + page_count * sizeof(u64);
+  return (end + PAGE_MASK) & ~PAGE_MASK;
+}
+
+bool snapshot_save(const snapshot_t *s, const char *path) {
+  FILE *file = fopen(path, "wb");
+  if (file == NULL)
+    return false;
+
+  snapshot_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.memory_size = s->memory_size;
+  header.page_count = s->page_count;
+  header.data_offset = data_offset(s->page_count);
+  header.PC = s->PC;
+  header.SP = s->SP;
+  memcpy(header.regs, s->regs, sizeof(reg_file));
+  header.nzcv[0] = (s->pstate.nzcv & FLAG_N) != 0;
+  header.nzcv[1] = (s->pstate.nzcv & FLAG_Z) != 0;
+  header.nzcv[2] = (s->pstate.nzcv & FLAG_C) != 0;
+  header.nzcv[3] = (s->pstate.nzcv & FLAG_V) != 0;
+  memcpy(header.vregs, s->vregs, sizeof(header.vregs));
+
+  bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+  for (u64 i = 0; written && i < s->page_count; i++)
+    written = fwrite(&s->pages[i].address, sizeof(u64), 1, file) == 1;
+
+  static const u8 padding[PAGE_SIZE];
+  u64 padding_size = header.data_offset - sizeof(header) -
+                     s->page_count * sizeof(u64);
+  if (written && padding_size > 0)
+    written = fwrite(padding, padding_size, 1, file) == 1;
+  for (u64 i = 0; written && i < s->page_count; i++)
+    written = fwrite(s->pages[i].data, PAGE_SIZE, 1, file) == 1;
+
+  return fclose(file) == 0 && written;
+}
+
+static bool valid_header(const snapshot_header_t *header, u64 file_size) {
+  u64 pages = header->memory_size >> PAGE_BITS;
+  return memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) == 0 &&
+         header->memory_size != 0 && header->memory_size <= MAX_MEMORY_SIZE &&
+         (header->memory_size & PAGE_MASK) == 0 &&
+         header->page_count <= pages &&
+         header->data_offset == data_offset(header->page_count) &&
+         header->data_offset + header->page_count * PAGE_SIZE <= file_size;
+}
+
+snapshot_t *snapshot_load(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+    return NULL;
+
+  snapshot_header_t header;
+  struct stat st;
+  snapshot_t *s = NULL;
+  if (fread(&header, sizeof(header), 1, file) == 1 &&
+      fstat(fileno(file), &st) == 0 && valid_header(&header, st.st_size))
+    s = snapshot_alloc(header.page_count);
+  if (s == NULL) {
+    fclose(file);
+    return NULL;
+  }
+
+  s->memory_size = header.memory_size;
+  s->PC = header.PC;
+  s->SP = header.SP;
+  memcpy(s->regs, header.regs, sizeof(reg_file));
+  s->pstate.nzcv = (header.nzcv[0] ? FLAG_N : 0) |
+                   (header.nzcv[1] ? FLAG_Z : 0) |
+                   (header.nzcv[2] ? FLAG_C : 0) | (header.nzcv[3] ? FLAG_V : 0);
+  s->pstate.pending = FLAGS_NONE;
+  memcpy(s->vregs, header.vregs, sizeof(s->vregs));
+
+  /* the pages have to be in order and inside the address space */
+  bool valid = true;
+  for (u64 i = 0; valid && i < s->page_count; i++) {
+    u64 address;
+    valid = fread(&address, sizeof(address), 1, file) == 1 &&
+            (address & PAGE_MASK) == 0 && address < s->memory_size &&
+            (i == 0 || address > s->pages[i - 1].address);
+    s->pages[i].address = address;
+  }
+
+  if (valid) {
+    s->image = mapping_create(fileno(file), st.st_size);
+    valid = s->image != NULL;
+  }
+  fclose(file);
+  if (!valid) {
+    snapshot_release(s);
+    return NULL;
+  }
+
+  for (u64 i = 0; i < s->page_count; i++) {
+    s->pages[i].data = s->image->data + header.data_offset + i * PAGE_SIZE;
+    s->pages[i].mapped = true;
+  }
+  return s;
+}
@@ -0,0 +1,61 @@
+#ifndef SNAPSHOT
+#define SNAPSHOT
+
+#include "../defs.h"
+#include "emulate.h"
+#include <stdbool.h>
+
+/*
+ * A snapshot is the complete state of a machine at some point: its registers,
+ * PSTATE and every page written since the program was loaded. Pages are not
+ * copied: the machine and the snapshot share them, and whichever writes a
+ * page first (only ever the machine) makes its own copy. Restoring a snapshot
+ * therefore only has to look at the pages written since it was taken.
+ *
+ * Pages are reference counted, so a snapshot can be released while machines
+ * still use its pages.
+ */
+
+/* extension of the snapshot files written by --snapshot-at */
+#define SNAPSHOT_EXTENSION ".snap"
+
+typedef struct snapshot snapshot_t;
+
+/**
+ * Captures the state of a machine. The machine carries on from the same state.
+ *
+ * @return the snapshot, with one reference owned by the caller, or NULL if it
+ *         could not be allocated.
+ */
+snapshot_t *machine_snapshot(machine_t *m);
+
+/**
+ * Puts a machine back into the state captured by a snapshot, which may have
+ * been taken on another machine with the same memory size.
+ *
+ * @return false if the memory sizes differ, the machine is left untouched.
+ */
+bool machine_restore(machine_t *m, snapshot_t *s);
+
+/**
+ * Drops a reference to a snapshot, which may be NULL.
+ */
+void snapshot_release(snapshot_t *s);
+
+/**
+ * Writes a snapshot to a file.
+ *
+ * @return false if the file could not be written.
+ */
+bool snapshot_save(const snapshot_t *s, const char *path);
+
+/**
+ * Reads a snapshot written by snapshot_save. Its pages are mapped from the
+ * file rather than read.
+ *
+ * @return the snapshot, or NULL if the file could not be read or is not a
+ *         snapshot.
+ */
+snapshot_t *snapshot_load(const char *path);
+
+#endif /* SNAPSHOT */
@@ -0,0 +1,273 @@
+#include "timeline.h"
+#include "decode.h"
+#include "flags.h"
+#include "machine.h"
+#include "memory.h"
+#include "profile.h"
+#include "snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+  UNDO_INSN, /* first record of every instruction, holds its PC */
+  UNDO_REG,
+  UNDO_SP,
+  UNDO_FLAGS, /* NZCV packed into the low four bits */
+  UNDO_VREG,  /* one 64-bit half of a V register */
+  UNDO_STORE,
+} undo_kind_t;
+
+/* one value an instruction overwrote */
+typedef struct {
+  u64 address; /* PC, register number or guest address */
+  u64 value;   /* value before the instruction ran */
+  u8 kind;
+  u8 size; /* bytes stored for UNDO_STORE, the half for UNDO_VREG */
+} undo_entry_t;
+
+typedef struct {
+  u64 position; /* instructions run when it was taken */
+  snapshot_t *snapshot;
+} checkpoint_t;
+
+struct timeline {
+  u64 position;
+  checkpoint_t checkpoints[TIMELINE_CHECKPOINTS]; /* ring, oldest at first */
+  int first, count;
+  undo_entry_t *log; /* records of the instructions since the checkpoint */
+  size_t log_len, log_cap;
+  bool undoing; /* stores are undoing others, so not recorded */
+  bool halted;  /* the next instruction stops the machine */
+};
+
+static void push_entry(struct timeline *t, undo_kind_t kind, u64 address,
+                       u64 value, int size) {
+  if (t->log_len == t->log_cap) {
+    size_t capacity = t->log_cap ? 2 * t->log_cap : 1024;
+    undo_entry_t *grown = realloc(t->log, capacity * sizeof(undo_entry_t));
+    if (grown == NULL) {
+      fprintf(stderr, "Could not allocate the undo log\n");
+      exit(1);
+    }
+    t->log = grown;
+    t->log_cap = capacity;
+  }
+  t->log[t->log_len++] = (undo_entry_t){
+      .address = address, .value = value, .kind = kind, .size = size};
+}
+
+static checkpoint_t *newest_checkpoint(struct timeline *t) {
+  return &t->checkpoints[(t->first + t->count - 1) % TIMELINE_CHECKPOINTS];
+}
+
+static bool take_checkpoint(machine_t *m) {
+  struct timeline *t = m->timeline;
+  snapshot_t *snapshot = machine_snapshot(m);
+  if (snapshot == NULL)
+    return false;
+
+  if (t->count == TIMELINE_CHECKPOINTS) {
+    /* the oldest is dropped, history now starts at the next one */
+    snapshot_release(t->checkpoints[t->first].snapshot);
+    t->first = (t->first + 1) % TIMELINE_CHECKPOINTS;
+    t->count--;
+  }
+  t->count++;
+  *newest_checkpoint(t) =
+      (checkpoint_t){.position = t->position, .snapshot = snapshot};
+  t->log_len = 0;
+  return true;
+}
+
+bool timeline_start(machine_t *m) {
+  timeline_stop(m);
+  m->timeline = calloc(1, sizeof(struct timeline));
+  if (m->timeline == NULL)
+    return false;
+  /* from now on every store has to reach the slow path to be recorded */
+  memory_flush_tlb(m);
+  if (!take_checkpoint(m)) {
+    timeline_stop(m);
+    return false;
+  }
+  return true;
+}
+
+void timeline_stop(machine_t *m) {
+  struct timeline *t = m->timeline;
+  if (t == NULL)
+    return;
+  for (int i = 0; i < t->count; i++)
+    snapshot_release(
+        t->checkpoints[(t->first + i) % TIMELINE_CHECKPOINTS].snapshot);
+  free(t->log);
+  free(t);
+  m->timeline = NULL;
+}
+
+u64 timeline_position(const machine_t *m) { return m->timeline->position; }
+
+u64 timeline_start_position(const machine_t *m) {
+  const struct timeline *t = m->timeline;
+  return t->checkpoints[t->first].position;
+}
+
+void timeline_record_store(machine_t *m, u64 address, int num_bytes) {
+  struct timeline *t = m->timeline;
+  if (!t->undoing)
+    push_entry(t, UNDO_STORE, address, memory_load(m, address, num_bytes),
+               num_bytes);
+}
+
+typedef struct {
+  const decoded_instr_t *d;
+  bool running;
+} step_t;
+
+static void run_instruction(machine_t *m, void *arg) {
+  step_t *step = arg;
+  step->running = step->d->exec(m, step->d);
+}
+
+/* pops the records of the last instruction, noting if it wrote to watch */
+static bool undo_instruction(machine_t *m, u64 watch) {
+  struct timeline *t = m->timeline;
+  bool wrote = false;
+  t->undoing = true;
+  while (TRUE) {
+    const undo_entry_t *e = &t->log[--t->log_len];
+    switch (e->kind) {
+    case UNDO_INSN:
+      m->PC = e->address;
+      t->undoing = false;
+      return wrote;
+    case UNDO_REG:
+      m->regs[e->address] = e->value;
+      break;
+    case UNDO_SP:
+      m->SP = e->value;
+      break;
+    case UNDO_FLAGS:
+      m->pstate.nzcv = e->value;
+      m->pstate.pending = FLAGS_NONE;
+      break;
+    case UNDO_VREG:
+      m->vregs[e->address].d[e->size] = e->value;
+      break;
+    case UNDO_STORE:
+      wrote |= watch - e->address < e->size;
+      /* goes through the slow path, which invalidates cached instructions */
+      memory_store(m, e->address, e->value, e->size);
+      break;
+    }
+  }
+}
+
+bool timeline_step(machine_t *m) {
+  struct timeline *t = m->timeline;
+  if (t->halted)
+    return false;
+
+  /* registers are compared afterwards, rather than every handler logging */
+  materialise_flags(&m->pstate);
+  reg_file regs;
+  memcpy(regs, m->regs, sizeof(reg_file));
+  vreg vregs[VREG_COUNT];
+  memcpy(vregs, m->vregs, sizeof(vregs));
+  reg sp = m->SP;
+  u8 nzcv = m->pstate.nzcv;
+  reg pc = m->PC;
+  push_entry(t, UNDO_INSN, pc, 0, 0);
+
+  step_t step = {.d = decode_cache_lookup(m, pc)};
+  if (m->profile != NULL)
+    profile_count(m, pc, step.d);
+  m->exit = (machine_exit_t){.reason = MACHINE_RUNNING, .pc = pc};
+  bool faulted = !machine_catch_faults(m, run_instruction, &step);
+  if (!faulted && m->PC == pc)
+    m->PC += sizeof(instruction);
+
+  for (int i = 0; i < REG_COUNT; i++) {
+    if (m->regs[i] != regs[i])
+      push_entry(t, UNDO_REG, i, regs[i], 0);
+  }
+  for (int i = 0; i < VREG_COUNT; i++) {
+    for (int half = 0; half < 2; half++) {
+      if (m->vregs[i].d[half] != vregs[i].d[half])
+        push_entry(t, UNDO_VREG, i, vregs[i].d[half], half);
+    }
+  }
+  if (m->SP != sp)
+    push_entry(t, UNDO_SP, 0, sp, 0);
+  materialise_flags(&m->pstate);
+  if (m->pstate.nzcv != nzcv)
+    push_entry(t, UNDO_FLAGS, 0, nzcv, 0);
+
+  if (faulted || !step.running) {
+    /* left at the instruction, with anything it did before faulting undone */
+    undo_instruction(m, 0);
+    if (m->exit.reason == MACHINE_RUNNING)
+      m->exit.reason = MACHINE_HALTED;
+    t->halted = true;
+    return false;
+  }
+
+  t->position++;
+  /* replaying an interval reaches a checkpoint that is still there */
+  if (t->position % TIMELINE_INTERVAL == 0 &&
+      t->position > newest_checkpoint(t)->position && !take_checkpoint(m)) {
+    fprintf(stderr, "Could not allocate a checkpoint\n");
+    exit(1);
+  }
+  return true;
+}
+
+/* steps forward to position, which is reachable without stopping */
+static void run_to(machine_t *m, u64 position) {
+  while (m->timeline->position < position && timeline_step(m))
+    ;
+}
+
+/* steps back once, *wrote tells if the instruction wrote to watch */
+static bool step_back(machine_t *m, u64 watch, bool *wrote) {
+  struct timeline *t = m->timeline;
+  if (t->log_len == 0) {
+    /* at a checkpoint: rebuild the records of the interval before it */
+    if (t->count <= 1)
+      return false;
+    u64 position = t->position;
+    const checkpoint_t *previous =
+        &t->checkpoints[(t->first + t->count - 2) % TIMELINE_CHECKPOINTS];
+    machine_restore(m, previous->snapshot);
+    t->position = previous->position;
+    t->halted = false;
+    run_to(m, position);
+
+    /* the records lead up to the newest checkpoint, which is redundant now */
+    snapshot_release(newest_checkpoint(t)->snapshot);
+    t->count--;
+  }
+  *wrote = undo_instruction(m, watch);
+  t->position--;
+  t->halted = false;
+  return true;
+}
+
+bool timeline_step_back(machine_t *m) {
+  bool wrote;
+  return step_back(m, 0, &wrote);
+}
+
+bool timeline_last_write(machine_t *m, u64 address) {
+  u64 start = m->timeline->position;
+  bool wrote = false;
+  while (!wrote) {
+    if (!step_back(m, address, &wrote)) {
+      /* nothing wrote to it, go back to where the search started */
+      run_to(m, start);
+      return false;
+    }
+  }
+  return true;
+}
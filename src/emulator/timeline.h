@@ -0,0 +1,79 @@
+#ifndef TIMELINE
+#define TIMELINE
+
+#include "../defs.h"
+#include "emulate.h"
+#include <stdbool.h>
+
+/*
+ * Records execution so it can be run backwards. Every TIMELINE_INTERVAL
+ * instructions a snapshot of the machine is taken as a checkpoint, and every
+ * instruction since the newest checkpoint leaves an undo record of the
+ * registers, flags and memory it overwrote. Stepping back pops undo records;
+ * once they run out the previous checkpoint is restored and the interval is
+ * run forward again to rebuild them.
+ *
+ * Only the newest TIMELINE_CHECKPOINTS checkpoints are kept, which bounds the
+ * memory used and how far back execution can go.
+ */
+
+/* instructions between checkpoints */
+#define TIMELINE_INTERVAL (1 << 14)
+
+/* checkpoints kept, older ones are dropped */
+#define TIMELINE_CHECKPOINTS 256
+
+/**
+ * Starts recording a machine from its current state, which becomes the start
+ * of its history.
+ *
+ * @return false if the timeline could not be allocated.
+ */
+bool timeline_start(machine_t *m);
+
+/**
+ * Stops recording and drops the history of a machine, if it has any.
+ */
+void timeline_stop(machine_t *m);
+
+/**
+ * Returns the number of instructions run since recording started.
+ */
+u64 timeline_position(const machine_t *m);
+
+/**
+ * Returns the earliest position that can still be returned to.
+ */
+u64 timeline_start_position(const machine_t *m);
+
+/**
+ * Runs the next instruction, recording it. Faults are caught.
+ *
+ * @return false if the machine stopped instead, its state is left unchanged
+ *         and m->exit says why.
+ */
+bool timeline_step(machine_t *m);
+
+/**
+ * Undoes the last instruction run.
+ *
+ * @return false if the machine is at the start of its history.
+ */
+bool timeline_step_back(machine_t *m);
+
+/**
+ * Steps back to the last instruction that wrote to address, leaving the
+ * machine just before it runs.
+ *
+ * @return false if no recorded instruction wrote to address, the machine is
+ *         left where it was.
+ */
+bool timeline_last_write(machine_t *m, u64 address);
+
+/**
+ * Records the bytes a store is about to overwrite. Called by the memory slow
+ * path, which every store takes while a machine is being recorded.
+ */
+void timeline_record_store(machine_t *m, u64 address, int num_bytes);
+
+#endif /* TIMELINE */
@@ -0,0 +1,199 @@
+#include "timing.h"
+#include "execute/branches.h"
+#include "execute/immediate_instructions.h"
+#include "execute/load_store.h"
+#include "execute/register_instruction.h"
+#include "execute/simd.h"
+#include "hooks.h"
+#include <inttypes.h>
+#include <stdlib.h>
+
+/* the condition flags are tracked as one more register, after ZR */
+#define FLAGS_SLOT (REG_COUNT + 1)
+#define SLOTS (REG_COUNT + 2)
+
+/* registers read and written by one instruction, REG_COUNT if unused */
+typedef struct {
+  u8 reads[3];
+  u8 writes[3];
+  bool reads_flags, writes_flags;
+  u64 latency; /* until writes[0] and [2] are ready, [1] is an ALU result */
+  bool is_load;
+} operands_t;
+
+struct timing {
+  machine_hooks_t hooks; /* the model watches instructions retire */
+  u64 cycle;             /* cycle the next instruction may issue in */
+  u64 ready[SLOTS];      /* cycle each register can first be used in */
+  bool from_load[SLOTS]; /* whether it was last written by a load */
+  u64 instructions;
+  u64 load_use_stalls; /* cycles waiting on a load */
+  u64 multiply_stalls; /* cycles waiting on a multiply */
+  u64 branch_cycles;   /* cycles lost to taken branches */
+};
+
+static void retire(void *ctx, machine_t *m, reg pc, const decoded_instr_t *d);
+
+bool timing_init(machine_t *m) {
+  timing_destroy(m);
+  struct timing *t = calloc(1, sizeof(struct timing));
+  if (t == NULL)
+    return false;
+  t->hooks = (machine_hooks_t){.retire = retire, .ctx = t};
+  if (!hooks_attach(m, &t->hooks)) {
+    free(t);
+    return false;
+  }
+  m->timing = t;
+  return true;
+}
+
+void timing_destroy(machine_t *m) {
+  if (m->timing == NULL)
+    return;
+  hooks_detach(m, &m->timing->hooks);
+  free(m->timing);
+  m->timing = NULL;
+}
+
+static operands_t operands(const decoded_instr_t *d) {
+  operands_t o = {.reads = {REG_COUNT, REG_COUNT, REG_COUNT},
+                  .writes = {REG_COUNT, REG_COUNT, REG_COUNT},
+                  .latency = LATENCY_ALU};
+  if (d->exec == exec_arith_imm) {
+    o.reads[0] = d->rn;
+    o.writes[0] = d->rd;
+    o.writes_flags = d->opc & 1;
+  } else if (d->exec == exec_move_wide) {
+    o.writes[0] = d->rd;
+  } else if (d->exec == exec_move_keep) {
+    o.reads[0] = o.writes[0] = d->rd;
+  } else if (d->exec == exec_arith_reg || d->exec == exec_logic_reg) {
+    o.reads[0] = d->rn;
+    o.reads[1] = d->rm;
+    o.writes[0] = d->rd;
+    o.writes_flags = d->exec == exec_arith_reg ? d->opc & 1
+                                               : d->opc == OPP_AND_FLAGS;
+  } else if (d->exec == exec_cond_select) {
+    o.reads[0] = d->rn;
+    o.reads[1] = d->rm;
+    o.writes[0] = d->rd;
+    o.reads_flags = true;
+  } else if (d->exec == exec_multiply) {
+    o.reads[0] = d->rn;
+    o.reads[1] = d->rm;
+    o.reads[2] = d->ra;
+    o.writes[0] = d->rd;
+    o.latency = LATENCY_MULTIPLY;
+  } else if (d->exec == exec_load || d->exec == exec_store) {
+    o.reads[0] = d->rn;
+    if (d->opc == REGISTER_OFFSET)
+      o.reads[1] = d->rm;
+    if (d->opc == PRE_INDEXED || d->opc == POST_INDEXED)
+      o.writes[1] = d->rn;
+    if (d->exec == exec_load) {
+      o.writes[0] = d->rd;
+      o.latency = LATENCY_LOAD;
+      o.is_load = true;
+    } else {
+      o.reads[2] = d->rd;
+    }
+  } else if (d->exec == exec_load_pair || d->exec == exec_store_pair) {
+    o.reads[0] = d->rn;
+    if (d->opc == PRE_INDEXED || d->opc == POST_INDEXED)
+      o.writes[1] = d->rn;
+    if (d->exec == exec_load_pair) {
+      o.writes[0] = d->rd;
+      o.writes[2] = d->ra;
+      o.latency = LATENCY_LOAD;
+      o.is_load = true;
+    } else {
+      o.reads[1] = d->rd;
+      o.reads[2] = d->ra;
+    }
+  } else if (d->exec == exec_load_literal) {
+    o.writes[0] = d->rd;
+    o.latency = LATENCY_LOAD;
+    o.is_load = true;
+  } else if (d->exec == exec_branch_reg) {
+    o.reads[0] = d->rn;
+  } else if (d->exec == exec_branch_cond) {
+    o.reads_flags = true;
+  } else if (d->exec == exec_compare_branch || d->exec == exec_test_branch) {
+    o.reads[0] = d->rd;
+  } else if (d->exec == exec_vector_load || d->exec == exec_vector_store) {
+    /* only the general purpose registers are modelled, not the V registers */
+    o.reads[0] = d->rn;
+    if (d->opc) {
+      o.reads[1] = d->rm;
+      o.writes[1] = d->rn;
+    }
+  } else if (d->exec == exec_vector_dup) {
+    o.reads[0] = d->rn;
+  } else if (d->exec == exec_vector_move) {
+    o.writes[0] = d->rd;
+  }
+  return o;
+}
+
+/* delays the issue of an instruction until a source is ready */
+static void wait_for(struct timing *t, u8 slot, u64 *issue, bool *on_load) {
+  if (t->ready[slot] > *issue) {
+    *issue = t->ready[slot];
+    *on_load = t->from_load[slot];
+  }
+}
+
+static void produce(struct timing *t, u8 slot, u64 ready, bool is_load) {
+  t->ready[slot] = ready;
+  t->from_load[slot] = is_load;
+}
+
+/* accounts for an instruction that has just run */
+static void retire(void *ctx, machine_t *m, reg pc, const decoded_instr_t *d) {
+  struct timing *t = ctx;
+  operands_t o = operands(d);
+
+  /* ZR is never written, so it is always ready */
+  u64 issue = t->cycle;
+  bool on_load = false;
+  for (int i = 0; i < 3; i++)
+    wait_for(t, o.reads[i], &issue, &on_load);
+  if (o.reads_flags)
+    wait_for(t, FLAGS_SLOT, &issue, &on_load);
+  if (on_load)
+    t->load_use_stalls += issue - t->cycle;
+  else
+    t->multiply_stalls += issue - t->cycle;
+
+  if (o.writes[0] < REG_COUNT)
+    produce(t, o.writes[0], issue + o.latency, o.is_load);
+  if (o.writes[1] < REG_COUNT)
+    produce(t, o.writes[1], issue + LATENCY_ALU, false);
+  if (o.writes[2] < REG_COUNT)
+    produce(t, o.writes[2], issue + o.latency, o.is_load);
+  if (o.writes_flags)
+    produce(t, FLAGS_SLOT, issue + LATENCY_ALU, false);
+
+  t->cycle = issue + 1;
+  if (m->PC != pc + sizeof(instruction)) {
+    t->cycle += TAKEN_BRANCH_PENALTY;
+    t->branch_cycles += TAKEN_BRANCH_PENALTY;
+  }
+  t->instructions++;
+}
+
+void timing_report(const machine_t *m, FILE *out) {
+  const struct timing *t = m->timing;
+  fprintf(out, "Timing:\n");
+  fprintf(out, "Cycles: %" PRIu64 "\n", t->cycle);
+  fprintf(out, "Instructions: %" PRIu64 "\n", t->instructions);
+  fprintf(out, "CPI: %.3f\n",
+          t->instructions != 0 ? (double)t->cycle / t->instructions : 0.0);
+  fprintf(out, "  %-28s %14" PRIu64 "\n", "load-use stalls",
+          t->load_use_stalls);
+  fprintf(out, "  %-28s %14" PRIu64 "\n", "multiply stalls",
+          t->multiply_stalls);
+  fprintf(out, "  %-28s %14" PRIu64 "\n", "taken branch bubbles",
+          t->branch_cycles);
+}
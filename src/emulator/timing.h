@@ -0,0 +1,42 @@
+#ifndef TIMING
+#define TIMING
+
+#include "../defs.h"
+#include "emulate.h"
+#include <stdio.h>
+
+/*
+ * A cycle-approximate model of a single issue, in-order core such as the
+ * Cortex-A53 of the Raspberry Pi 3. Instructions issue one per cycle once
+ * their source registers (and flags) are ready; results become ready after
+ * the latency of their class, so using a loaded value straight away stalls.
+ * Taken branches additionally cost a fixed refetch bubble.
+ */
+
+/* cycles from issue until the result can be used */
+#define LATENCY_ALU 1
+#define LATENCY_MULTIPLY 3
+#define LATENCY_LOAD 3
+
+/* cycles lost refetching after a taken branch */
+#define TAKEN_BRANCH_PENALTY 2
+
+/**
+ * Starts estimating the cycles a machine takes. The model is attached as a
+ * retire hook, so every instruction is then run one at a time.
+ *
+ * @return false if the model could not be allocated.
+ */
+bool timing_init(machine_t *m);
+
+/**
+ * Frees the timing model of a machine, if it has one.
+ */
+void timing_destroy(machine_t *m);
+
+/**
+ * Writes the estimated cycles, CPI and where the stall cycles came from.
+ */
+void timing_report(const machine_t *m, FILE *out);
+
+#endif /* TIMING */
@@ -0,0 +1,205 @@
+#include "trace.h"
+#include "execute/load_store.h"
+#include "execute/simd.h"
+#include "hooks.h"
+#include "memory.h"
+#include "trace_format.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define RING_MASK (TRACE_RING_SIZE - 1)
+
+/* how long the writer sleeps when it has caught up */
+#define WRITER_NAP_NS 100000
+
+struct trace {
+  machine_hooks_t hooks;
+  trace_record_t pending; /* the instruction being run */
+  int accesses;           /* memory accesses of the pending instruction */
+  trace_record_t *ring;
+
+  /* each index is written by one thread only, on its own line */
+  _Alignas(CACHE_LINE_SIZE) u64 head; /* next record to push */
+  _Alignas(CACHE_LINE_SIZE) u64 tail; /* next record to write out */
+  _Alignas(CACHE_LINE_SIZE) bool done;
+
+  pthread_t writer;
+  FILE *file;
+  bool failed; /* a write failed, only read once the writer is joined */
+  trace_codec_t codec;
+  u8 buffer[TRACE_BUFFER_SIZE];
+};
+
+static void push(struct trace *t, const trace_record_t *r) {
+  u64 head = t->head;
+  while (head - __atomic_load_n(&t->tail, __ATOMIC_ACQUIRE) ==
+         TRACE_RING_SIZE) {
+    /* the writer is behind, let it catch up */
+    sched_yield();
+  }
+  t->ring[head & RING_MASK] = *r;
+  __atomic_store_n(&t->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void *write_trace(void *arg) {
+  struct trace *t = arg;
+  size_t used = 0;
+  while (TRUE) {
+    /* read done first, so no record pushed before it was set is missed */
+    bool done = __atomic_load_n(&t->done, __ATOMIC_ACQUIRE);
+    u64 head = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);
+    u64 tail = t->tail;
+    if (tail == head) {
+      if (done)
+        break;
+      struct timespec nap = {.tv_nsec = WRITER_NAP_NS};
+      nanosleep(&nap, NULL);
+      continue;
+    }
+
+    for (; tail != head; tail++) {
+      if (used > TRACE_BUFFER_SIZE - TRACE_RECORD_MAX) {
+        t->failed |= fwrite(t->buffer, 1, used, t->file) != used;
+        used = 0;
+      }
+      used += trace_encode(&t->codec, &t->ring[tail & RING_MASK],
+                           t->buffer + used);
+    }
+    /* hand the slots back to the machine */
+    __atomic_store_n(&t->tail, tail, __ATOMIC_RELEASE);
+  }
+  t->failed |= fwrite(t->buffer, 1, used, t->file) != used;
+  return NULL;
+}
+
+/* the register a load or store writes, other than its base, or REG_COUNT */
+static u8 load_store_target(const decoded_instr_t *d) {
+  if (d->exec == exec_load || d->exec == exec_load_literal ||
+      d->exec == exec_load_pair || d->exec == exec_load_exclusive ||
+      d->exec == exec_load_acquire)
+    return d->rd;
+  /* STXR and STLXR report whether they stored in rs */
+  if (d->exec == exec_store_exclusive)
+    return d->rm;
+  return REG_COUNT;
+}
+
+/* the general purpose register an instruction writes, or REG_COUNT */
+static u8 target(const decoded_instr_t *d) {
+  switch (d->instr_class) {
+  case CLASS_DP_IMM:
+  case CLASS_DP_REG:
+    return d->rd;
+  case CLASS_LOAD_STORE:
+    return load_store_target(d);
+  case CLASS_SIMD:
+    /* only UMOV writes a general purpose register */
+    return d->exec == exec_vector_move ? d->rd : REG_COUNT;
+  default:
+    return REG_COUNT;
+  }
+}
+
+static void retire(void *ctx, machine_t *m, reg pc, const decoded_instr_t *d) {
+  struct trace *t = ctx;
+  trace_record_t *r = &t->pending;
+  r->pc = pc;
+  r->word = (instruction)memory_load(m, pc, sizeof(instruction));
+  r->rd = TRACE_NO_REG;
+  r->rd2 = TRACE_NO_REG;
+  r->pair = d->exec == exec_load_pair || d->exec == exec_store_pair;
+  u8 rd = target(d);
+  if (rd < REG_COUNT) {
+    r->rd = rd;
+    r->rd_value = m->regs[rd];
+  }
+  /* the second register of a load pair, first if rd is the zero register */
+  if (d->exec == exec_load_pair && d->ra < REG_COUNT && d->ra != d->rd) {
+    u8 *slot = r->rd == TRACE_NO_REG ? &r->rd : &r->rd2;
+    u64 *value = r->rd == TRACE_NO_REG ? &r->rd_value : &r->rd2_value;
+    *slot = d->ra;
+    *value = m->regs[d->ra];
+  }
+  push(t, r);
+  r->mem_size = 0;
+  t->accesses = 0;
+}
+
+/* the first access is kept, and the second of a pair */
+static void access(struct trace *t, u64 address, u64 value, int num_bytes,
+                   bool write) {
+  int index = t->accesses++;
+  if (index == 1)
+    t->pending.mem_value2 = value;
+  if (index != 0)
+    return;
+  t->pending.mem_address = address;
+  t->pending.mem_value = value;
+  t->pending.mem_size = num_bytes;
+  t->pending.mem_write = write;
+}
+
+static void mem_read(void *ctx, machine_t *m, u64 address, u64 value,
+                     int num_bytes) {
+  (void)m;
+  access(ctx, address, value, num_bytes, false);
+}
+
+static void mem_write(void *ctx, machine_t *m, u64 address, u64 value,
+                      int num_bytes) {
+  (void)m;
+  access(ctx, address, value, num_bytes, true);
+}
+
+static void trace_free(struct trace *t) {
+  if (t->file != NULL)
+    fclose(t->file);
+  free(t->ring);
+  free(t);
+}
+
+bool trace_start(machine_t *m, const char *path) {
+  trace_stop(m);
+  struct trace *t = calloc(1, sizeof(struct trace));
+  if (t == NULL)
+    return false;
+  t->ring = malloc(TRACE_RING_SIZE * sizeof(trace_record_t));
+  t->file = fopen(path, "wb");
+  if (t->ring == NULL || t->file == NULL ||
+      fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_SIZE, t->file) != TRACE_MAGIC_SIZE) {
+    trace_free(t);
+    return false;
+  }
+  trace_codec_init(&t->codec);
+  t->hooks = (machine_hooks_t){
+      .retire = retire, .mem_read = mem_read, .mem_write = mem_write, .ctx = t};
+
+  if (pthread_create(&t->writer, NULL, write_trace, t) != 0) {
+    trace_free(t);
+    return false;
+  }
+  if (!hooks_attach(m, &t->hooks)) {
+    __atomic_store_n(&t->done, true, __ATOMIC_RELEASE);
+    pthread_join(t->writer, NULL);
+    trace_free(t);
+    return false;
+  }
+  m->trace = t;
+  return true;
+}
+
+bool trace_stop(machine_t *m) {
+  struct trace *t = m->trace;
+  if (t == NULL)
+    return true;
+  hooks_detach(m, &t->hooks);
+  __atomic_store_n(&t->done, true, __ATOMIC_RELEASE);
+  pthread_join(t->writer, NULL);
+  bool written = !t->failed && fflush(t->file) == 0;
+  trace_free(t);
+  m->trace = NULL;
+  return written;
+}
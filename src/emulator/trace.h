@@ -0,0 +1,37 @@
+#ifndef TRACE
+#define TRACE
+
+#include "../defs.h"
+#include "emulate.h"
+
+/*
+ * Records every instruction a machine retires into a file, in the format of
+ * trace_format.h. The machine only copies each record into a lock-free
+ * single producer, single consumer ring; a writer thread encodes the records
+ * and writes them out in the background.
+ */
+
+/* records the ring holds, a power of two */
+#define TRACE_RING_SIZE (1 << 16)
+
+/* bytes the writer encodes before writing them to the file */
+#define TRACE_BUFFER_SIZE (1 << 16)
+
+/**
+ * Starts tracing a machine into a file. The trace is attached as hooks, so
+ * every instruction is then run one at a time.
+ *
+ * @param path The file to write, replaced if it exists.
+ * @return false if the file or the writer could not be set up.
+ */
+bool trace_start(machine_t *m, const char *path);
+
+/**
+ * Stops tracing a machine, if it is traced, once every record it produced has
+ * been written.
+ *
+ * @return false if writing the trace failed.
+ */
+bool trace_stop(machine_t *m);
+
+#endif /* TRACE */
@@ -0,0 +1,193 @@
+#include "trace_format.h"
+#include <string.h>
+
+#define WORD_SLOT(pc) (((pc) / sizeof(instruction)) & (TRACE_WORD_CACHE - 1))
+
+void trace_codec_init(trace_codec_t *c) {
+  memset(c, 0, sizeof(trace_codec_t));
+  /* the first record is sequential if it is at START_INSTR_ADDR */
+  c->pc = START_INSTR_ADDR - sizeof(instruction);
+  for (int i = 0; i < TRACE_WORD_CACHE; i++)
+    c->words[i].pc = UINT64_MAX;
+}
+
+/* small differences of either sign become small unsigned numbers */
+static u64 zigzag(u64 delta) { return (delta << 1) ^ -(delta >> 63); }
+static u64 unzigzag(u64 value) { return (value >> 1) ^ -(value & 1); }
+
+static size_t put_varint(u8 *out, u64 value) {
+  size_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = (u8)value | 0x80;
+    value >>= 7;
+  }
+  out[n++] = (u8)value;
+  return n;
+}
+
+/* returns the bytes consumed, 0 if in ends before the varint does */
+static size_t get_varint(const u8 *in, size_t len, u64 *value) {
+  *value = 0;
+  for (size_t n = 0; n < len && n < 10; n++) {
+    *value |= (u64)(in[n] & 0x7f) << (7 * n);
+    if (!(in[n] & 0x80))
+      return n + 1;
+  }
+  return 0;
+}
+
+static u8 log2_size(u8 size) {
+  return size == 8 ? 3 : size == 4 ? 2 : size == 2 ? 1 : 0;
+}
+
+/* writes a register index and its value, as a delta from the last traced */
+static size_t put_reg(trace_codec_t *c, u8 *out, u8 index, u64 value) {
+  out[0] = index;
+  size_t n = 1 + put_varint(out + 1, zigzag(value - c->regs[index]));
+  c->regs[index] = value;
+  return n;
+}
+
+/*
+ * reads what put_reg wrote, against the codec's values without updating
+ * them, returns the bytes consumed or 0 if in is too short or malformed
+ */
+static size_t get_reg(const trace_codec_t *c, const u8 *in, size_t len,
+                      u8 *index, u64 *value) {
+  if (len == 0 || in[0] >= REG_COUNT)
+    return 0;
+  size_t k = get_varint(in + 1, len - 1, value);
+  if (k == 0)
+    return 0;
+  *index = in[0];
+  *value = c->regs[*index] + unzigzag(*value);
+  return k + 1;
+}
+
+size_t trace_encode(trace_codec_t *c, const trace_record_t *r, u8 *out) {
+  size_t n = 1;
+  u8 flags = 0;
+
+  if (r->pc == c->pc + sizeof(instruction))
+    flags |= TRACE_SEQUENTIAL;
+  else
+    n += put_varint(out + n, zigzag(r->pc - c->pc));
+  c->pc = r->pc;
+
+  if (c->words[WORD_SLOT(r->pc)].pc == r->pc &&
+      c->words[WORD_SLOT(r->pc)].word == r->word) {
+    flags |= TRACE_WORD_KNOWN;
+  } else {
+    memcpy(out + n, &r->word, sizeof(instruction));
+    n += sizeof(instruction);
+    c->words[WORD_SLOT(r->pc)].pc = r->pc;
+    c->words[WORD_SLOT(r->pc)].word = r->word;
+  }
+
+  if (r->pair)
+    flags |= TRACE_PAIR;
+
+  if (r->rd < REG_COUNT) {
+    flags |= TRACE_HAS_REG;
+    n += put_reg(c, out + n, r->rd, r->rd_value);
+    if (r->pair && r->rd2 < REG_COUNT)
+      n += put_reg(c, out + n, r->rd2, r->rd2_value);
+    else if (r->pair)
+      out[n++] = TRACE_NO_REG;
+  }
+
+  if (r->mem_size != 0) {
+    flags |= TRACE_HAS_MEM | log2_size(r->mem_size) << TRACE_MEM_SIZE_SHIFT;
+    if (r->mem_write)
+      flags |= TRACE_MEM_WRITE;
+    n += put_varint(out + n, zigzag(r->mem_address - c->mem_address));
+    n += put_varint(out + n, r->mem_value);
+    if (r->pair)
+      n += put_varint(out + n, r->mem_value2);
+    c->mem_address = r->mem_address;
+  }
+
+  out[0] = flags;
+  return n;
+}
+
+size_t trace_decode(trace_codec_t *c, const u8 *in, size_t len,
+                    trace_record_t *r) {
+  if (len == 0)
+    return 0;
+  u8 flags = in[0];
+  size_t n = 1, k;
+  u64 value;
+  memset(r, 0, sizeof(trace_record_t));
+  r->rd = TRACE_NO_REG;
+
+  r->pc = c->pc + sizeof(instruction);
+  if (!(flags & TRACE_SEQUENTIAL)) {
+    if ((k = get_varint(in + n, len - n, &value)) == 0)
+      return 0;
+    n += k;
+    r->pc = c->pc + unzigzag(value);
+  }
+
+  bool known = flags & TRACE_WORD_KNOWN;
+  if (known) {
+    r->word = c->words[WORD_SLOT(r->pc)].word;
+  } else {
+    if (len - n < sizeof(instruction))
+      return 0;
+    memcpy(&r->word, in + n, sizeof(instruction));
+    n += sizeof(instruction);
+  }
+
+  r->pair = flags & TRACE_PAIR;
+  r->rd2 = TRACE_NO_REG;
+  if (flags & TRACE_HAS_REG) {
+    if ((k = get_reg(c, in + n, len - n, &r->rd, &r->rd_value)) == 0)
+      return 0;
+    n += k;
+    if (r->pair) {
+      if (n == len)
+        return 0;
+      if (in[n] == TRACE_NO_REG) {
+        n++;
+      } else {
+        /* a pair writes two different registers */
+        k = get_reg(c, in + n, len - n, &r->rd2, &r->rd2_value);
+        if (k == 0 || r->rd2 == r->rd)
+          return 0;
+        n += k;
+      }
+    }
+  }
+
+  if (flags & TRACE_HAS_MEM) {
+    r->mem_size = 1 << (flags >> TRACE_MEM_SIZE_SHIFT & TRACE_MEM_SIZE_MASK);
+    r->mem_write = flags & TRACE_MEM_WRITE;
+    if ((k = get_varint(in + n, len - n, &value)) == 0)
+      return 0;
+    n += k;
+    r->mem_address = c->mem_address + unzigzag(value);
+    if ((k = get_varint(in + n, len - n, &r->mem_value)) == 0)
+      return 0;
+    n += k;
+    if (r->pair) {
+      if ((k = get_varint(in + n, len - n, &r->mem_value2)) == 0)
+        return 0;
+      n += k;
+    }
+  }
+
+  /* the whole record is there, so the codec can move on */
+  c->pc = r->pc;
+  if (!known) {
+    c->words[WORD_SLOT(r->pc)].pc = r->pc;
+    c->words[WORD_SLOT(r->pc)].word = r->word;
+  }
+  if (r->rd != TRACE_NO_REG)
+    c->regs[r->rd] = r->rd_value;
+  if (r->rd2 != TRACE_NO_REG)
+    c->regs[r->rd2] = r->rd2_value;
+  if (r->mem_size != 0)
+    c->mem_address = r->mem_address;
+  return n;
+}
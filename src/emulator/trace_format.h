@@ -0,0 +1,102 @@
+#ifndef TRACE_FORMAT
+#define TRACE_FORMAT
+
+#include "../defs.h"
+#include "emulate.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * The binary format of execution traces, shared by the emulator and the
+ * tools reading traces. It has no dependencies on the rest of the emulator.
+ *
+ * A trace is TRACE_MAGIC followed by one record per retired instruction.
+ * Records are delta encoded against a codec state that the encoder and the
+ * decoder update in the same way, so most records take a few bytes:
+ *
+ *   flags     1 byte, TRACE_* below
+ *   pc        zigzag varint of pc - previous pc, unless TRACE_SEQUENTIAL
+ *   word      4 bytes little-endian, unless TRACE_WORD_KNOWN (the word was
+ *             last seen at the same pc)
+ *   register  1 byte index, then zigzag varint of the value minus the last
+ *             value traced for that register, if TRACE_HAS_REG
+ *   memory    zigzag varint of the address minus the last traced address,
+ *             then varint of the value, if TRACE_HAS_MEM
+ *
+ * Records of pair transfers (TRACE_PAIR) also hold a second register index
+ * and value after the first, the index TRACE_NO_REG and no value if only
+ * one register was written, and a varint of the second value after the
+ * first, accessed at the address plus the size.
+ */
+
+#define TRACE_MAGIC "A64TRC2"
+#define TRACE_MAGIC_SIZE 8
+
+/* record flags */
+#define TRACE_SEQUENTIAL 0x01 /* pc is 4 past the previous one */
+#define TRACE_WORD_KNOWN 0x02
+#define TRACE_HAS_REG 0x04
+#define TRACE_HAS_MEM 0x08
+#define TRACE_MEM_WRITE 0x10
+#define TRACE_MEM_SIZE_SHIFT 5 /* log2 of the access size in bits 5 and 6 */
+#define TRACE_MEM_SIZE_MASK 0x3
+#define TRACE_PAIR 0x80
+
+/* longest encoded record */
+#define TRACE_RECORD_MAX 72
+
+/* instruction words remembered by pc, a power of two */
+#define TRACE_WORD_CACHE 4096
+
+/* register index of records that wrote none */
+#define TRACE_NO_REG 0xff
+
+typedef struct {
+  reg pc;
+  instruction word;
+  u8 rd;       /* register written, or TRACE_NO_REG */
+  u8 rd2;      /* second register written by a pair, or TRACE_NO_REG */
+  u8 mem_size; /* bytes of each access, 0 if memory was not accessed */
+  bool mem_write;
+  bool pair; /* a pair transfer, accessing memory twice */
+  u64 rd_value;
+  u64 rd2_value;
+  u64 mem_address;
+  u64 mem_value;
+  u64 mem_value2; /* at mem_address + mem_size, for pairs */
+} trace_record_t;
+
+typedef struct {
+  reg pc;
+  u64 regs[REG_COUNT];
+  u64 mem_address;
+  struct {
+    reg pc;
+    instruction word;
+  } words[TRACE_WORD_CACHE];
+} trace_codec_t;
+
+/**
+ * Resets a codec to the state at the start of a trace.
+ */
+void trace_codec_init(trace_codec_t *c);
+
+/**
+ * Encodes a record and updates the codec.
+ *
+ * @param out Room for TRACE_RECORD_MAX bytes.
+ * @return the number of bytes written.
+ */
+size_t trace_encode(trace_codec_t *c, const trace_record_t *r, u8 *out);
+
+/**
+ * Decodes a record and updates the codec.
+ *
+ * @param len Bytes available at in.
+ * @return the number of bytes consumed, or 0 if in does not hold a whole
+ *         record (the codec is then left untouched).
+ */
+size_t trace_decode(trace_codec_t *c, const u8 *in, size_t len,
+                    trace_record_t *r);
+
+#endif /* TRACE_FORMAT */
@@ -0,0 +1,12 @@
+// the trace records what every transfer writes: the loaded register of
+// ldxr and ldar, the status register of stxr and stlxr, and nothing for stlr
+movz x1, #0x1000
+movz x2, #7
+ldxr x3, [x1]
+add x3, x3, x2
+stxr w4, x3, [x1]
+ldaxr w5, [x1]
+stlxr w6, w2, [x1]
+stlr x2, [x1]
+ldar x7, [x1]
+and x0, x0, x0
@@ -0,0 +1,15 @@
+// the store to 0x42000 evicts the page at 0x2000 from the TLB, so the
+// first ldar misses and the second, of a W register, hits
+movz x1, #0x2000
+movz x2, #0x7788
+movk x2, #0x5566, lsl #16
+movk x2, #0x3344, lsl #32
+movk x2, #0x1122, lsl #48
+str x2, [x1]
+movz x5, #0x4, lsl #16
+add x5, x5, x1
+str x2, [x5]
+ldar x3, [x1]
+ldar w4, [x1]
+ldr x6, [x1]
+and x0, x0, x0
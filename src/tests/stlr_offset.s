@@ -0,0 +1,6 @@
+// the explicit #0 offset must keep x1 as the base, not x0
+movz x1, #0x2000
+movz x2, #0x55
+stlr x2, [x1, #0]
+ldar x3, [x1, #0]
+and x0, x0, x0
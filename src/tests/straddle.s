@@ -0,0 +1,12 @@
+// the first ldr maps the zero page for 0x3000 in the TLB, the store across
+// 0x3000 then gives that page data, which the second ldr must see
+movz x1, #0x3000
+movz x2, #0x2ffc
+movz x4, #0x1111
+movk x4, #0x2222, lsl #16
+movk x4, #0x3333, lsl #32
+movk x4, #0x4444, lsl #48
+ldr x5, [x1]
+str x4, [x2]
+ldr x6, [x1]
+and x0, x0, x0
@@ -0,0 +1,15 @@
+// the barriers and hints run as one word each, with the encodings in
+// system.out, so the label after them is where the branch expects it
+nop
+dsb sy
+dsb ish
+isb
+isb sy
+clrex
+clrex #0xf
+dmb ish
+b done
+movz x2, #1
+done:
+movz x1, #1
+and x0, x0, x0
@@ -0,0 +1,24 @@
+// br x10 at 0x80000004 branches to itself, so it falls through; the JIT has
+// to compare the whole PC with x10 there, not a sign extended imm32 of it
+movz x3, #0x8000, lsl #16
+// add x9, x9, #1 at 0x80000000
+movz x7, #0x0529
+movk x7, #0x9100, lsl #16
+str w7, [x3]
+// br x10
+movz x7, #0x0140
+movk x7, #0xd61f, lsl #16
+str w7, [x3, #4]
+// br x5, back to the loop
+movz x7, #0x00a0
+movk x7, #0xd61f, lsl #16
+str w7, [x3, #8]
+movz x10, #0x8000, lsl #16
+add x10, x10, #4
+movz x5, #0x3c
+movz x6, #64
+again:
+br x3
+subs x6, x6, #1
+b.ne again
+and x0, x0, x0
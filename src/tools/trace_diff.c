@@ -0,0 +1,181 @@
+#include "../defs.h"
+#include "../emulator/trace_format.h"
+#include "trace_print.h"
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Finds where two traces written by `emulate --trace`, or two machine state
+ * dumps, first differ.
+ *
+ * Both files are mapped and compared in large blocks with memcmp, then a word
+ * at a time within the first block that differs. The trace encoding is
+ * deterministic, so traces that agree up to a record agree byte for byte up
+ * to its end; only the common prefix has to be decoded, to count records.
+ */
+
+#define USAGE "Usage: ./trace_diff a b\n"
+
+/* bytes compared at once before narrowing down */
+#define BLOCK_SIZE (1 << 16)
+
+typedef struct {
+  const u8 *data;
+  size_t size;
+} file_map_t;
+
+static bool map_file(const char *path, file_map_t *map) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  bool mapped = fstat(fd, &st) == 0;
+  map->size = mapped ? st.st_size : 0;
+  map->data = NULL;
+  if (mapped && map->size != 0) {
+    void *data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    mapped = data != MAP_FAILED;
+    if (mapped) {
+      map->data = data;
+      /* both files are read front to back once */
+      madvise(data, map->size, MADV_SEQUENTIAL);
+    }
+  }
+  close(fd);
+  return mapped;
+}
+
+/* the offset of the first byte that differs, len if there is none */
+static size_t first_difference(const u8 *a, const u8 *b, size_t len) {
+  size_t offset = 0;
+  while (offset < len) {
+    size_t block = len - offset < BLOCK_SIZE ? len - offset : BLOCK_SIZE;
+    if (memcmp(a + offset, b + offset, block) != 0)
+      break;
+    offset += block;
+  }
+  for (; offset + sizeof(u64) <= len; offset += sizeof(u64)) {
+    u64 x, y;
+    memcpy(&x, a + offset, sizeof(u64));
+    memcpy(&y, b + offset, sizeof(u64));
+    /* the lowest differing byte, as the host is little-endian */
+    if (x != y)
+      return offset + __builtin_ctzll(x ^ y) / 8;
+  }
+  for (; offset < len; offset++) {
+    if (a[offset] != b[offset])
+      break;
+  }
+  return offset;
+}
+
+static bool is_trace(const file_map_t *map) {
+  return map->size >= TRACE_MAGIC_SIZE &&
+         memcmp(map->data, TRACE_MAGIC, TRACE_MAGIC_SIZE) == 0;
+}
+
+/* prints the record of a trace at offset, decoded with a copy of the codec */
+static void print_side(const char *name, const trace_codec_t *codec,
+                       const file_map_t *map, size_t offset, u64 index) {
+  static trace_codec_t copy;
+  copy = *codec;
+  trace_record_t r;
+  printf("%s:", name);
+  if (trace_decode(&copy, map->data + offset, map->size - offset, &r) != 0)
+    trace_print_record(stdout, index, &r);
+  else
+    printf(" ends after %" PRIu64 " records\n", index);
+}
+
+static int diff_traces(const file_map_t *a, const file_map_t *b) {
+  size_t common = a->size < b->size ? a->size : b->size;
+  size_t diff = first_difference(a->data, b->data, common);
+  if (diff == common && a->size == b->size) {
+    printf("Traces are identical\n");
+    return EXIT_SUCCESS;
+  }
+
+  /* count the records before the one holding the first difference */
+  trace_codec_t *codec = malloc(sizeof(trace_codec_t));
+  if (codec == NULL)
+    return EXIT_FAILURE;
+  trace_codec_init(codec);
+  size_t offset = TRACE_MAGIC_SIZE;
+  u64 index = 0;
+  trace_record_t last;
+  bool has_last = false;
+  while (TRUE) {
+    trace_record_t r;
+    size_t n = trace_decode(codec, a->data + offset, diff - offset, &r);
+    if (n == 0)
+      break;
+    last = r;
+    offset += n;
+    index++;
+    has_last = true;
+  }
+
+  printf("Traces diverge at record %" PRIu64 " (byte %zu)\n", index, diff);
+  if (has_last) {
+    printf("last common:");
+    trace_print_record(stdout, index - 1, &last);
+  }
+  print_side("a", codec, a, offset, index);
+  print_side("b", codec, b, offset, index);
+  free(codec);
+  return EXIT_FAILURE;
+}
+
+/* prints the line of a text file around offset */
+static void print_line(const char *name, const file_map_t *map,
+                       size_t start) {
+  const u8 *end = memchr(map->data + start, '\n', map->size - start);
+  size_t len = (end != NULL ? (size_t)(end - map->data) : map->size) - start;
+  printf("%s: %.*s\n", name, (int)len, map->data + start);
+}
+
+static int diff_dumps(const file_map_t *a, const file_map_t *b) {
+  size_t common = a->size < b->size ? a->size : b->size;
+  size_t diff = first_difference(a->data, b->data, common);
+  if (diff == common && a->size == b->size) {
+    printf("Dumps are identical\n");
+    return EXIT_SUCCESS;
+  }
+
+  size_t line = 1, start = 0;
+  for (const u8 *p = a->data; (p = memchr(p, '\n', a->data + diff - p));
+       p++) {
+    line++;
+    start = p + 1 - a->data;
+  }
+  printf("Dumps diverge at line %zu\n", line);
+  print_line("a", a, start);
+  print_line("b", b, start);
+  return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fprintf(stderr, USAGE);
+    return EXIT_FAILURE;
+  }
+  file_map_t maps[2];
+  for (int i = 0; i < 2; i++) {
+    if (!map_file(argv[i + 1], &maps[i])) {
+      fprintf(stderr, "Could not read %s\n", argv[i + 1]);
+      return EXIT_FAILURE;
+    }
+  }
+  const file_map_t a = maps[0], b = maps[1];
+  if (is_trace(&a) != is_trace(&b)) {
+    fprintf(stderr, "Cannot compare a trace with a dump\n");
+    return EXIT_FAILURE;
+  }
+  return is_trace(&a) ? diff_traces(&a, &b) : diff_dumps(&a, &b);
+}
@@ -0,0 +1,118 @@
+#include "../defs.h"
+#include "../emulator/trace_format.h"
+#include "trace_print.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Prints a trace written by `emulate --trace`, one retired instruction per
+ * line. The trace is decoded as it is read, so it can be of any length.
+ */
+
+#define USAGE                                                                  \
+  "Usage: ./trace_dump [--pc addr] [--reg n] [--mem addr] [--limit n] "       \
+  "trace\n"
+
+#define READ_SIZE (1 << 16)
+
+typedef struct {
+  bool by_pc, by_reg, by_mem;
+  u64 pc, mem;
+  u8 reg;
+  u64 limit; /* records printed at most */
+} filter_t;
+
+static bool matches(const filter_t *f, const trace_record_t *r) {
+  if (f->by_pc && r->pc != f->pc)
+    return false;
+  if (f->by_reg && r->rd != f->reg && r->rd2 != f->reg)
+    return false;
+  /* a pair accesses twice the size */
+  u64 accessed = r->pair ? 2 * r->mem_size : r->mem_size;
+  if (f->by_mem && (accessed == 0 || f->mem - r->mem_address >= accessed))
+    return false;
+  return true;
+}
+
+int main(int argc, char **argv) {
+  filter_t filter = {.limit = UINT64_MAX};
+  const char *path = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--pc") == 0 && i + 1 < argc) {
+      filter.by_pc = true;
+      filter.pc = strtoull(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--reg") == 0 && i + 1 < argc) {
+      filter.by_reg = true;
+      filter.reg = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--mem") == 0 && i + 1 < argc) {
+      filter.by_mem = true;
+      filter.mem = strtoull(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc) {
+      filter.limit = strtoull(argv[++i], NULL, 0);
+    } else if (path == NULL) {
+      path = argv[i];
+    } else {
+      fprintf(stderr, USAGE);
+      return EXIT_FAILURE;
+    }
+  }
+  if (path == NULL) {
+    fprintf(stderr, USAGE);
+    return EXIT_FAILURE;
+  }
+
+  FILE *file = fopen(path, "rb");
+  char magic[TRACE_MAGIC_SIZE];
+  if (file == NULL || fread(magic, 1, TRACE_MAGIC_SIZE, file) !=
+                          TRACE_MAGIC_SIZE ||
+      memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0) {
+    fprintf(stderr, "%s is not a trace\n", path);
+    return EXIT_FAILURE;
+  }
+
+  trace_codec_t *codec = malloc(sizeof(trace_codec_t));
+  u8 *buffer = malloc(READ_SIZE);
+  if (codec == NULL || buffer == NULL)
+    return EXIT_FAILURE;
+  trace_codec_init(codec);
+
+  /* buffer holds [start, end), records are decoded until one is cut off */
+  size_t start = 0, end = 0;
+  u64 index = 0, printed = 0;
+  bool more = true;
+  while (printed < filter.limit) {
+    trace_record_t r;
+    size_t n = trace_decode(codec, buffer + start, end - start, &r);
+    if (n != 0) {
+      start += n;
+      if (matches(&filter, &r)) {
+        trace_print_record(stdout, index, &r);
+        printed++;
+      }
+      index++;
+      continue;
+    }
+    if (!more)
+      break;
+    /* keep the partial record and refill behind it */
+    memmove(buffer, buffer + start, end - start);
+    end -= start;
+    start = 0;
+    size_t got = fread(buffer + end, 1, READ_SIZE - end, file);
+    end += got;
+    more = got != 0;
+  }
+
+  int status = EXIT_SUCCESS;
+  if (printed < filter.limit && start != end) {
+    fprintf(stderr, "%s is truncated after %" PRIu64 " records\n", path,
+            index);
+    status = EXIT_FAILURE;
+  }
+  free(buffer);
+  free(codec);
+  fclose(file);
+  return status;
+}
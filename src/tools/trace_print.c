@@ -0,0 +1,20 @@
+#include "trace_print.h"
+#include <inttypes.h>
+
+void trace_print_record(FILE *out, u64 index, const trace_record_t *r) {
+  fprintf(out, "%10" PRIu64 " 0x%08" PRIx64 ": %08" PRIx32, index, r->pc,
+          r->word);
+  if (r->rd != TRACE_NO_REG)
+    fprintf(out, "  X%02d = %016" PRIx64, r->rd, r->rd_value);
+  if (r->rd2 != TRACE_NO_REG)
+    fprintf(out, "  X%02d = %016" PRIx64, r->rd2, r->rd2_value);
+  if (r->mem_size != 0) {
+    fprintf(out, "  %s 0x%" PRIx64 " = 0x%" PRIx64 " (%d)",
+            r->mem_write ? "store" : "load", r->mem_address, r->mem_value,
+            r->mem_size);
+    if (r->pair)
+      fprintf(out, ", 0x%" PRIx64 " = 0x%" PRIx64,
+              r->mem_address + r->mem_size, r->mem_value2);
+  }
+  fprintf(out, "\n");
+}
@@ -0,0 +1,14 @@
+#ifndef TRACE_PRINT
+#define TRACE_PRINT
+
+#include "../defs.h"
+#include "../emulator/trace_format.h"
+#include <stdio.h>
+
+/**
+ * Writes a trace record as one line: its index, address and instruction
+ * word, then the register it wrote and the memory it accessed, if any.
+ */
+void trace_print_record(FILE *out, u64 index, const trace_record_t *r);
+
+#endif /* TRACE_PRINT */